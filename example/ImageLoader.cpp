@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//============================================================================
+/// \file   ImageLoader.cpp
+/// \date   19.10.2020
+/// \brief  Implementation of the ImageLoader class.
+//============================================================================
+
+//============================================================================
+//                                   INCLUDES
+//============================================================================
+#include "ImageLoader.h"
+
+#include "raw-decode-control.h"
+
+#include <QImageReader>
+#include <QRunnable>
+
+/**
+ * @brief The pyramid stops at the first level whose longer side is at most
+ * this many pixels.
+ */
+static constexpr int SmallestLevel = 512;
+
+/**
+ * @brief Decodes one image and builds its pyramid on a worker thread.
+ */
+class DecodeJob : public QRunnable
+{
+public:
+    DecodeJob(ImageLoader* Loader, const QString& FileName, quint64 Id, bool WithPreview,
+              const QSharedPointer<RawDecodeControl>& Control)
+        : m_Loader(Loader),
+          m_FileName(FileName),
+          m_Id(Id),
+          m_WithPreview(WithPreview),
+          m_Control(Control)
+    {}
+
+    void run() override
+    {
+        if (m_WithPreview && !m_Control->isCanceled())
+        {
+            // the embedded preview takes a few milliseconds, so the user
+            // sees something while the raw data is being decoded
+            QImageReader Reader{m_FileName};
+            Reader.setAutoTransform(true);
+            if (Reader.format() == "raw")
+            {
+                Reader.device()->setProperty("qtraw_source", "preview");
+                const auto Preview = Reader.read();
+                if (!Preview.isNull())
+                {
+                    report(ImagePyramid{Preview}, true, QString());
+                }
+            }
+        }
+
+        QImageReader Reader{m_FileName};
+        Reader.setAutoTransform(true);
+        Reader.device()->setProperty("qtraw_decode_control", QVariant::fromValue(m_Control));
+        const auto Image = Reader.read();
+        if (Image.isNull())
+        {
+            report(ImagePyramid{}, false, Reader.errorString());
+            return;
+        }
+
+        // every level is halved from the one before, so each costs only a
+        // quarter of the previous one and the full image is scaled just once
+        auto Levels = ImagePyramid{Image};
+        while (qMax(Levels.constLast().width(), Levels.constLast().height()) > SmallestLevel &&
+               !m_Control->isCanceled())
+        {
+            const auto& Last = Levels.constLast();
+            Levels.append(Last.scaled(qMax(Last.width() / 2, 1), qMax(Last.height() / 2, 1),
+                                      Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+        }
+        report(Levels, false, QString());
+    }
+
+private:
+    void report(const ImagePyramid& Levels, bool Preview, const QString& Error)
+    {
+        QMetaObject::invokeMethod(m_Loader, "finish", Qt::QueuedConnection,
+                                  Q_ARG(QString, m_FileName), Q_ARG(quint64, m_Id),
+                                  Q_ARG(ImagePyramid, Levels),
+                                  Q_ARG(bool, Preview), Q_ARG(QString, Error));
+    }
+
+    ImageLoader* m_Loader;
+    QString m_FileName;
+    quint64 m_Id;
+    bool m_WithPreview;
+    QSharedPointer<RawDecodeControl> m_Control;
+};
+
+//============================================================================
+ImageLoader::ImageLoader(qint64 MemoryBudget, QObject* parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<ImagePyramid>("ImagePyramid");
+
+    // the cache counts in KiB, so that large budgets fit into an int
+    m_Cache.setMaxCost(int(MemoryBudget / 1024));
+
+    // one thread for the current image and one for each neighbour
+    m_Pool.setMaxThreadCount(3);
+}
+
+//============================================================================
+ImageLoader::~ImageLoader()
+{
+    for (const auto& Running : m_Jobs)
+    {
+        Running.Control->cancel();
+    }
+    m_Pool.waitForDone();
+}
+
+//============================================================================
+void ImageLoader::load(const QString& FileName)
+{
+    m_Current = FileName;
+    m_CurrentShown = false;
+    m_LoadTimer.start();
+
+    if (auto* Levels = m_Cache.object(FileName))
+    {
+        m_CurrentShown = true;
+        emit imageLoaded(FileName, *Levels, m_LoadTimer.elapsed(), true);
+        return;
+    }
+    if (isRunning(FileName))
+    {
+        // a prefetch is already on its way
+        return;
+    }
+    start(FileName, true);
+}
+
+//============================================================================
+void ImageLoader::prefetch(const QString& FileName)
+{
+    if (!m_Cache.contains(FileName) && !isRunning(FileName))
+    {
+        start(FileName, false);
+    }
+}
+
+//============================================================================
+void ImageLoader::keepOnly(const QStringList& FileNames)
+{
+    for (auto it = m_Jobs.cbegin(); it != m_Jobs.cend(); ++it)
+    {
+        if (!FileNames.contains(it.key()))
+        {
+            it->Control->cancel();
+        }
+    }
+}
+
+//============================================================================
+void ImageLoader::start(const QString& FileName, bool Current)
+{
+    auto NewJob = Job{};
+    NewJob.Control = QSharedPointer<RawDecodeControl>::create();
+    NewJob.Id = ++m_NextJobId;
+    NewJob.Prefetch = !Current;
+
+    // a canceled job that is still winding down is replaced
+    m_Jobs.insert(FileName, NewJob);
+
+    // the current image overtakes queued prefetches
+    m_Pool.start(new DecodeJob(this, FileName, NewJob.Id, Current, NewJob.Control),
+                 Current ? 1 : 0);
+}
+
+//============================================================================
+bool ImageLoader::isRunning(const QString& FileName) const
+{
+    const auto it = m_Jobs.constFind(FileName);
+    return it != m_Jobs.cend() && !it->Control->isCanceled();
+}
+
+//============================================================================
+void ImageLoader::finish(const QString& FileName, quint64 JobId, const ImagePyramid& Levels,
+                         bool Preview, const QString& Error)
+{
+    const auto it = m_Jobs.constFind(FileName);
+    if (it == m_Jobs.cend() || it->Id != JobId)
+    {
+        // the job has been replaced in the meantime
+        return;
+    }
+
+    const auto IsCurrent = FileName == m_Current;
+    if (Preview)
+    {
+        if (IsCurrent && !m_CurrentShown)
+        {
+            emit previewLoaded(FileName, Levels.constFirst(), m_LoadTimer.elapsed());
+        }
+        return;
+    }
+
+    const auto Finished = m_Jobs.take(FileName);
+    if (Finished.Control->isCanceled())
+    {
+        return;
+    }
+    if (Levels.isEmpty())
+    {
+        if (IsCurrent)
+        {
+            emit loadFailed(FileName, Error);
+        }
+        return;
+    }
+
+    auto Cost = qint64{};
+    for (const auto& Level : Levels)
+    {
+        Cost += Level.sizeInBytes();
+    }
+    m_Cache.insert(FileName, new ImagePyramid(Levels), int(Cost / 1024));
+    if (IsCurrent)
+    {
+        m_CurrentShown = true;
+        emit imageLoaded(FileName, Levels, m_LoadTimer.elapsed(), Finished.Prefetch);
+    }
+}
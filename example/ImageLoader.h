@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//============================================================================
+/// \file   ImageLoader.h
+/// \date   19.10.2020
+/// \brief  Declaration of the ImageLoader class.
+//============================================================================
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+//============================================================================
+//                                   INCLUDES
+//============================================================================
+#include <QCache>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QVector>
+
+//============================================================================
+//                            FORWARD DECLARATIONS
+//============================================================================
+class RawDecodeControl;
+
+/**
+ * @brief The levels of a decoded image. Level 0 is the full image, every
+ * further level is half the size of the one before.
+ */
+using ImagePyramid = QVector<QImage>;
+
+/**
+ * @brief The ImageLoader class decodes images on worker threads.
+ *
+ * The image that is shown is decoded first as its embedded preview and then
+ * in full, together with the pyramid that is used for zooming. Its neighbours
+ * are prefetched into a cache, which is limited by a memory budget. Decodes
+ * of images that are no longer needed are canceled.
+ */
+class ImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Construct an ImageLoader that caches up to @a MemoryBudget bytes
+     * of decoded images.
+     */
+    explicit ImageLoader(qint64 MemoryBudget, QObject* parent = nullptr);
+
+    /**
+     * Rule of five.
+     */
+    ImageLoader(const ImageLoader& rhs) = delete;
+    ImageLoader& operator=(const ImageLoader& rhs) = delete;
+    ImageLoader(const ImageLoader&& rhs) = delete;
+    ImageLoader& operator=(const ImageLoader&& rhs) = delete;
+
+    /**
+     * @brief Cancels all decodes and waits for the worker threads.
+     */
+    ~ImageLoader() override;
+
+    /**
+     * @brief Loads the image @a FileName that is to be shown.
+     *
+     * previewLoaded() is emitted as soon as the embedded preview is decoded,
+     * imageLoaded() once the full image is available.
+     */
+    void load(const QString& FileName);
+
+    /**
+     * @brief Decodes the image @a FileName into the cache in the background.
+     */
+    void prefetch(const QString& FileName);
+
+    /**
+     * @brief Cancels the decodes of all images except @a FileNames.
+     */
+    void keepOnly(const QStringList& FileNames);
+
+signals:
+    /**
+     * @brief The embedded preview of the current image @a FileName has been
+     * decoded @a LatencyMs milliseconds after load().
+     */
+    void previewLoaded(const QString& FileName, const QImage& Image, qint64 LatencyMs);
+
+    /**
+     * @brief The current image @a FileName has been decoded into the pyramid
+     * @a Levels @a LatencyMs milliseconds after load(). @a Prefetched tells if
+     * it came from the cache or from a prefetch that was already running.
+     */
+    void imageLoaded(const QString& FileName, const ImagePyramid& Levels, qint64 LatencyMs,
+                     bool Prefetched);
+
+    /**
+     * @brief The current image @a FileName could not be decoded.
+     */
+    void loadFailed(const QString& FileName, const QString& Error);
+
+private:
+    /**
+     * @brief Called by the worker threads when the preview or the full image
+     * of @a FileName is decoded by the job @a JobId. The preview has a
+     * single level.
+     */
+    Q_INVOKABLE void finish(const QString& FileName, quint64 JobId, const ImagePyramid& Levels,
+                            bool Preview, const QString& Error);
+
+    /**
+     * @brief Starts decoding @a FileName, with a preview first if @a Current.
+     */
+    void start(const QString& FileName, bool Current);
+
+    /**
+     * @brief Returns true if @a FileName is being decoded and has not been
+     * canceled.
+     */
+    bool isRunning(const QString& FileName) const;
+
+    /**
+     * @brief A running decode.
+     */
+    struct Job
+    {
+        QSharedPointer<RawDecodeControl> Control;
+        quint64 Id{};
+        bool Prefetch{};
+    };
+
+    QThreadPool m_Pool;
+    QHash<QString, Job> m_Jobs;
+    QCache<QString, ImagePyramid> m_Cache;
+    QString m_Current;
+    QElapsedTimer m_LoadTimer;
+    quint64 m_NextJobId{};
+    bool m_CurrentShown{};
+};
+
+#endif // IMAGELOADER_H
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//============================================================================
+/// \file   ImageView.cpp
+/// \date   19.10.2020
+/// \brief  Implementation of the ImageView class.
+//============================================================================
+
+//============================================================================
+//                                   INCLUDES
+//============================================================================
+#include "ImageView.h"
+
+#include <QPaintEvent>
+#include <QPainter>
+
+//============================================================================
+ImageView::ImageView(QWidget* parent)
+    : QWidget(parent)
+{
+    // every paint event covers the exposed area completely
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+//============================================================================
+void ImageView::setPyramid(const ImagePyramid& Levels, bool KeepSize)
+{
+    const auto DisplayedWidth = width();
+    m_Levels = Levels;
+    if (KeepSize && !m_Levels.isEmpty() && m_Levels.constFirst().width() > 0)
+    {
+        m_ScaleFactor = double(DisplayedWidth) / m_Levels.constFirst().width();
+    }
+    else
+    {
+        m_ScaleFactor = 1.0;
+        resize(sizeHint());
+    }
+    update();
+}
+
+//============================================================================
+QSize ImageView::imageSize() const
+{
+    return m_Levels.isEmpty() ? QSize() : m_Levels.constFirst().size();
+}
+
+//============================================================================
+double ImageView::scaleFactor() const
+{
+    return m_ScaleFactor;
+}
+
+//============================================================================
+void ImageView::setScaleFactor(double Factor)
+{
+    m_ScaleFactor = Factor;
+    resize(sizeHint());
+}
+
+//============================================================================
+QSize ImageView::sizeHint() const
+{
+    return m_ScaleFactor * imageSize();
+}
+
+//============================================================================
+int ImageView::levelFor(double Scale) const
+{
+    auto Level = 0;
+    while (Level + 1 < m_Levels.size() && Scale * double(1 << (Level + 1)) <= 1.0)
+    {
+        ++Level;
+    }
+    return Level;
+}
+
+//============================================================================
+void ImageView::paintEvent(QPaintEvent* Event)
+{
+    QPainter Painter{this};
+    const auto Target = Event->rect();
+    if (m_Levels.isEmpty() || width() <= 0 || height() <= 0)
+    {
+        Painter.fillRect(Target, palette().base());
+        return;
+    }
+
+    // the widget may have been stretched to fit the window, so the actual
+    // scale is taken from its size rather than from m_ScaleFactor
+    const auto& Full = m_Levels.constFirst();
+    const auto ScaleX = double(width()) / Full.width();
+    const auto ScaleY = double(height()) / Full.height();
+    const auto& Level = m_Levels.at(levelFor(qMax(ScaleX, ScaleY)));
+
+    const auto FactorX = double(Level.width()) / width();
+    const auto FactorY = double(Level.height()) / height();
+    const auto Source = QRectF(Target.x() * FactorX, Target.y() * FactorY,
+                               Target.width() * FactorX, Target.height() * FactorY);
+
+    // the level is at most twice as large as the displayed image, so a
+    // bilinear filter is enough
+    Painter.setRenderHint(QPainter::SmoothPixmapTransform, FactorX != 1.0 || FactorY != 1.0);
+    Painter.drawImage(QRectF(Target), Level, Source);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//============================================================================
+/// \file   ImageView.h
+/// \date   19.10.2020
+/// \brief  Declaration of the ImageView class.
+//============================================================================
+
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+//============================================================================
+//                                   INCLUDES
+//============================================================================
+#include "ImageLoader.h"
+
+#include <QWidget>
+
+/**
+ * @brief The ImageView class paints an ImagePyramid at any zoom factor.
+ *
+ * Every paint event draws only the exposed part of the widget, taken from the
+ * smallest level that is still at least as large as the displayed image. So
+ * zooming and panning never scale the full image as a whole.
+ */
+class ImageView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @brief Construct an empty ImageView with @a parent as the parent widget.
+     */
+    explicit ImageView(QWidget* parent = nullptr);
+
+    /**
+     * Rule of five.
+     */
+    ImageView(const ImageView& rhs) = delete;
+    ImageView& operator=(const ImageView& rhs) = delete;
+    ImageView(const ImageView&& rhs) = delete;
+    ImageView& operator=(const ImageView&& rhs) = delete;
+
+    /**
+     * @brief Destruct an ImageView.
+     */
+    ~ImageView() override = default;
+
+    /**
+     * @brief Shows the image @a Levels.
+     *
+     * If @a KeepSize is set the widget keeps its size and the scale factor
+     * is adapted instead, which lets a full image replace its smaller preview
+     * without a jump. Otherwise the scale factor is reset to 1.
+     */
+    void setPyramid(const ImagePyramid& Levels, bool KeepSize);
+
+    /**
+     * @brief Returns the size of the full image.
+     */
+    QSize imageSize() const;
+
+    /**
+     * @brief Returns the factor by which the full image is scaled.
+     */
+    double scaleFactor() const;
+
+    /**
+     * @brief Resizes the widget to the full image scaled by @a Factor.
+     */
+    void setScaleFactor(double Factor);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent* Event) override;
+
+private:
+    /**
+     * @brief Returns the index of the level that is drawn at @a Scale.
+     */
+    int levelFor(double Scale) const;
+
+    ImagePyramid m_Levels;
+    double m_ScaleFactor{1};
+};
+
+#endif // IMAGEVIEW_H
@@ -58,13 +58,15 @@
 //                                   INCLUDES
 //============================================================================
 #include "MainWindow.h"
+#include "ImageLoader.h"
+#include "ImageView.h"
 
 #include <QAction>
 #include <QApplication>
 #include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QImageReader>
-#include <QLabel>
 #include <QMenu>
 #include <QMenuBar>
 #include <QMessageBox>
@@ -72,23 +74,34 @@
 #include <QScrollArea>
 #include <QScrollBar>
 #include <QStandardPaths>
+#include <QStatusBar>
+
+/**
+ * @brief The memory that prefetched images may take up.
+ */
+static constexpr qint64 PrefetchBudget = 768LL * 1024 * 1024;
 
 //============================================================================
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent),
-      m_ImageLabel(new QLabel),
+      m_Loader(new ImageLoader(PrefetchBudget, this)),
+      m_ImageView(new ImageView),
       m_ScrollArea(new QScrollArea)
 {
-    m_ImageLabel->setBackgroundRole(QPalette::Base);
-    m_ImageLabel->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
-    m_ImageLabel->setScaledContents(true);
+    connect(m_Loader, &ImageLoader::previewLoaded, this, &MainWindow::previewLoaded);
+    connect(m_Loader, &ImageLoader::imageLoaded, this, &MainWindow::imageLoaded);
+    connect(m_Loader, &ImageLoader::loadFailed, this, &MainWindow::loadFailed);
+
+    m_ImageView->setBackgroundRole(QPalette::Base);
+    m_ImageView->setSizePolicy(QSizePolicy::Ignored, QSizePolicy::Ignored);
 
     m_ScrollArea->setBackgroundRole(QPalette::Dark);
-    m_ScrollArea->setWidget(m_ImageLabel);
+    m_ScrollArea->setWidget(m_ImageView);
     m_ScrollArea->setVisible(false);
     setCentralWidget(m_ScrollArea);
 
     createActions();
+    statusBar();
 
     resize(QGuiApplication::primaryScreen()->availableSize() * 3 / 5);
 }
@@ -106,6 +119,16 @@ void MainWindow::createActions()
     auto ExitAct = FileMenu->addAction(tr("E&xit"), this, &QWidget::close);
     ExitAct->setShortcut(tr("Ctrl+Q"));
 
+    auto GoMenu = menuBar()->addMenu(tr("&Go"));
+
+    m_NextAct = GoMenu->addAction(tr("&Next Image"), this, &MainWindow::nextImage);
+    m_NextAct->setShortcut(tr("Ctrl+Right"));
+    m_NextAct->setEnabled(false);
+
+    m_PreviousAct = GoMenu->addAction(tr("&Previous Image"), this, &MainWindow::previousImage);
+    m_PreviousAct->setShortcut(tr("Ctrl+Left"));
+    m_PreviousAct->setEnabled(false);
+
     auto ViewMenu = menuBar()->addMenu(tr("&View"));
 
     m_ZoomInAct = ViewMenu->addAction(tr("Zoom &In (25%)"), this, &MainWindow::zoomIn);
@@ -134,6 +157,8 @@ void MainWindow::updateActions()
     m_ZoomInAct->setEnabled(!m_FitToWindowAct->isChecked());
     m_ZoomOutAct->setEnabled(!m_FitToWindowAct->isChecked());
     m_NormalSizeAct->setEnabled(!m_FitToWindowAct->isChecked());
+    m_NextAct->setEnabled(m_CurrentIndex + 1 < m_Files.size());
+    m_PreviousAct->setEnabled(m_CurrentIndex > 0);
 }
 
 //============================================================================
@@ -165,39 +190,135 @@ void MainWindow::open()
     QFileDialog Dialog{this, tr("Open File")};
     initializeImageFileDialog(Dialog);
 
-    while (Dialog.exec() == QDialog::Accepted &&
-           !loadImage(Dialog.selectedFiles().constFirst())) {}
+    if (Dialog.exec() == QDialog::Accepted)
+    {
+        loadImage(Dialog.selectedFiles().constFirst());
+    }
+}
+
+//============================================================================
+void MainWindow::loadImage(const QString& FileName)
+{
+    listDirectory(FileName);
+    const auto Index = m_Files.indexOf(QFileInfo(FileName).absoluteFilePath());
+    if (Index < 0)
+    {
+        // not a supported file name suffix, so there are no neighbours
+        m_Files = QStringList{QFileInfo(FileName).absoluteFilePath()};
+    }
+    showImageAt(qMax(Index, 0));
+}
+
+//============================================================================
+void MainWindow::listDirectory(const QString& FileName)
+{
+    auto NameFilters = QStringList{};
+    const auto SupportedFormats = QImageReader::supportedImageFormats();
+    for (const auto& Format : SupportedFormats)
+    {
+        NameFilters.append(QLatin1String("*.") + QString::fromLatin1(Format));
+    }
+
+    const auto Dir = QFileInfo(FileName).absoluteDir();
+    m_Files.clear();
+    const auto Entries = Dir.entryInfoList(NameFilters, QDir::Files, QDir::Name | QDir::IgnoreCase);
+    for (const auto& Entry : Entries)
+    {
+        m_Files.append(Entry.absoluteFilePath());
+    }
 }
 
 //============================================================================
-bool MainWindow::loadImage(const QString& FileName)
+void MainWindow::showImageAt(int Index)
 {
-    QImageReader Reader{FileName};
-    Reader.setAutoTransform(true);
+    m_CurrentIndex = Index;
+    m_ShowingPreview = false;
+    const auto& FileName = m_Files.at(Index);
 
-    const auto NewImage = Reader.read();
+    // only the current image and its direct neighbours are worth decoding
+    auto Wanted = QStringList{FileName};
+    if (Index + 1 < m_Files.size())
+    {
+        Wanted.append(m_Files.at(Index + 1));
+    }
+    if (Index > 0)
+    {
+        Wanted.append(m_Files.at(Index - 1));
+    }
+    m_Loader->keepOnly(Wanted);
 
-    if (NewImage.isNull())
+    statusBar()->showMessage(tr("Loading %1...").arg(QDir::toNativeSeparators(FileName)));
+    m_Loader->load(FileName);
+    for (const auto& Neighbour : Wanted.mid(1))
     {
-        QMessageBox::critical(this, QGuiApplication::applicationDisplayName(),
-                              tr("Cannot load %1: %2")
-                              .arg(QDir::toNativeSeparators(FileName), Reader.errorString()));
-        return false;
+        m_Loader->prefetch(Neighbour);
     }
-    m_Image = NewImage;
-    m_ImageLabel->setPixmap(QPixmap::fromImage(m_Image));
-    m_ScaleFactor = 1.0;
 
-    m_ScrollArea->setVisible(true);
-    m_FitToWindowAct->setEnabled(true);
+    setWindowFilePath(FileName);
     updateActions();
+}
+
+//============================================================================
+void MainWindow::nextImage()
+{
+    if (m_CurrentIndex + 1 < m_Files.size())
+    {
+        showImageAt(m_CurrentIndex + 1);
+    }
+}
 
-    if (!m_FitToWindowAct->isChecked())
+//============================================================================
+void MainWindow::previousImage()
+{
+    if (m_CurrentIndex > 0)
     {
-        m_ImageLabel->adjustSize();
+        showImageAt(m_CurrentIndex - 1);
     }
+}
+
+//============================================================================
+void MainWindow::previewLoaded(const QString& FileName, const QImage& Image, qint64 LatencyMs)
+{
+    Q_UNUSED(FileName)
+    setImage(ImagePyramid{Image}, false);
+    m_ShowingPreview = true;
+    statusBar()->showMessage(tr("Preview after %1 ms, decoding...").arg(LatencyMs));
+}
 
-    return true;
+//============================================================================
+void MainWindow::imageLoaded(const QString& FileName, const ImagePyramid& Levels,
+                             qint64 LatencyMs, bool Prefetched)
+{
+    Q_UNUSED(FileName)
+
+    // the full image replaces the preview at the same zoom
+    setImage(Levels, m_ShowingPreview);
+    m_ShowingPreview = false;
+    statusBar()->showMessage(tr("%1 x %2, loaded in %3 ms%4")
+                             .arg(Levels.constFirst().width())
+                             .arg(Levels.constFirst().height())
+                             .arg(LatencyMs)
+                             .arg(Prefetched ? tr(" (prefetched)") : QString()));
+}
+
+//============================================================================
+void MainWindow::loadFailed(const QString& FileName, const QString& Error)
+{
+    statusBar()->clearMessage();
+    QMessageBox::critical(this, QGuiApplication::applicationDisplayName(),
+                          tr("Cannot load %1: %2")
+                          .arg(QDir::toNativeSeparators(FileName), Error));
+}
+
+//============================================================================
+void MainWindow::setImage(const ImagePyramid& Levels, bool KeepScale)
+{
+    // when fitting to the window the scroll area controls the size
+    m_ImageView->setPyramid(Levels, KeepScale || m_FitToWindowAct->isChecked());
+
+    m_ScrollArea->setVisible(true);
+    m_FitToWindowAct->setEnabled(true);
+    updateActions();
 }
 
 //============================================================================
@@ -215,8 +336,7 @@ void MainWindow::zoomOut()
 //============================================================================
 void MainWindow::normalSize()
 {
-    m_ImageLabel->adjustSize();
-    m_ScaleFactor = 1.0;
+    m_ImageView->setScaleFactor(1.0);
 }
 
 //============================================================================
@@ -234,9 +354,8 @@ void MainWindow::fitToWindow()
 //============================================================================
 void MainWindow::scaleImage(double Factor)
 {
-    Q_ASSERT(m_ImageLabel->pixmap());
-    m_ScaleFactor *= Factor;
-    m_ImageLabel->resize(m_ScaleFactor * m_ImageLabel->pixmap()->size());
+    Q_ASSERT(m_ImageView->imageSize().isValid());
+    m_ImageView->setScaleFactor(m_ImageView->scaleFactor() * Factor);
 
     /**
      * @brief Set the value of the given @a ScrollBar according to @b Factor.
@@ -251,6 +370,6 @@ void MainWindow::scaleImage(double Factor)
     adjustScrollBar(m_ScrollArea->horizontalScrollBar());
     adjustScrollBar(m_ScrollArea->verticalScrollBar());
 
-    m_ZoomInAct->setEnabled(m_ScaleFactor < 6.0);
-    m_ZoomOutAct->setEnabled(m_ScaleFactor > 0.167);
+    m_ZoomInAct->setEnabled(m_ImageView->scaleFactor() < 6.0);
+    m_ZoomOutAct->setEnabled(m_ImageView->scaleFactor() > 0.167);
 }
@@ -60,13 +60,14 @@
 //============================================================================
 //                                   INCLUDES
 //============================================================================
-#include <QImage>
+#include "ImageLoader.h"
+
 #include <QMainWindow>
 
 //============================================================================
 //                            FORWARD DECLARATIONS
 //============================================================================
-class QLabel;
+class ImageView;
 class QScrollArea;
 class QScrollBar;
 class QAction;
@@ -114,10 +115,20 @@ public:
     void open();
 
     /**
-     * @brief Loads the image from the file specified by @a FileName into the
-     * internal QImage object.
+     * @brief Starts loading the image from the file specified by @a FileName
+     * in the background and prefetches its neighbours in the same directory.
+     */
+    void loadImage(const QString& FileName);
+
+    /**
+     * @brief Shows the next image in the directory.
+     */
+    void nextImage();
+
+    /**
+     * @brief Shows the previous image in the directory.
      */
-    bool loadImage(const QString& FileName);
+    void previousImage();
 
     /**
      * @brief Zoom into the image by 25%.
@@ -140,20 +151,58 @@ public:
     void fitToWindow();
 
     /**
-     * @brief Scales the internal QImage object by the given @a Factor.
+     * @brief Scales the displayed image by the given @a Factor.
      */
     void scaleImage(double Factor);
 
 private:
-    QImage m_Image;
-    QLabel* m_ImageLabel{};
+    /**
+     * @brief Shows the embedded preview of the current image until the full
+     * image is decoded.
+     */
+    void previewLoaded(const QString& FileName, const QImage& Image, qint64 LatencyMs);
+
+    /**
+     * @brief Shows the fully decoded current image.
+     */
+    void imageLoaded(const QString& FileName, const ImagePyramid& Levels, qint64 LatencyMs,
+                     bool Prefetched);
+
+    /**
+     * @brief Tells the user that the current image could not be loaded.
+     */
+    void loadFailed(const QString& FileName, const QString& Error);
+
+    /**
+     * @brief Displays the image @a Levels, keeping the displayed size if
+     * @a KeepScale is set.
+     */
+    void setImage(const ImagePyramid& Levels, bool KeepScale);
+
+    /**
+     * @brief Lists the images in the directory of @a FileName.
+     */
+    void listDirectory(const QString& FileName);
+
+    /**
+     * @brief Loads the image at @a Index in the directory listing.
+     */
+    void showImageAt(int Index);
+
+    ImageLoader* m_Loader{};
+    QStringList m_Files;
+    int m_CurrentIndex{-1};
+    bool m_ShowingPreview{};
+
+    ImageView* m_ImageView{};
     QScrollArea* m_ScrollArea{};
-    double m_ScaleFactor{1};
 
     QAction* m_ZoomInAct{};
     QAction* m_ZoomOutAct{};
     QAction* m_NormalSizeAct{};
     QAction* m_FitToWindowAct{};
+    QAction* m_NextAct{};
+    QAction* m_PreviousAct{};
 };
 
 #endif // MAINWINDOW_H
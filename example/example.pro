@@ -19,9 +19,16 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 CONFIG += c++11
 
+# for the decode control of the raw plugin
+INCLUDEPATH += ../src
+
 SOURCES += \
         main.cpp \
+        ImageLoader.cpp \
+        ImageView.cpp \
         MainWindow.cpp
 
 HEADERS += \
+        ImageLoader.h \
+        ImageView.h \
         MainWindow.h
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "converter.h"
+#include "work-queue.h"
+
+#include "buffer-pool.h"
+#include "raw-io-handler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <QBuffer>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageWriter>
+#include <QSaveFile>
+
+using namespace std;
+
+/**
+ * @brief One file on its way through the pipeline.
+ */
+struct Converter::Job
+{
+    QString file;
+    QByteArray data;
+    QString error;
+    QSize size;
+    double readMs{};
+    double decodeMs{};
+    double encodeMs{};
+    double writeMs{};
+};
+
+//============================================================================
+/**
+ * @brief Returns the milliseconds that have passed since @a timer was
+ * (re)started and restarts it.
+ */
+static double lap(QElapsedTimer* timer)
+{
+    const auto ms = timer->nsecsElapsed() / 1e6;
+    timer->restart();
+    return ms;
+}
+
+//============================================================================
+Converter::Converter(const ConvertOptions& options) :
+    m_options(options)
+{
+}
+
+//============================================================================
+Converter::~Converter() = default;
+
+//============================================================================
+QString Converter::outputPath(const QString& file) const
+{
+    const auto info = QFileInfo(file);
+    const auto directory = m_options.outputDirectory.isEmpty() ?
+                           info.absolutePath() : m_options.outputDirectory;
+    return QDir(directory).filePath(info.completeBaseName() + QLatin1Char('.') +
+                                    QString::fromLatin1(m_options.format));
+}
+
+//============================================================================
+void Converter::convert(Job* job, QImage* image) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QBuffer input(&job->data);
+    input.open(QIODevice::ReadOnly);
+    RawIOHandler handler;
+    handler.setDevice(&input);
+    handler.setRawOption(RawIOHandler::Source, m_options.source);
+    if (m_options.size.isValid())
+    {
+        const auto fullSize = handler.option(QImageIOHandler::Size).toSize();
+        if (fullSize.width() > m_options.size.width() ||
+            fullSize.height() > m_options.size.height())
+        {
+            handler.setOption(QImageIOHandler::ScaledSize,
+                              fullSize.scaled(m_options.size, Qt::KeepAspectRatio));
+        }
+    }
+    const auto decoded = handler.read(image);
+    job->decodeMs = lap(&timer);
+
+    // the raw data isn't needed anymore
+    input.close();
+    job->data.clear();
+    if (!decoded)
+    {
+        job->error = QStringLiteral("could not decode the raw image");
+        return;
+    }
+    job->size = image->size();
+
+    QBuffer output(&job->data);
+    output.open(QIODevice::WriteOnly);
+    QImageWriter writer(&output, m_options.format);
+    writer.setQuality(m_options.quality);
+    if (!writer.write(*image))
+    {
+        job->error = writer.errorString();
+    }
+    job->encodeMs = lap(&timer);
+}
+
+//============================================================================
+int Converter::run(const QStringList& files)
+{
+    const auto jobs = size_t(max(1, m_options.jobs));
+    WorkQueue<Job> decodeQueue(jobs * 2);
+    WorkQueue<Job> writeQueue(jobs * 2);
+
+    QElapsedTimer batchTimer;
+    batchTimer.start();
+
+    // Stage 1: read the raw files ahead of the workers
+    thread reader([&files, &decodeQueue]
+                  {
+                      for (const auto& file : files)
+                      {
+                          QElapsedTimer timer;
+                          timer.start();
+                          auto job = Job{};
+                          job.file = file;
+                          QFile input(file);
+                          if (input.open(QIODevice::ReadOnly))
+                          {
+                              job.data = input.readAll();
+                          }
+                          else
+                          {
+                              job.error = input.errorString();
+                          }
+                          job.readMs = lap(&timer);
+                          decodeQueue.push(move(job));
+                      }
+                      decodeQueue.close();
+                  });
+
+    // Stage 2: decode and encode, every worker with its own frame buffer
+    auto workers = vector<thread>{};
+    for (size_t i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back([this, &decodeQueue, &writeQueue]
+                             {
+                                 auto image = QImage{};
+                                 auto job = Job{};
+                                 while (decodeQueue.pop(&job))
+                                 {
+                                     if (job.error.isEmpty())
+                                     {
+                                         convert(&job, &image);
+                                     }
+                                     writeQueue.push(move(job));
+                                 }
+                             });
+    }
+
+    // Stage 3: write the results and report on them
+    auto failed = 0;
+    auto converted = 0;
+    auto inputBytes = qint64{};
+    auto outputPixels = qint64{};
+    thread writer([this, &writeQueue, &failed, &converted, &outputPixels]
+                  {
+                      auto job = Job{};
+                      while (writeQueue.pop(&job))
+                      {
+                          QElapsedTimer timer;
+                          timer.start();
+                          const auto path = outputPath(job.file);
+                          if (job.error.isEmpty())
+                          {
+                              QSaveFile output(path);
+                              if (!output.open(QIODevice::WriteOnly) ||
+                                  output.write(job.data) != job.data.size() ||
+                                  !output.commit())
+                              {
+                                  job.error = output.errorString();
+                              }
+                          }
+                          job.writeMs = lap(&timer);
+
+                          if (!job.error.isEmpty())
+                          {
+                              ++failed;
+                              fprintf(stderr, "%s: %s\n", qPrintable(job.file),
+                                      qPrintable(job.error));
+                              continue;
+                          }
+                          ++converted;
+                          outputPixels += qint64(job.size.width()) * job.size.height();
+                          const auto total = job.readMs + job.decodeMs +
+                                             job.encodeMs + job.writeMs;
+                          printf("%s -> %s: %dx%d, read %.1f ms, decode %.1f ms, "
+                                 "encode %.1f ms, write %.1f ms, %.1f images/s\n",
+                                 qPrintable(job.file), qPrintable(path),
+                                 job.size.width(), job.size.height(), job.readMs,
+                                 job.decodeMs, job.encodeMs, job.writeMs,
+                                 total > 0 ? 1000.0 / total : 0.0);
+                          fflush(stdout);
+                      }
+                  });
+
+    reader.join();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    writeQueue.close();
+    writer.join();
+
+    for (const auto& file : files)
+    {
+        inputBytes += QFileInfo(file).size();
+    }
+    const auto seconds = max(batchTimer.nsecsElapsed() / 1e9, 1e-9);
+    printf("%d converted, %d failed in %.2f s: %.2f images/s, %.1f MB/s read, "
+           "%.1f MP/s written with %zu workers\n",
+           converted, failed, seconds, converted / seconds,
+           inputBytes / 1e6 / seconds, outputPixels / 1e6 / seconds, jobs);
+    const auto pool = BufferPool::global().statistics();
+    printf("Frame buffers: %lld reused, %lld allocated, %.1f MB peak, %.1f MB retained\n",
+           pool.hits, pool.misses, pool.peakBytesInUse / 1e6, pool.bytesRetained / 1e6);
+    return failed;
+}
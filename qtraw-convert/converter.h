@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+class QImage;
+
+/**
+ * @brief The options of a batch conversion.
+ */
+struct ConvertOptions
+{
+    /**
+     * The directory the converted images are written to. An empty directory
+     * puts every image next to its raw file.
+     */
+    QString outputDirectory;
+
+    /**
+     * The output format, e.g. "jpg", "png" or "tiff".
+     */
+    QByteArray format{"jpg"};
+
+    /**
+     * The size the images are scaled into, keeping their aspect ratio. An
+     * invalid size keeps the size of the raw image.
+     */
+    QSize size;
+
+    /**
+     * The quality of the output format, or -1 for its default.
+     */
+    int quality{-1};
+
+    /**
+     * The RawIOHandler::ImageSource, as its name.
+     */
+    QString source{"auto"};
+
+    /**
+     * The number of images that are decoded in parallel.
+     */
+    int jobs{1};
+};
+
+/**
+ * @brief The Converter class converts raw files in one process.
+ *
+ * The conversion runs as a pipeline: one thread reads the raw files ahead of
+ * time, a pool of workers decodes and encodes them, and another thread writes
+ * the results. That way the disk is busy while the workers decode, and every
+ * worker reuses its image buffer from one file to the next.
+ */
+class Converter
+{
+public:
+    /**
+     * @brief Construct a new Converter with the given @a options.
+     */
+    explicit Converter(const ConvertOptions& options);
+
+    /**
+     * @brief Destruct the Converter.
+     */
+    ~Converter();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(Converter);
+    Converter(const Converter&& rhs) = delete;
+    Converter& operator=(const Converter&& rhs) = delete;
+
+    /**
+     * @brief Converts all @a files and prints the throughput of every file
+     * and of the whole batch.
+     * @returns the number of files that could not be converted
+     */
+    int run(const QStringList& files);
+
+private:
+    struct Job;
+
+    /**
+     * @brief Decodes and encodes the raw data of @a job, using @a image as
+     * the frame buffer.
+     */
+    void convert(Job* job, QImage* image) const;
+
+    /**
+     * @brief Returns the path of the converted image of @a file.
+     */
+    QString outputPath(const QString& file) const;
+
+    ConvertOptions m_options;
+};
+
+#endif // CONVERTER_H
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "converter.h"
+
+#include "buffer-pool.h"
+#include "libraw-pool.h"
+#include "raw-formats.h"
+#include "raw-io-handler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QLibraryInfo>
+#include <QLoggingCategory>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QTextStream>
+#include <QThread>
+
+using namespace std;
+
+//============================================================================
+/**
+ * @brief Expands the command line argument @a argument into a list of files.
+ *
+ * Directories are searched for raw files, wildcards in the file name are
+ * expanded, and everything else is taken as a file name.
+ */
+static QStringList expandArgument(const QString& argument)
+{
+    const auto info = QFileInfo(argument);
+    if (info.isDir())
+    {
+        auto filters = QStringList{};
+        for (const auto& key : RawFormats::keys())
+        {
+            filters << QStringLiteral("*.") + key;
+        }
+        auto files = QStringList{};
+        for (const auto& entry : QDir(argument).entryInfoList(filters, QDir::Files,
+                                                              QDir::Name | QDir::IgnoreCase))
+        {
+            files << entry.filePath();
+        }
+        return files;
+    }
+
+    if (!argument.contains(QLatin1Char('*')) && !argument.contains(QLatin1Char('?')) &&
+        !argument.contains(QLatin1Char('[')))
+    {
+        return {argument};
+    }
+
+    auto files = QStringList{};
+    for (const auto& entry : info.dir().entryInfoList({info.fileName()}, QDir::Files,
+                                                      QDir::Name))
+    {
+        files << entry.filePath();
+    }
+    return files;
+}
+
+//============================================================================
+/**
+ * @brief Reads a list of files, one per line, from @a listFile ("-" for the
+ * standard input).
+ */
+static QStringList readFileList(const QString& listFile)
+{
+    QFile file(listFile);
+    const auto opened = listFile == QLatin1String("-") ?
+                        file.open(stdin, QIODevice::ReadOnly | QIODevice::Text) :
+                        file.open(QIODevice::ReadOnly | QIODevice::Text);
+    if (!opened)
+    {
+        fprintf(stderr, "Cannot read the file list %s: %s\n", qPrintable(listFile),
+                qPrintable(file.errorString()));
+        return {};
+    }
+
+    auto files = QStringList{};
+    QTextStream stream(&file);
+    while (!stream.atEnd())
+    {
+        const auto line = stream.readLine().trimmed();
+        if (!line.isEmpty())
+        {
+            files << line;
+        }
+    }
+    return files;
+}
+
+//============================================================================
+/**
+ * @brief Decodes @a file once, as the first thing after the start of the
+ * process, and prints how long LibRaw took to construct and the whole
+ * decode took in nanoseconds.
+ * @returns the exit code
+ */
+static int firstDecode(const QString& file, const ConvertOptions& options)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QFile input(file);
+    if (!input.open(QIODevice::ReadOnly))
+    {
+        return 1;
+    }
+    RawIOHandler handler;
+    handler.setDevice(&input);
+    handler.setRawOption(RawIOHandler::Source, options.source);
+    if (options.size.isValid())
+    {
+        const auto fullSize = handler.option(QImageIOHandler::Size).toSize();
+        if (fullSize.width() > options.size.width() ||
+            fullSize.height() > options.size.height())
+        {
+            handler.setOption(QImageIOHandler::ScaledSize,
+                              fullSize.scaled(options.size, Qt::KeepAspectRatio));
+        }
+    }
+    QImage image;
+    if (!handler.read(&image))
+    {
+        return 1;
+    }
+    printf("%lld %lld\n", static_cast<long long>(LibRawPool::global().constructionTime()),
+           static_cast<long long>(timer.nsecsElapsed()));
+    return 0;
+}
+
+//============================================================================
+/**
+ * @brief The times of the first decodes of several fresh processes.
+ */
+struct ColdStartTimes
+{
+    vector<qint64> total;
+    vector<qint64> construction;
+    vector<qint64> decode;
+};
+
+//============================================================================
+/**
+ * @brief Starts @a runs pairs of fresh processes that each decode @a file
+ * once and prints the median time from the start of a process to its first
+ * decoded image.
+ *
+ * One process of a pair parses the rawspeed camera database from
+ * @a camerasFile, as LibRaw did before rawspeed compiled it into a table, the
+ * other one uses the compiled table. The parsing processes build the table
+ * as well, so their times are an upper bound of the parsing. The processes
+ * take turns, so a change of the load of the machine affects both alike.
+ * @returns the exit code
+ */
+static int coldStart(const QString& file, int runs, const QStringList& decodeArguments,
+                     const QString& camerasFile)
+{
+    const auto decodeOnce = [&file, &decodeArguments](const QProcessEnvironment& environment,
+                                                      ColdStartTimes* times)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        QProcess process;
+        process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        process.setProcessEnvironment(environment);
+        process.start(QCoreApplication::applicationFilePath(),
+                      QStringList{QStringLiteral("--first-decode")} + decodeArguments +
+                      QStringList{file});
+        if (!process.waitForFinished(-1) || process.exitCode() != 0)
+        {
+            fprintf(stderr, "Cannot decode %s\n", qPrintable(file));
+            return false;
+        }
+        times->total.push_back(timer.nsecsElapsed());
+        const auto output = process.readAllStandardOutput().trimmed().split(' ');
+        times->construction.push_back(output.value(0).toLongLong());
+        times->decode.push_back(output.value(1).toLongLong());
+        return true;
+    };
+
+    auto tableEnvironment = QProcessEnvironment::systemEnvironment();
+    tableEnvironment.remove(QStringLiteral("QTRAW_RAWSPEED_CAMERAS"));
+    auto xmlEnvironment = tableEnvironment;
+    xmlEnvironment.insert(QStringLiteral("QTRAW_RAWSPEED_CAMERAS"), camerasFile);
+    auto table = ColdStartTimes{};
+    auto xml = ColdStartTimes{};
+    for (int run = 0; run < runs; ++run)
+    {
+        if (!decodeOnce(xmlEnvironment, &xml) || !decodeOnce(tableEnvironment, &table))
+        {
+            return 1;
+        }
+    }
+
+    const auto median = [](vector<qint64> times)
+    {
+        sort(times.begin(), times.end());
+        return double(times[times.size() / 2]) / 1e6;
+    };
+    printf("cold start of %s, median of %d processes each\n", qPrintable(file), runs);
+    printf("                         cameras.xml  compiled table\n");
+    printf("  start to first image   %8.1f ms     %8.1f ms\n", median(xml.total),
+           median(table.total));
+    printf("  first decode           %8.1f ms     %8.1f ms\n", median(xml.decode),
+           median(table.decode));
+    printf("  constructing LibRaw    %8.1f ms     %8.1f ms\n", median(xml.construction),
+           median(table.construction));
+    return 0;
+}
+
+//============================================================================
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qtraw-convert"));
+
+    // the handler is chatty on the debug channel
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Converts raw images to JPEG, PNG or TIFF in parallel."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"),
+                                 QStringLiteral("Raw files, wildcards or directories."),
+                                 QStringLiteral("[files...]"));
+    const auto listOption = QCommandLineOption(
+        {QStringLiteral("l"), QStringLiteral("list")},
+        QStringLiteral("Read the files to convert from <file>, one per line (\"-\" for stdin)."),
+        QStringLiteral("file"));
+    const auto outputOption = QCommandLineOption(
+        {QStringLiteral("o"), QStringLiteral("output")},
+        QStringLiteral("Write the images to <directory> instead of next to the raw files."),
+        QStringLiteral("directory"));
+    const auto formatOption = QCommandLineOption(
+        {QStringLiteral("f"), QStringLiteral("format")},
+        QStringLiteral("The output <format>: jpg, png or tiff (default: jpg)."),
+        QStringLiteral("format"), QStringLiteral("jpg"));
+    const auto sizeOption = QCommandLineOption(
+        {QStringLiteral("s"), QStringLiteral("size")},
+        QStringLiteral("Scale the images into <width>x<height>, keeping the aspect ratio."),
+        QStringLiteral("size"));
+    const auto qualityOption = QCommandLineOption(
+        {QStringLiteral("q"), QStringLiteral("quality")},
+        QStringLiteral("The <quality> of the output format from 0 to 100."),
+        QStringLiteral("quality"), QStringLiteral("-1"));
+    const auto sourceOption = QCommandLineOption(
+        QStringLiteral("source"),
+        QStringLiteral("Decode the embedded preview, the raw data or pick automatically "
+                       "(<source>: auto, preview or raw; default: auto)."),
+        QStringLiteral("source"), QStringLiteral("auto"));
+    const auto jobsOption = QCommandLineOption(
+        {QStringLiteral("j"), QStringLiteral("jobs")},
+        QStringLiteral("Decode <n> images in parallel (default: the number of cores)."),
+        QStringLiteral("n"), QString::number(QThread::idealThreadCount()));
+    const auto hugePagesOption = QCommandLineOption(
+        QStringLiteral("huge-pages"),
+        QStringLiteral("Back the frame buffers by transparent huge pages."));
+    const auto coldStartOption = QCommandLineOption(
+        QStringLiteral("cold-start"),
+        QStringLiteral("Don't convert, but decode the first file in <runs> fresh processes "
+                       "that parse the rawspeed cameras.xml and in <runs> that use the "
+                       "compiled camera table, and print the time to the first decoded "
+                       "image."),
+        QStringLiteral("runs"));
+    const auto camerasOption = QCommandLineOption(
+        QStringLiteral("cameras"),
+        QStringLiteral("The cameras.xml the --cold-start processes parse (default: the "
+                       "installed one of rawspeed)."),
+        QStringLiteral("file"));
+    auto firstDecodeOption = QCommandLineOption(QStringLiteral("first-decode"));
+    firstDecodeOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOptions({listOption, outputOption, formatOption, sizeOption,
+                       qualityOption, sourceOption, jobsOption, hugePagesOption,
+                       coldStartOption, camerasOption, firstDecodeOption});
+    parser.process(app);
+
+    auto options = ConvertOptions{};
+    options.outputDirectory = parser.value(outputOption);
+    options.format = parser.value(formatOption).toLower().toLatin1();
+    options.quality = parser.value(qualityOption).toInt();
+    options.source = parser.value(sourceOption);
+    options.jobs = parser.value(jobsOption).toInt();
+
+    // LibRaw's raw and image buffers of one decode per worker stay mapped
+    // for the next file
+    BufferPool::serveLibRaw();
+    BufferPool::global().setRetainLimit(qint64(qMax(1, options.jobs)) * 512 * 1024 * 1024);
+    BufferPool::global().setHugePages(parser.isSet(hugePagesOption));
+    if (!QImageWriter::supportedImageFormats().contains(options.format))
+    {
+        fprintf(stderr, "Unsupported output format %s\n", options.format.constData());
+        return 2;
+    }
+    if (parser.isSet(sizeOption))
+    {
+        const auto size = parser.value(sizeOption).split(QLatin1Char('x'));
+        if (size.size() == 2)
+        {
+            options.size = QSize(size[0].toInt(), size[1].toInt());
+        }
+        if (options.size.isEmpty())
+        {
+            fprintf(stderr, "Invalid size %s\n", qPrintable(parser.value(sizeOption)));
+            return 2;
+        }
+    }
+    if (!options.outputDirectory.isEmpty() && !QDir().mkpath(options.outputDirectory))
+    {
+        fprintf(stderr, "Cannot create %s\n", qPrintable(options.outputDirectory));
+        return 2;
+    }
+
+    auto files = QStringList{};
+    for (const auto& argument : parser.positionalArguments())
+    {
+        files << expandArgument(argument);
+    }
+    if (parser.isSet(listOption))
+    {
+        files << readFileList(parser.value(listOption));
+    }
+    if (files.isEmpty())
+    {
+        parser.showHelp(2);
+    }
+    if (parser.isSet(firstDecodeOption))
+    {
+        return firstDecode(files.first(), options);
+    }
+    if (parser.isSet(coldStartOption))
+    {
+        auto decodeArguments = QStringList{QStringLiteral("--source"), options.source};
+        if (options.size.isValid())
+        {
+            decodeArguments << QStringLiteral("--size") << parser.value(sizeOption);
+        }
+        const auto camerasFile = parser.isSet(camerasOption) ?
+                                 parser.value(camerasOption) :
+                                 QLibraryInfo::location(QLibraryInfo::DataPath) +
+                                 QStringLiteral("/rawspeed/cameras.xml");
+        if (!QFileInfo(camerasFile).isFile())
+        {
+            fprintf(stderr, "Cannot find the rawspeed cameras %s, use --cameras\n",
+                    qPrintable(camerasFile));
+            return 2;
+        }
+        return coldStart(files.first(), qMax(1, parser.value(coldStartOption).toInt()),
+                         decodeArguments, camerasFile);
+    }
+
+    Converter converter(options);
+    return converter.run(files) == 0 ? 0 : 1;
+}
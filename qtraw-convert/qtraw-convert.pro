@@ -0,0 +1,22 @@
+include(../common-config.pri)
+
+TARGET = qtraw-convert
+TEMPLATE = app
+QT += \
+    core \
+    gui
+CONFIG += c++14 \
+    console
+CONFIG -= app_bundle
+
+include(../src/qtraw-core.pri)
+
+HEADERS += \
+    converter.h \
+    work-queue.h
+SOURCES += \
+    converter.cpp \
+    main.cpp
+
+target.path = $${INSTALL_PREFIX}/bin
+INSTALLS += target
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief The WorkQueue class hands items from one stage of a pipeline to the
+ * next one.
+ *
+ * The queue is bounded, so a fast producer blocks instead of running
+ * arbitrarily far ahead of its consumers.
+ */
+template<typename T>
+class WorkQueue
+{
+public:
+    /**
+     * @brief Construct a new WorkQueue that holds at most @a capacity items.
+     */
+    explicit WorkQueue(size_t capacity) :
+        m_capacity(capacity > 0 ? capacity : 1)
+    {}
+
+    /**
+     * @brief Appends @a item, waiting for free space if the queue is full.
+     * @returns false if the queue has been closed
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+        if (m_closed)
+        {
+            return false;
+        }
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Takes the next item into @a item, waiting for one to arrive if
+     * the queue is empty.
+     * @returns false if the queue has been closed and drained
+     */
+    bool pop(T* item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+        {
+            return false;
+        }
+        *item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Closes the queue. Items that are already queued can still be
+     * taken, but no new items are accepted.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed{};
+};
+
+#endif // WORK_QUEUE_H
@@ -0,0 +1,92 @@
+include(../common-config.pri)
+
+TARGET = qtraw-core
+TEMPLATE = lib
+QT += \
+    core \
+    gui
+CONFIG += c++14
+DEFINES += QTRAW_CORE_LIBRARY
+DESTDIR = ../libs
+
+build_pass:CONFIG(debug, debug|release) {
+    win32: TARGET = $$join(TARGET,,,d) # 'd' suffix for debug builds on Windows
+}
+
+SRC = $$PWD/../src
+
+CONFIG += link_pkgconfig
+
+# the reentrant LibRaw, as decodes run on several threads at once
+unix: {
+    PKGCONFIG += \
+        libraw_r
+}
+# shm_open() for the shared frames
+linux: LIBS += -lrt
+
+win32: {
+    INCLUDEPATH *= $$PWD/../LibRaw/libraw/
+
+    LIBS += -L$$OUT_PWD/../libs -llibraw_r
+}
+
+# the public API, installed for applications that link the library
+PUBLIC_HEADERS = \
+    $$SRC/buffer-pool.h \
+    $$SRC/decode-metrics.h \
+    $$SRC/decode-scheduler.h \
+    $$SRC/image-statistics.h \
+    $$SRC/qtraw-export.h \
+    $$SRC/raw-decode-control.h \
+    $$SRC/raw-developer.h \
+    $$SRC/raw-io-handler.h \
+    $$SRC/shared-frame.h \
+    $$SRC/unpack-cache.h
+
+HEADERS += \
+    $$PUBLIC_HEADERS \
+    $$SRC/datastream.h \
+    $$SRC/device-spool.h \
+    $$SRC/frame-packing.h \
+    $$SRC/libraw-pool.h \
+    $$SRC/preview-locator.h \
+    $$SRC/raw-formats.h \
+    $$SRC/raw-header.h
+SOURCES += \
+    $$SRC/buffer-pool.cpp \
+    $$SRC/datastream.cpp \
+    $$SRC/decode-metrics.cpp \
+    $$SRC/decode-scheduler.cpp \
+    $$SRC/device-spool.cpp \
+    $$SRC/frame-packing.cpp \
+    $$SRC/libraw-pool.cpp \
+    $$SRC/preview-locator.cpp \
+    $$SRC/raw-developer.cpp \
+    $$SRC/raw-formats.cpp \
+    $$SRC/raw-header.cpp \
+    $$SRC/raw-io-handler.cpp \
+    $$SRC/shared-frame.cpp \
+    $$SRC/unpack-cache.cpp
+OTHER_FILES += \
+    $$SRC/raw-formats.txt
+
+include(../src/raw-formats.pri)
+write_file($$OUT_PWD/raw-formats.inc, RAW_FORMATS_TABLE)|error("Could not write raw-formats.inc")
+
+# the generated files are looked up in the include path
+INCLUDEPATH += \
+    $$SRC \
+    $$OUT_PWD
+
+# Installation
+win32: {
+    target.path = $$[QT_INSTALL_LIBEXECS]
+} else {
+    target.path = $${INSTALL_LIBDIR}
+}
+INSTALLS += target
+
+headers.files = $$PUBLIC_HEADERS
+headers.path = $${INSTALL_PREFIX}/include/qtraw
+INSTALLS += headers
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "catalog.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+//============================================================================
+/**
+ * @brief Returns @a value, or a null QVariant of the same type if it is
+ * empty, so unknown values end up as NULL in the database.
+ */
+static QVariant nullIfEmpty(const QString& value)
+{
+    return value.isEmpty() ? QVariant(QVariant::String) : QVariant(value);
+}
+
+//============================================================================
+Catalog::Catalog() :
+    m_connection(QStringLiteral("qtraw-catalog-%1").arg(quintptr(this), 0, 16))
+{
+}
+
+//============================================================================
+Catalog::~Catalog()
+{
+    if (QSqlDatabase::contains(m_connection))
+    {
+        QSqlDatabase::database(m_connection, false).close();
+        QSqlDatabase::removeDatabase(m_connection);
+    }
+}
+
+//============================================================================
+bool Catalog::open(const QString& fileName)
+{
+    auto db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), m_connection);
+    db.setDatabaseName(fileName);
+    if (!db.open())
+    {
+        m_error = db.lastError().text();
+        return false;
+    }
+
+    // the catalog can always be rebuilt, so durability is traded for speed
+    const auto statements = QStringList{
+        QStringLiteral("PRAGMA journal_mode = WAL"),
+        QStringLiteral("PRAGMA synchronous = NORMAL"),
+        QStringLiteral("CREATE TABLE IF NOT EXISTS files ("
+                       "path TEXT PRIMARY KEY, size INTEGER, modified INTEGER, "
+                       "width INTEGER, height INTEGER, orientation INTEGER, "
+                       "make TEXT, model TEXT, lens TEXT, iso REAL, shutter REAL, "
+                       "aperture REAL, focal_length REAL, timestamp INTEGER, "
+                       "preview_offset INTEGER, preview_length INTEGER, "
+                       "preview_width INTEGER, preview_height INTEGER, "
+                       "preview_format TEXT, error TEXT)")
+    };
+    QSqlQuery query(db);
+    for (const auto& statement : statements)
+    {
+        if (!query.exec(statement))
+        {
+            m_error = query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+//============================================================================
+QHash<QString, FileStamp> Catalog::stamps() const
+{
+    auto result = QHash<QString, FileStamp>{};
+    QSqlQuery query(QSqlDatabase::database(m_connection));
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT path, size, modified FROM files")))
+    {
+        return result;
+    }
+    while (query.next())
+    {
+        result.insert(query.value(0).toString(),
+                      {query.value(1).toLongLong(), query.value(2).toLongLong()});
+    }
+    return result;
+}
+
+//============================================================================
+bool Catalog::store(const QVector<CatalogEntry>& entries)
+{
+    auto db = QSqlDatabase::database(m_connection);
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral(
+        "INSERT OR REPLACE INTO files VALUES "
+        "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"));
+    for (const auto& entry : entries)
+    {
+        const auto& header = entry.header;
+        query.addBindValue(entry.path);
+        query.addBindValue(entry.stamp.size);
+        query.addBindValue(entry.stamp.modified);
+        query.addBindValue(header.size.width());
+        query.addBindValue(header.size.height());
+        query.addBindValue(header.orientation);
+        query.addBindValue(nullIfEmpty(header.make));
+        query.addBindValue(nullIfEmpty(header.model));
+        query.addBindValue(nullIfEmpty(header.lens));
+        query.addBindValue(header.isoSpeed);
+        query.addBindValue(header.shutter);
+        query.addBindValue(header.aperture);
+        query.addBindValue(header.focalLength);
+        query.addBindValue(header.timestamp.isValid() ?
+                           QVariant(header.timestamp.toSecsSinceEpoch()) :
+                           QVariant(QVariant::LongLong));
+        query.addBindValue(header.previewOffset);
+        query.addBindValue(header.previewLength);
+        query.addBindValue(header.previewSize.width());
+        query.addBindValue(header.previewSize.height());
+        query.addBindValue(nullIfEmpty(QString::fromLatin1(header.previewFormat)));
+        query.addBindValue(nullIfEmpty(entry.error));
+        if (!query.exec())
+        {
+            m_error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit())
+    {
+        m_error = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+//============================================================================
+bool Catalog::remove(const QStringList& paths)
+{
+    auto db = QSqlDatabase::database(m_connection);
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare(QStringLiteral("DELETE FROM files WHERE path = ?"));
+    for (const auto& path : paths)
+    {
+        query.addBindValue(path);
+        if (!query.exec())
+        {
+            m_error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit())
+    {
+        m_error = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+//============================================================================
+QString Catalog::errorString() const
+{
+    return m_error;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "raw-header.h"
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief The size and modification time of an indexed file. A file whose
+ * stamp has not changed is not indexed again.
+ */
+struct FileStamp
+{
+    qint64 size{};
+    qint64 modified{};
+
+    bool operator==(const FileStamp& rhs) const
+    {
+        return size == rhs.size && modified == rhs.modified;
+    }
+};
+
+/**
+ * @brief One file in the Catalog.
+ */
+struct CatalogEntry
+{
+    QString path;
+    FileStamp stamp;
+    RawHeader header;
+
+    /**
+     * Why the header could not be read. Such files are kept in the catalog as
+     * well, so they are not tried again until they change.
+     */
+    QString error;
+};
+
+/**
+ * @brief The Catalog class stores the RawHeader of every indexed file in a
+ * local SQLite database.
+ *
+ * A Catalog may only be used by the thread that opened it.
+ */
+class Catalog
+{
+public:
+    /**
+     * @brief Construct a new Catalog that is not opened yet.
+     */
+    Catalog();
+
+    /**
+     * @brief Destruct the Catalog and close its database.
+     */
+    ~Catalog();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(Catalog);
+    Catalog(const Catalog&& rhs) = delete;
+    Catalog& operator=(const Catalog&& rhs) = delete;
+
+    /**
+     * @brief Opens or creates the catalog in the file @a fileName.
+     * @returns true on success
+     */
+    bool open(const QString& fileName);
+
+    /**
+     * @brief Returns the stamps of all files in the catalog by their path.
+     */
+    QHash<QString, FileStamp> stamps() const;
+
+    /**
+     * @brief Inserts or replaces @a entries in one transaction.
+     * @returns true on success
+     */
+    bool store(const QVector<CatalogEntry>& entries);
+
+    /**
+     * @brief Removes the files @a paths from the catalog.
+     * @returns true on success
+     */
+    bool remove(const QStringList& paths);
+
+    /**
+     * @brief Returns why the last operation failed.
+     */
+    QString errorString() const;
+
+private:
+    QString m_connection;
+    QString m_error;
+};
+
+#endif // CATALOG_H
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "catalog.h"
+#include "indexer.h"
+#include "work-queue.h"
+
+#include "raw-formats.h"
+#include "raw-header.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * @brief The number of files that are written to the catalog in one
+ * transaction.
+ */
+static constexpr int BatchSize = 1000;
+
+//============================================================================
+/**
+ * @brief Asks the kernel to read the first @a length bytes of @a path into
+ * the page cache in the background.
+ *
+ * By the time a worker gets to the file its header is in memory, so the
+ * workers don't wait for the disk one seek at a time.
+ */
+static void readAhead(const QString& path, qint64 length)
+{
+#if defined(Q_OS_UNIX) && defined(POSIX_FADV_WILLNEED)
+    const auto fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, off_t(length), POSIX_FADV_WILLNEED);
+        ::close(fd);
+    }
+#else
+    Q_UNUSED(path)
+    Q_UNUSED(length)
+#endif
+}
+
+//============================================================================
+/**
+ * @brief Walks the directory trees @a roots and calls @a visit for every raw
+ * file in them.
+ */
+template<typename Visitor>
+static void walk(const QStringList& roots, Visitor visit)
+{
+    auto filters = QStringList{};
+    for (const auto& key : RawFormats::keys())
+    {
+        filters << QStringLiteral("*.") + key;
+    }
+
+    for (const auto& root : roots)
+    {
+        QDirIterator it(root, filters, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            it.next();
+            visit(it.fileInfo());
+        }
+    }
+}
+
+//============================================================================
+Indexer::Indexer(Catalog* catalog, const IndexOptions& options) :
+    m_catalog(catalog),
+    m_options(options)
+{
+}
+
+//============================================================================
+Indexer::~Indexer() = default;
+
+//============================================================================
+int Indexer::run(const QStringList& roots)
+{
+    const auto jobs = size_t(max(1, m_options.jobs));
+    const auto known = m_catalog->stamps();
+
+    // the readahead only runs this far ahead of the workers
+    WorkQueue<CatalogEntry> parseQueue(jobs * 8);
+    WorkQueue<CatalogEntry> storeQueue(jobs * 8);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Stage 1: walk the directories and read the changed files ahead
+    auto seen = QSet<QString>{};
+    // counted by the walker and read by this thread while it runs
+    atomic<int> unchanged{0};
+    thread walker([this, &roots, &known, &seen, &unchanged, &parseQueue]
+                  {
+                      walk(roots, [&](const QFileInfo& info)
+                      {
+                          auto entry = CatalogEntry{};
+                          entry.path = info.absoluteFilePath();
+                          entry.stamp = {info.size(),
+                                         info.lastModified().toMSecsSinceEpoch()};
+                          seen.insert(entry.path);
+
+                          const auto it = known.constFind(entry.path);
+                          if (!m_options.force && it != known.cend() && *it == entry.stamp)
+                          {
+                              ++unchanged;
+                              return;
+                          }
+                          readAhead(entry.path, m_options.readahead);
+                          parseQueue.push(move(entry));
+                      });
+                      parseQueue.close();
+                  });
+
+    // Stage 2: parse the headers, every worker with its own LibRaw
+    auto workers = vector<thread>{};
+    for (size_t i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back([&parseQueue, &storeQueue]
+                             {
+                                 RawHeaderReader reader;
+                                 auto entry = CatalogEntry{};
+                                 while (parseQueue.pop(&entry))
+                                 {
+                                     QFile file(entry.path);
+                                     if (!file.open(QIODevice::ReadOnly))
+                                     {
+                                         entry.error = file.errorString();
+                                     }
+                                     else if (!reader.read(&file, &entry.header))
+                                     {
+                                         entry.error = reader.errorString();
+                                     }
+                                     storeQueue.push(move(entry));
+                                 }
+                             });
+    }
+    thread closer([&walker, &workers, &storeQueue]
+                  {
+                      walker.join();
+                      for (auto& worker : workers)
+                      {
+                          worker.join();
+                      }
+                      storeQueue.close();
+                  });
+
+    // Stage 3: store the headers in large transactions on this thread, which
+    // owns the catalog
+    auto indexed = 0;
+    auto failed = 0;
+    auto storeFailed = false;
+    auto batch = QVector<CatalogEntry>{};
+    batch.reserve(BatchSize);
+    const auto flush = [this, &batch, &storeFailed]
+    {
+        if (!batch.isEmpty() && !storeFailed && !m_catalog->store(batch))
+        {
+            fprintf(stderr, "Cannot write to the catalog: %s\n",
+                    qPrintable(m_catalog->errorString()));
+            storeFailed = true;
+        }
+        batch.clear();
+    };
+    //------------------------------------------------------------------------
+
+    auto entry = CatalogEntry{};
+    while (storeQueue.pop(&entry))
+    {
+        if (entry.error.isEmpty())
+        {
+            ++indexed;
+        }
+        else
+        {
+            ++failed;
+            fprintf(stderr, "%s: %s\n", qPrintable(entry.path), qPrintable(entry.error));
+        }
+        batch.append(move(entry));
+        if (batch.size() >= BatchSize)
+        {
+            flush();
+            printf("%d parsed, %d unchanged, %.0f files/s\n", indexed + failed,
+                   unchanged.load(), (indexed + failed) / max(timer.nsecsElapsed() / 1e9, 1e-9));
+            fflush(stdout);
+        }
+    }
+    flush();
+    closer.join();
+
+    // files that are gone from the scanned directories leave the catalog
+    auto removed = QStringList{};
+    for (const auto& root : roots)
+    {
+        const auto prefix = QDir(root).absolutePath() + QLatin1Char('/');
+        for (auto it = known.cbegin(); it != known.cend(); ++it)
+        {
+            if (it.key().startsWith(prefix) && !seen.contains(it.key()))
+            {
+                removed << it.key();
+            }
+        }
+    }
+    if (!removed.isEmpty() && !m_catalog->remove(removed))
+    {
+        fprintf(stderr, "Cannot write to the catalog: %s\n",
+                qPrintable(m_catalog->errorString()));
+    }
+
+    m_counts = {indexed, failed, unchanged.load(), removed.size()};
+    const auto seconds = max(timer.nsecsElapsed() / 1e9, 1e-9);
+    printf("%d indexed, %d failed, %d unchanged, %d removed in %.2f s: %.0f files/s "
+           "with %zu workers\n",
+           indexed, failed, m_counts.unchanged, m_counts.removed, seconds,
+           (indexed + failed) / seconds, jobs);
+    return failed;
+}
+
+//============================================================================
+IndexCounts Indexer::counts() const
+{
+    return m_counts;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include <QString>
+#include <QStringList>
+
+class Catalog;
+
+/**
+ * @brief The options of an indexing run.
+ */
+struct IndexOptions
+{
+    /**
+     * The number of headers that are parsed in parallel.
+     */
+    int jobs{1};
+
+    /**
+     * The number of bytes at the start of every file that are read ahead
+     * while the workers are busy with earlier files.
+     */
+    qint64 readahead{256 * 1024};
+
+    /**
+     * Index every file again, even if its size and modification time have
+     * not changed.
+     */
+    bool force{false};
+};
+
+/**
+ * @brief The number of files of the last indexing run, by what happened to
+ * them.
+ */
+struct IndexCounts
+{
+    int indexed{};
+    int failed{};
+    int unchanged{};
+    int removed{};
+};
+
+/**
+ * @brief The Indexer class records the headers of all raw files below some
+ * directories in a Catalog.
+ *
+ * The indexing runs as a pipeline: one thread walks the directory trees,
+ * skips the files that have not changed since the last run and asks the
+ * kernel to read the headers of the others ahead. A pool of workers parses
+ * the headers, each with a LibRaw object of its own, and the calling thread
+ * writes the results to the catalog in large transactions.
+ */
+class Indexer
+{
+public:
+    /**
+     * @brief Construct a new Indexer that stores into @a catalog.
+     */
+    Indexer(Catalog* catalog, const IndexOptions& options);
+
+    /**
+     * @brief Destruct the Indexer.
+     */
+    ~Indexer();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(Indexer);
+    Indexer(const Indexer&& rhs) = delete;
+    Indexer& operator=(const Indexer&& rhs) = delete;
+
+    /**
+     * @brief Indexes all raw files below the directories @a roots and removes
+     * the files that have disappeared from them from the catalog.
+     * @returns the number of files whose header could not be read
+     */
+    int run(const QStringList& roots);
+
+    /**
+     * @brief Returns the counts of the last run.
+     */
+    IndexCounts counts() const;
+
+private:
+    Catalog* m_catalog;
+    IndexOptions m_options;
+    IndexCounts m_counts;
+};
+
+#endif // INDEXER_H
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "catalog.h"
+#include "indexer.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QThread>
+
+//============================================================================
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qtraw-index"));
+
+    // the handler is chatty on the debug channel
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Records the dimensions, orientation, camera, exposure and preview location "
+        "of all raw files below some directories in an SQLite catalog."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("directories"),
+                                 QStringLiteral("The directories to index."),
+                                 QStringLiteral("directories..."));
+    const auto catalogOption = QCommandLineOption(
+        {QStringLiteral("c"), QStringLiteral("catalog")},
+        QStringLiteral("The SQLite <file> of the catalog (default: qtraw-catalog.sqlite)."),
+        QStringLiteral("file"), QStringLiteral("qtraw-catalog.sqlite"));
+    const auto jobsOption = QCommandLineOption(
+        {QStringLiteral("j"), QStringLiteral("jobs")},
+        QStringLiteral("Parse <n> headers in parallel (default: twice the number of cores)."),
+        QStringLiteral("n"), QString::number(2 * QThread::idealThreadCount()));
+    const auto readaheadOption = QCommandLineOption(
+        QStringLiteral("readahead"),
+        QStringLiteral("Read the first <kib> KiB of every file ahead (default: 256)."),
+        QStringLiteral("kib"), QStringLiteral("256"));
+    const auto forceOption = QCommandLineOption(
+        {QStringLiteral("f"), QStringLiteral("force")},
+        QStringLiteral("Index all files again, even if they have not changed."));
+    parser.addOptions({catalogOption, jobsOption, readaheadOption, forceOption});
+    parser.process(app);
+
+    const auto roots = parser.positionalArguments();
+    if (roots.isEmpty())
+    {
+        parser.showHelp(2);
+    }
+    for (const auto& root : roots)
+    {
+        if (!QFileInfo(root).isDir())
+        {
+            fprintf(stderr, "%s is not a directory\n", qPrintable(root));
+            return 2;
+        }
+    }
+
+    Catalog catalog;
+    if (!catalog.open(parser.value(catalogOption)))
+    {
+        fprintf(stderr, "Cannot open the catalog %s: %s\n",
+                qPrintable(parser.value(catalogOption)), qPrintable(catalog.errorString()));
+        return 2;
+    }
+
+    auto options = IndexOptions{};
+    options.jobs = parser.value(jobsOption).toInt();
+    options.readahead = parser.value(readaheadOption).toLongLong() * 1024;
+    options.force = parser.isSet(forceOption);
+    Indexer indexer(&catalog, options);
+    return indexer.run(roots) == 0 ? 0 : 1;
+}
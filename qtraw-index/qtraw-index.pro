@@ -0,0 +1,28 @@
+include(../common-config.pri)
+
+TARGET = qtraw-index
+TEMPLATE = app
+QT += \
+    core \
+    gui \
+    sql
+CONFIG += c++14 \
+    console
+CONFIG -= app_bundle
+
+include(../src/qtraw-core.pri)
+
+# the bounded queue between the pipeline stages
+INCLUDEPATH += ../qtraw-convert
+
+HEADERS += \
+    ../qtraw-convert/work-queue.h \
+    catalog.h \
+    indexer.h
+SOURCES += \
+    catalog.cpp \
+    indexer.cpp \
+    main.cpp
+
+target.path = $${INSTALL_PREFIX}/bin
+INSTALLS += target
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "image-quality.h"
+
+#include <QImage>
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+constexpr double QualityScore::MaxPsnr;
+
+//============================================================================
+/**
+ * @brief Converts the 8 bit sRGB value @a value to linear sRGB.
+ */
+static double linear(int value)
+{
+    const auto v = value / 255.0;
+    return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+//============================================================================
+/**
+ * @brief Converts the sRGB colour @a rgb to CIELAB with the D65 white.
+ */
+static array<double, 3> toLab(QRgb rgb)
+{
+    // the table saves the power functions for all but the first pixels
+    static const auto table = []
+    {
+        auto result = array<double, 256>();
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result[i] = linear(int(i));
+        }
+        return result;
+    }();
+    const auto r = table[size_t(qRed(rgb))];
+    const auto g = table[size_t(qGreen(rgb))];
+    const auto b = table[size_t(qBlue(rgb))];
+    const auto x = (0.4124 * r + 0.3576 * g + 0.1805 * b) / 0.95047;
+    const auto y = 0.2126 * r + 0.7152 * g + 0.0722 * b;
+    const auto z = (0.0193 * r + 0.1192 * g + 0.9505 * b) / 1.08883;
+
+    const auto f = [](double t)
+    {
+        return t > 216.0 / 24389.0 ? cbrt(t) : (24389.0 / 27.0 * t + 16.0) / 116.0;
+    };
+    const auto fx = f(x);
+    const auto fy = f(y);
+    const auto fz = f(z);
+    return {{116.0 * fy - 16.0, 500.0 * (fx - fy), 200.0 * (fy - fz)}};
+}
+
+//============================================================================
+/**
+ * @brief Returns the mean structural similarity of the luminance planes
+ * @a a and @a b of the given @a width and @a height, over 8x8 windows that
+ * overlap by half.
+ */
+static double ssim(const vector<double>& a, const vector<double>& b, int width, int height)
+{
+    static const auto Window = 8;
+    static const auto Step = 4;
+    static const auto C1 = (0.01 * 255.0) * (0.01 * 255.0);
+    static const auto C2 = (0.03 * 255.0) * (0.03 * 255.0);
+    if (width < Window || height < Window)
+    {
+        return a == b ? 1.0 : 0.0;
+    }
+
+    auto sum = 0.0;
+    auto windows = 0;
+    for (int top = 0; top + Window <= height; top += Step)
+    {
+        for (int left = 0; left + Window <= width; left += Step)
+        {
+            auto meanA = 0.0;
+            auto meanB = 0.0;
+            for (int y = top; y < top + Window; ++y)
+            {
+                for (int x = left; x < left + Window; ++x)
+                {
+                    meanA += a[size_t(y * width + x)];
+                    meanB += b[size_t(y * width + x)];
+                }
+            }
+            const auto n = double(Window * Window);
+            meanA /= n;
+            meanB /= n;
+
+            auto varianceA = 0.0;
+            auto varianceB = 0.0;
+            auto covariance = 0.0;
+            for (int y = top; y < top + Window; ++y)
+            {
+                for (int x = left; x < left + Window; ++x)
+                {
+                    const auto da = a[size_t(y * width + x)] - meanA;
+                    const auto db = b[size_t(y * width + x)] - meanB;
+                    varianceA += da * da;
+                    varianceB += db * db;
+                    covariance += da * db;
+                }
+            }
+            varianceA /= n - 1.0;
+            varianceB /= n - 1.0;
+            covariance /= n - 1.0;
+
+            sum += ((2.0 * meanA * meanB + C1) * (2.0 * covariance + C2)) /
+                   ((meanA * meanA + meanB * meanB + C1) * (varianceA + varianceB + C2));
+            ++windows;
+        }
+    }
+    return sum / windows;
+}
+
+//============================================================================
+QualityScore compareImages(const QImage& reference, const QImage& image)
+{
+    auto score = QualityScore{};
+    if (reference.size() != image.size() || reference.isNull())
+    {
+        return score;
+    }
+    const auto a = reference.convertToFormat(QImage::Format_RGB32);
+    const auto b = image.convertToFormat(QImage::Format_RGB32);
+    const auto width = a.width();
+    const auto height = a.height();
+    const auto pixels = size_t(width) * size_t(height);
+
+    auto squaredError = 0.0;
+    auto deltaE = 0.0;
+    auto lumaA = vector<double>(pixels);
+    auto lumaB = vector<double>(pixels);
+    for (int y = 0; y < height; ++y)
+    {
+        const auto* lineA = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+        const auto* lineB = reinterpret_cast<const QRgb*>(b.constScanLine(y));
+        for (int x = 0; x < width; ++x)
+        {
+            const auto pa = lineA[x];
+            const auto pb = lineB[x];
+            const auto dr = double(qRed(pa) - qRed(pb));
+            const auto dg = double(qGreen(pa) - qGreen(pb));
+            const auto db = double(qBlue(pa) - qBlue(pb));
+            squaredError += dr * dr + dg * dg + db * db;
+
+            const auto labA = toLab(pa);
+            const auto labB = toLab(pb);
+            deltaE += sqrt((labA[0] - labB[0]) * (labA[0] - labB[0]) +
+                           (labA[1] - labB[1]) * (labA[1] - labB[1]) +
+                           (labA[2] - labB[2]) * (labA[2] - labB[2]));
+
+            const auto i = size_t(y * width + x);
+            lumaA[i] = 0.299 * qRed(pa) + 0.587 * qGreen(pa) + 0.114 * qBlue(pa);
+            lumaB[i] = 0.299 * qRed(pb) + 0.587 * qGreen(pb) + 0.114 * qBlue(pb);
+        }
+    }
+
+    const auto meanSquaredError = squaredError / (3.0 * pixels);
+    score.psnr = meanSquaredError > 0.0 ?
+                 qMin(QualityScore::MaxPsnr,
+                      10.0 * log10(255.0 * 255.0 / meanSquaredError)) :
+                 QualityScore::MaxPsnr;
+    score.ssim = ssim(lumaA, lumaB, width, height);
+    score.deltaE = deltaE / pixels;
+    return score;
+}
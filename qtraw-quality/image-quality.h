@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGE_QUALITY_H
+#define IMAGE_QUALITY_H
+
+class QImage;
+
+/**
+ * @brief How close an image comes to its reference.
+ */
+struct QualityScore
+{
+    /**
+     * The peak signal to noise ratio over the RGB channels in dB. Identical
+     * images score MaxPsnr.
+     */
+    double psnr{0.0};
+
+    /**
+     * The mean structural similarity of the luminance, from -1 to 1.
+     */
+    double ssim{0.0};
+
+    /**
+     * The mean colour difference CIE76 (delta E) in CIELAB.
+     */
+    double deltaE{0.0};
+
+    static constexpr double MaxPsnr = 100.0;
+};
+
+/**
+ * @brief Compares @a image with @a reference, which has to have the same
+ * size. Both are taken as sRGB.
+ */
+QualityScore compareImages(const QImage& reference, const QImage& image);
+
+#endif // IMAGE_QUALITY_H
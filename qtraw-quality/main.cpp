@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "image-quality.h"
+#include "synthetic-raw.h"
+
+#include "raw-developer.h"
+#include "raw-formats.h"
+#include "raw-io-handler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+
+using namespace std;
+
+/**
+ * @brief One image of the corpus.
+ */
+struct CorpusImage
+{
+    QString name;
+    QByteArray data;
+
+    /**
+     * The rendering of a synthetic image is known, so the built-in
+     * thresholds hold for it.
+     */
+    bool synthetic;
+};
+
+/**
+ * @brief A way of decoding an image into a target size.
+ */
+struct DecodePath
+{
+    QString name;
+    function<bool(QIODevice* device, const QSize& size, QImage* image)> decode;
+};
+
+/**
+ * @brief The limits a path has to stay within. A NaN disables a limit.
+ */
+struct Thresholds
+{
+    double minPsnr;
+    double minSsim;
+    double maxDeltaE;
+};
+
+/**
+ * @brief The comparison of one path on one image.
+ */
+struct Result
+{
+    QString image;
+    QString path;
+    QualityScore score;
+    double milliseconds;
+    bool decoded;
+    bool passed;
+};
+
+//============================================================================
+/**
+ * @brief Develops the raw image on @a device with @a parameters into
+ * @a image, scaled to @a size by the developer.
+ */
+static bool develop(QIODevice* device, const DevelopParameters& parameters,
+                    const QSize& size, QImage* image)
+{
+    RawDeveloper developer;
+    return developer.open(device) && developer.develop(parameters, size, image);
+}
+
+//============================================================================
+/**
+ * @brief Returns the fast paths that are evaluated.
+ */
+static vector<DecodePath> decodePaths()
+{
+    const auto developed = [](const DevelopParameters& parameters)
+    {
+        return [parameters](QIODevice* device, const QSize& size, QImage* image)
+        {
+            return develop(device, parameters, size, image);
+        };
+    };
+    //------------------------------------------------------------------------
+
+    auto halfSize = DevelopParameters{};
+    halfSize.halfSize = true;
+    auto linear = DevelopParameters{};
+    linear.demosaic = 0;
+
+    return {
+        // the embedded preview, scaled by the JPEG decoder
+        {QStringLiteral("preview"), [](QIODevice* device, const QSize& size, QImage* image)
+         {
+             RawIOHandler handler;
+             handler.setDevice(device);
+             handler.setRawOption(RawIOHandler::Source, RawIOHandler::PreviewSource);
+             handler.setOption(QImageIOHandler::ScaledSize, size);
+             return handler.read(image);
+         }},
+        // full quality, downscaled while the output is packed
+        {QStringLiteral("scaled"), developed(DevelopParameters{})},
+        // LibRaw's half size mode bins every 2x2 Bayer block into one pixel
+        {QStringLiteral("half-size"), developed(halfSize)},
+        // bilinear instead of AHD demosaicing
+        {QStringLiteral("linear"), developed(linear)},
+        // full quality with nearest neighbour scaling, as a baseline
+        {QStringLiteral("nearest"), [](QIODevice* device, const QSize& size, QImage* image)
+         {
+             auto full = QImage{};
+             if (!develop(device, DevelopParameters{}, QSize(), &full))
+             {
+                 return false;
+             }
+             *image = full.scaled(size, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+             return !image->isNull();
+         }}
+    };
+}
+
+//============================================================================
+/**
+ * @brief Returns the thresholds that hold for the synthetic corpus. They are
+ * deliberately loose so that only real regressions fail the run. The
+ * nearest neighbour baseline is only reported.
+ */
+static QHash<QString, Thresholds> defaultThresholds()
+{
+    const auto none = qQNaN();
+    return {
+        {QStringLiteral("preview"), {18.0, 0.6, 6.0}},
+        {QStringLiteral("scaled"), {30.0, 0.9, 2.0}},
+        {QStringLiteral("half-size"), {20.0, 0.7, 4.0}},
+        {QStringLiteral("linear"), {20.0, 0.7, 4.0}},
+        {QStringLiteral("nearest"), {none, none, none}}
+    };
+}
+
+//============================================================================
+/**
+ * @brief Reads thresholds from the JSON file @a fileName, e.g.
+ * {"scaled": {"psnr": 35, "ssim": 0.95, "deltaE": 1.5}}, into @a thresholds.
+ * Limits that are left out are disabled.
+ * @returns true on success
+ */
+static bool readThresholds(const QString& fileName, QHash<QString, Thresholds>* thresholds)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", qPrintable(fileName),
+                qPrintable(file.errorString()));
+        return false;
+    }
+    auto error = QJsonParseError{};
+    const auto document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (!document.isObject())
+    {
+        fprintf(stderr, "Invalid thresholds in %s: %s\n", qPrintable(fileName),
+                qPrintable(error.errorString()));
+        return false;
+    }
+
+    const auto object = document.object();
+    for (auto it = object.constBegin(); it != object.constEnd(); ++it)
+    {
+        const auto limits = it.value().toObject();
+        (*thresholds)[it.key()] = {limits.value(QStringLiteral("psnr")).toDouble(qQNaN()),
+                                   limits.value(QStringLiteral("ssim")).toDouble(qQNaN()),
+                                   limits.value(QStringLiteral("deltaE")).toDouble(qQNaN())};
+    }
+    return true;
+}
+
+//============================================================================
+/**
+ * @brief Returns true if @a score is within @a thresholds.
+ */
+static bool withinThresholds(const QualityScore& score, const Thresholds& thresholds)
+{
+    // the comparisons are false for disabled limits
+    return !(score.psnr < thresholds.minPsnr) && !(score.ssim < thresholds.minSsim) &&
+           !(score.deltaE > thresholds.maxDeltaE);
+}
+
+//============================================================================
+/**
+ * @brief Decodes @a data @a runs times along @a path into @a image.
+ * @returns the median wall time in milliseconds, or a negative value if a
+ * decode failed
+ */
+static double measure(const DecodePath& path, const QByteArray& data, const QSize& size,
+                      int runs, QImage* image)
+{
+    auto times = vector<double>();
+    for (int run = 0; run < runs; ++run)
+    {
+        auto copy = data;
+        QBuffer buffer(&copy);
+        buffer.open(QIODevice::ReadOnly);
+        *image = QImage{};
+
+        QElapsedTimer timer;
+        timer.start();
+        if (!path.decode(&buffer, size, image) || image->size() != size)
+        {
+            return -1.0;
+        }
+        times.push_back(timer.nsecsElapsed() / 1e6);
+    }
+    sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+//============================================================================
+/**
+ * @brief Reads the raw files of the command line argument @a argument, which
+ * can be a file or a directory, into @a corpus.
+ */
+static void addFiles(const QString& argument, vector<CorpusImage>* corpus)
+{
+    auto files = QStringList{argument};
+    if (QFileInfo(argument).isDir())
+    {
+        auto filters = QStringList{};
+        for (const auto& key : RawFormats::keys())
+        {
+            filters << QStringLiteral("*.") + key;
+        }
+        files.clear();
+        for (const auto& entry : QDir(argument).entryInfoList(filters, QDir::Files,
+                                                              QDir::Name | QDir::IgnoreCase))
+        {
+            files << entry.filePath();
+        }
+    }
+
+    for (const auto& fileName : files)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            fprintf(stderr, "Cannot read %s: %s\n", qPrintable(fileName),
+                    qPrintable(file.errorString()));
+            continue;
+        }
+        corpus->push_back({QFileInfo(fileName).fileName(), file.readAll(), false});
+    }
+}
+
+//============================================================================
+/**
+ * @brief Parses the size @a text of the form <width>x<height>.
+ */
+static QSize parseSize(const QString& text)
+{
+    const auto parts = text.split(QLatin1Char('x'));
+    return parts.size() == 2 ? QSize(parts[0].toInt(), parts[1].toInt()) : QSize();
+}
+
+//============================================================================
+/**
+ * @brief Prints the @a results as a table.
+ */
+static void printTable(const vector<Result>& results)
+{
+    printf("%-24s %-10s %8s %8s %8s %10s\n", "image", "path", "psnr", "ssim", "deltaE",
+           "ms");
+    for (const auto& result : results)
+    {
+        if (!result.decoded)
+        {
+            printf("%-24s %-10s %37s  FAIL\n", qPrintable(result.image),
+                   qPrintable(result.path), "could not decode");
+            continue;
+        }
+        printf("%-24s %-10s %8.2f %8.4f %8.2f %10.1f%s\n", qPrintable(result.image),
+               qPrintable(result.path), result.score.psnr, result.score.ssim,
+               result.score.deltaE, result.milliseconds, result.passed ? "" : "  FAIL");
+    }
+}
+
+//============================================================================
+/**
+ * @brief Returns the @a results as a JSON document.
+ */
+static QByteArray toJson(const vector<Result>& results)
+{
+    auto array = QJsonArray{};
+    auto passed = true;
+    for (const auto& result : results)
+    {
+        array.append(QJsonObject{
+            {QStringLiteral("image"), result.image},
+            {QStringLiteral("path"), result.path},
+            {QStringLiteral("decoded"), result.decoded},
+            {QStringLiteral("psnr"), result.score.psnr},
+            {QStringLiteral("ssim"), result.score.ssim},
+            {QStringLiteral("deltaE"), result.score.deltaE},
+            {QStringLiteral("ms"), result.milliseconds},
+            {QStringLiteral("passed"), result.passed}
+        });
+        passed = passed && result.passed;
+    }
+    return QJsonDocument(QJsonObject{
+        {QStringLiteral("results"), array},
+        {QStringLiteral("passed"), passed}
+    }).toJson();
+}
+
+//============================================================================
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qtraw-quality"));
+
+    // the handler is chatty on the debug channel
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Compares the fast decode paths with a full quality decode at the same size."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("files"),
+                                 QStringLiteral("Raw files or directories to add to the "
+                                                "synthetic corpus."),
+                                 QStringLiteral("[files...]"));
+    const auto sizeOption = QCommandLineOption(
+        {QStringLiteral("s"), QStringLiteral("size")},
+        QStringLiteral("Compare at <width>x<height>, keeping the aspect ratio "
+                       "(default: 1024x1024)."),
+        QStringLiteral("size"), QStringLiteral("1024x1024"));
+    const auto scenesOption = QCommandLineOption(
+        QStringLiteral("scenes"),
+        QStringLiteral("The synthetic <scenes>, separated by commas, or \"none\" "
+                       "(default: %1).").arg(SyntheticRaw::scenes().join(QLatin1Char(','))),
+        QStringLiteral("scenes"), SyntheticRaw::scenes().join(QLatin1Char(',')));
+    const auto sensorOption = QCommandLineOption(
+        QStringLiteral("sensor"),
+        QStringLiteral("The <width>x<height> of the synthetic sensor (default: 3000x2000)."),
+        QStringLiteral("size"), QStringLiteral("3000x2000"));
+    const auto noiseOption = QCommandLineOption(
+        QStringLiteral("noise"),
+        QStringLiteral("The standard deviation of the sensor noise of the synthetic "
+                       "scenes as a fraction of the white level (default: 0)."),
+        QStringLiteral("sigma"), QStringLiteral("0"));
+    const auto pathsOption = QCommandLineOption(
+        QStringLiteral("paths"),
+        QStringLiteral("Only evaluate the <paths>, separated by commas."),
+        QStringLiteral("paths"));
+    const auto runsOption = QCommandLineOption(
+        QStringLiteral("runs"),
+        QStringLiteral("Decode every image <n> times and report the median time "
+                       "(default: 3)."),
+        QStringLiteral("n"), QStringLiteral("3"));
+    const auto thresholdsOption = QCommandLineOption(
+        QStringLiteral("thresholds"),
+        QStringLiteral("Read the thresholds from the JSON <file>. They apply to every "
+                       "image, the built-in ones only to the synthetic scenes."),
+        QStringLiteral("file"));
+    const auto jsonOption = QCommandLineOption(
+        QStringLiteral("json"),
+        QStringLiteral("Write the results as JSON to <file> (\"-\" for stdout) instead "
+                       "of printing a table."),
+        QStringLiteral("file"));
+    parser.addOptions({sizeOption, scenesOption, sensorOption, noiseOption, pathsOption,
+                       runsOption, thresholdsOption, jsonOption});
+    parser.process(app);
+
+    const auto size = parseSize(parser.value(sizeOption));
+    const auto sensor = parseSize(parser.value(sensorOption));
+    if (size.isEmpty() || sensor.isEmpty())
+    {
+        fprintf(stderr, "Invalid size\n");
+        return 2;
+    }
+    const auto runs = qMax(1, parser.value(runsOption).toInt());
+
+    auto thresholds = defaultThresholds();
+    const auto customThresholds = parser.isSet(thresholdsOption);
+    if (customThresholds && !readThresholds(parser.value(thresholdsOption), &thresholds))
+    {
+        return 2;
+    }
+
+    auto paths = decodePaths();
+    if (parser.isSet(pathsOption))
+    {
+        const auto selected = parser.value(pathsOption).split(QLatin1Char(','));
+        paths.erase(remove_if(paths.begin(), paths.end(),
+                              [&selected](const DecodePath& path)
+                              {
+                                  return !selected.contains(path.name);
+                              }),
+                    paths.end());
+    }
+
+    // the synthetic scenes keep the aspect ratio of the sensor in the preview
+    auto corpus = vector<CorpusImage>();
+    auto options = SyntheticRawOptions{};
+    options.size = sensor;
+    options.previewSize = sensor / 2;
+    options.noise = parser.value(noiseOption).toDouble();
+    for (const auto& scene : parser.value(scenesOption).split(QLatin1Char(','),
+                                                               QString::SkipEmptyParts))
+    {
+        if (scene == QLatin1String("none"))
+        {
+            continue;
+        }
+        const auto data = SyntheticRaw::render(scene, options);
+        if (data.isEmpty())
+        {
+            fprintf(stderr, "Unknown scene %s\n", qPrintable(scene));
+            return 2;
+        }
+        corpus.push_back({scene, data, true});
+    }
+    for (const auto& argument : parser.positionalArguments())
+    {
+        addFiles(argument, &corpus);
+    }
+    if (corpus.empty() || paths.empty())
+    {
+        parser.showHelp(2);
+    }
+
+    auto results = vector<Result>();
+    auto passed = true;
+    for (const auto& image : corpus)
+    {
+        // every path is compared with the full quality and size image,
+        // scaled down with Qt's area averaging
+        auto data = image.data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        auto full = QImage{};
+        if (!develop(&buffer, DevelopParameters{}, QSize(), &full))
+        {
+            fprintf(stderr, "Cannot decode %s\n", qPrintable(image.name));
+            passed = false;
+            continue;
+        }
+        const auto targetSize = full.size().scaled(size, Qt::KeepAspectRatio);
+        const auto reference = full.scaled(targetSize, Qt::IgnoreAspectRatio,
+                                           Qt::SmoothTransformation);
+        full = QImage{};
+
+        for (const auto& path : paths)
+        {
+            auto decoded = QImage{};
+            auto result = Result{image.name, path.name, QualityScore{}, 0.0, false, false};
+            result.milliseconds = measure(path, image.data, targetSize, runs, &decoded);
+            result.decoded = result.milliseconds >= 0.0;
+            if (result.decoded)
+            {
+                result.score = compareImages(reference, decoded);
+                result.passed = (!image.synthetic && !customThresholds) ||
+                                !thresholds.contains(path.name) ||
+                                withinThresholds(result.score, thresholds.value(path.name));
+            }
+            passed = passed && result.passed;
+            results.push_back(result);
+        }
+    }
+
+    if (!parser.isSet(jsonOption))
+    {
+        printTable(results);
+    }
+    else if (parser.value(jsonOption) == QLatin1String("-"))
+    {
+        fputs(toJson(results).constData(), stdout);
+    }
+    else
+    {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(toJson(results)) < 0)
+        {
+            fprintf(stderr, "Cannot write %s\n", qPrintable(file.fileName()));
+            return 2;
+        }
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+include(../common-config.pri)
+
+TARGET = qtraw-quality
+TEMPLATE = app
+QT += \
+    core \
+    gui
+CONFIG += c++14 \
+    console
+CONFIG -= app_bundle
+
+include(../src/qtraw-core.pri)
+
+HEADERS += \
+    image-quality.h \
+    synthetic-raw.h
+SOURCES += \
+    image-quality.cpp \
+    main.cpp \
+    synthetic-raw.cpp
+
+# fails if a fast path falls below its thresholds on the synthetic corpus
+check.commands = "./qtraw-quality"
+check.depends = qtraw-quality
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "synthetic-raw.h"
+
+#include <QBuffer>
+#include <QImage>
+#include <QImageWriter>
+#include <QtEndian>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+namespace SyntheticRaw
+{
+using Rgb = array<double, 3>;
+
+/**
+ * @brief A scene returns the linear sRGB colour at the sensor position
+ * @a x, @a y of a sensor of the given @a size.
+ */
+using Scene = Rgb (*)(double x, double y, const QSize& size);
+
+static const auto Pi = 3.14159265358979323846;
+static const auto BlackLevel = 512;
+static const auto WhiteLevel = 16383;
+
+/**
+ * @brief The part of the height the white bar at the top edge takes.
+ */
+static const auto WhiteBar = 0.04;
+
+//============================================================================
+/**
+ * @brief Converts the 8 bit sRGB value @a value to linear sRGB.
+ */
+static double linear(int value)
+{
+    const auto v = value / 255.0;
+    return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+//============================================================================
+/**
+ * @brief Applies the BT.709 curve LibRaw uses by default to @a value.
+ */
+static int bt709(double value)
+{
+    const auto v = qBound(0.0, value, 1.0);
+    const auto curved = v < 0.018 ? 4.5 * v : 1.099 * pow(v, 0.45) - 0.099;
+    return qBound(0, int(lround(curved * 255.0)), 255);
+}
+
+//============================================================================
+static Rgb gradients(double x, double y, const QSize& size)
+{
+    const auto u = x / size.width();
+    const auto v = y / size.height();
+    if (v > 0.85)
+    {
+        // a grey ramp along the bottom edge
+        return {{u, u, u}};
+    }
+
+    // hue along x, saturation along y
+    const auto saturation = (v - WhiteBar) / (0.85 - WhiteBar);
+    const auto h = u * 6.0;
+    const auto f = h - floor(h);
+    const auto value = 0.8;
+    const auto p = value * (1.0 - saturation);
+    const auto q = value * (1.0 - saturation * f);
+    const auto t = value * (1.0 - saturation * (1.0 - f));
+    switch (int(h) % 6)
+    {
+    case 0: return {{value, t, p}};
+    case 1: return {{q, value, p}};
+    case 2: return {{p, value, t}};
+    case 3: return {{p, q, value}};
+    case 4: return {{t, p, value}};
+    default: return {{value, p, q}};
+    }
+}
+
+//============================================================================
+static Rgb zonePlate(double x, double y, const QSize& size)
+{
+    // the frequency rises linearly with the radius and reaches the Nyquist
+    // frequency of the sensor in the corners
+    const auto dx = x - size.width() / 2.0;
+    const auto dy = y - size.height() / 2.0;
+    const auto radius = hypot(size.width(), size.height()) / 2.0;
+    const auto value = 0.5 + 0.45 * cos(Pi * (dx * dx + dy * dy) / (2.0 * radius));
+    return {{value, value, value}};
+}
+
+//============================================================================
+static Rgb patches(double x, double y, const QSize& size)
+{
+    // the sRGB values of the ColorChecker chart
+    static const auto chart = array<array<int, 3>, 24>{{
+        {{115, 82, 68}}, {{194, 150, 130}}, {{98, 122, 157}},
+        {{87, 108, 67}}, {{133, 128, 177}}, {{103, 189, 170}},
+        {{214, 126, 44}}, {{80, 91, 166}}, {{193, 90, 99}},
+        {{94, 60, 108}}, {{157, 188, 64}}, {{224, 163, 46}},
+        {{56, 61, 150}}, {{70, 148, 73}}, {{175, 54, 60}},
+        {{231, 199, 31}}, {{187, 86, 149}}, {{8, 133, 161}},
+        {{243, 243, 242}}, {{200, 200, 200}}, {{160, 160, 160}},
+        {{122, 122, 121}}, {{85, 85, 85}}, {{52, 52, 52}}
+    }};
+    static const auto background = Rgb{{0.02, 0.02, 0.02}};
+
+    const auto u = x / size.width() * 6.0;
+    const auto v = (y / size.height() - WhiteBar) / (1.0 - WhiteBar) * 4.0;
+    const auto column = int(u);
+    const auto row = int(v);
+    // a tenth of every cell is background
+    if (u - column < 0.05 || u - column > 0.95 || v - row < 0.05 || v - row > 0.95 ||
+        row < 0 || row > 3)
+    {
+        return background;
+    }
+    const auto& patch = chart[size_t(row * 6 + column)];
+    return {{linear(patch[0]), linear(patch[1]), linear(patch[2])}};
+}
+
+//============================================================================
+static Rgb lines(double x, double y, const QSize& size)
+{
+    // the line width grows from one to four pixels from left to right,
+    // vertical lines above and horizontal lines below
+    const auto width = 1 + qMin(3, int(x / size.width() * 4.0));
+    const auto vertical = y / size.height() < 0.55;
+    const auto position = int(floor(vertical ? x : y));
+    const auto value = (position / width) % 2 ? 0.9 : 0.05;
+    return {{value, value, value}};
+}
+
+//============================================================================
+/**
+ * @brief Returns the scene with the name @a name, or nullptr.
+ */
+static Scene findScene(const QString& name)
+{
+    static const auto scenes = vector<pair<QString, Scene>>{
+        {QStringLiteral("gradients"), &gradients},
+        {QStringLiteral("zone-plate"), &zonePlate},
+        {QStringLiteral("patches"), &patches},
+        {QStringLiteral("lines"), &lines}
+    };
+    const auto it = find_if(scenes.begin(), scenes.end(),
+                            [&name](const pair<QString, Scene>& entry)
+                            {
+                                return entry.first == name;
+                            });
+    return it == scenes.end() ? nullptr : it->second;
+}
+
+//============================================================================
+/**
+ * @brief Returns the colour of @a scene at @a x, @a y including the white
+ * bar.
+ */
+static Rgb sample(Scene scene, double x, double y, const QSize& size)
+{
+    if (y < WhiteBar * size.height())
+    {
+        return {{1.0, 1.0, 1.0}};
+    }
+    return scene(x, y, size);
+}
+
+//============================================================================
+/**
+ * @brief Renders the RGGB mosaic of @a scene as 16 bit little endian sensor
+ * values.
+ */
+static QByteArray renderMosaic(Scene scene, const SyntheticRawOptions& options)
+{
+    const auto& size = options.size;
+    auto mosaic = QByteArray(size.width() * size.height() * 2, Qt::Uninitialized);
+    auto* out = reinterpret_cast<uchar*>(mosaic.data());
+    auto generator = mt19937(options.seed);
+    auto noise = normal_distribution<double>(0.0, options.noise);
+
+    for (int y = 0; y < size.height(); ++y)
+    {
+        for (int x = 0; x < size.width(); ++x, out += 2)
+        {
+            // R G / G B
+            const auto channel = (y & 1) + (x & 1);
+            auto value = sample(scene, x + 0.5, y + 0.5, size)[size_t(channel)];
+            if (options.noise > 0.0)
+            {
+                value += noise(generator);
+            }
+            const auto level = BlackLevel + lround(qBound(0.0, value, 1.0) *
+                                                   (WhiteLevel - BlackLevel));
+            qToLittleEndian(quint16(level), out);
+        }
+    }
+    return mosaic;
+}
+
+//============================================================================
+/**
+ * @brief Renders @a scene as the JPEG preview. Every preview pixel averages
+ * a grid of scene samples, like a preview that is scaled down from the
+ * developed image.
+ */
+static QByteArray renderPreview(Scene scene, const SyntheticRawOptions& options)
+{
+    const auto& size = options.size;
+    const auto& previewSize = options.previewSize;
+    const auto scaleX = double(size.width()) / previewSize.width();
+    const auto scaleY = double(size.height()) / previewSize.height();
+    const auto samples = qBound(1, int(ceil(qMax(scaleX, scaleY))) * 2, 4);
+
+    auto preview = QImage(previewSize, QImage::Format_RGB32);
+    for (int y = 0; y < previewSize.height(); ++y)
+    {
+        auto* line = reinterpret_cast<QRgb*>(preview.scanLine(y));
+        for (int x = 0; x < previewSize.width(); ++x)
+        {
+            auto sum = Rgb{{0.0, 0.0, 0.0}};
+            for (int sy = 0; sy < samples; ++sy)
+            {
+                for (int sx = 0; sx < samples; ++sx)
+                {
+                    const auto color = sample(scene, (x + (sx + 0.5) / samples) * scaleX,
+                                              (y + (sy + 0.5) / samples) * scaleY, size);
+                    for (size_t c = 0; c < sum.size(); ++c)
+                    {
+                        sum[c] += color[c];
+                    }
+                }
+            }
+            const auto n = double(samples * samples);
+            line[x] = qRgb(bt709(sum[0] / n), bt709(sum[1] / n), bt709(sum[2] / n));
+        }
+    }
+
+    auto jpeg = QByteArray();
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "jpeg");
+    writer.setQuality(92);
+    if (!writer.write(preview))
+    {
+        return QByteArray();
+    }
+    return jpeg;
+}
+
+/**
+ * @brief One entry of a TIFF IFD.
+ */
+struct TiffEntry
+{
+    enum Type : quint16
+    {
+        Byte = 1,
+        Ascii = 2,
+        Short = 3,
+        Long = 4,
+        Rational = 5,
+        SRational = 10
+    };
+
+    quint16 tag;
+    Type type;
+    quint32 count;
+    QByteArray value;
+};
+
+//============================================================================
+/**
+ * @brief Appends the little endian @a value to @a data.
+ */
+template<typename T>
+static void append(QByteArray* data, T value)
+{
+    uchar bytes[sizeof(T)];
+    qToLittleEndian(value, bytes);
+    data->append(reinterpret_cast<const char*>(bytes), int(sizeof(T)));
+}
+
+//============================================================================
+/**
+ * @brief Returns an entry with the integral @a values of the given @a type.
+ */
+static TiffEntry entry(quint16 tag, TiffEntry::Type type,
+                       initializer_list<quint32> values)
+{
+    auto result = TiffEntry{tag, type, quint32(values.size()), QByteArray()};
+    for (const auto value : values)
+    {
+        switch (type)
+        {
+        case TiffEntry::Byte: result.value.append(char(value)); break;
+        case TiffEntry::Short: append(&result.value, quint16(value)); break;
+        default: append(&result.value, value); break;
+        }
+    }
+    return result;
+}
+
+//============================================================================
+/**
+ * @brief Returns an entry with the string @a text.
+ */
+static TiffEntry ascii(quint16 tag, const char* text)
+{
+    auto value = QByteArray(text);
+    value.append('\0');
+    return {tag, TiffEntry::Ascii, quint32(value.size()), value};
+}
+
+//============================================================================
+/**
+ * @brief Returns an entry with the (signed) rationals @a values, which are
+ * stored as ten thousandths.
+ */
+static TiffEntry rationals(quint16 tag, TiffEntry::Type type,
+                           initializer_list<double> values)
+{
+    auto result = TiffEntry{tag, type, quint32(values.size()), QByteArray()};
+    for (const auto value : values)
+    {
+        append(&result.value, qint32(lround(value * 10000.0)));
+        append(&result.value, qint32(10000));
+    }
+    return result;
+}
+
+//============================================================================
+/**
+ * @brief Appends an IFD with the @a entries to @a file.
+ * @returns the position of the offset of the next IFD
+ */
+static int appendIfd(QByteArray* file, vector<TiffEntry> entries)
+{
+    sort(entries.begin(), entries.end(), [](const TiffEntry& a, const TiffEntry& b)
+                                         {
+                                             return a.tag < b.tag;
+                                         });
+    const auto start = file->size();
+    const auto dataStart = start + 2 + 12 * int(entries.size()) + 4;
+    auto data = QByteArray();
+
+    append(file, quint16(entries.size()));
+    for (const auto& entry : entries)
+    {
+        append(file, entry.tag);
+        append(file, quint16(entry.type));
+        append(file, entry.count);
+        if (entry.value.size() <= 4)
+        {
+            file->append(entry.value);
+            file->append(4 - entry.value.size(), '\0');
+            continue;
+        }
+        append(file, quint32(dataStart + data.size()));
+        data.append(entry.value);
+        if (data.size() % 2)
+        {
+            data.append('\0');
+        }
+    }
+    const auto next = file->size();
+    append(file, quint32(0));
+    file->append(data);
+    return next;
+}
+
+//============================================================================
+/**
+ * @brief Overwrites the little endian 32 bit value at @a position of @a file.
+ */
+static void patch(QByteArray* file, int position, quint32 value)
+{
+    qToLittleEndian(value, reinterpret_cast<uchar*>(file->data() + position));
+}
+
+//============================================================================
+QStringList scenes()
+{
+    return {QStringLiteral("gradients"), QStringLiteral("zone-plate"),
+            QStringLiteral("patches"), QStringLiteral("lines")};
+}
+
+//============================================================================
+QByteArray render(const QString& name, const SyntheticRawOptions& options)
+{
+    const auto scene = findScene(name);
+    if (!scene || options.size.isEmpty())
+    {
+        return QByteArray();
+    }
+    const auto width = quint32(options.size.width());
+    const auto height = quint32(options.size.height());
+
+    auto file = QByteArray("II*\0\0\0\0\0", 8);
+    const auto mosaicOffset = quint32(file.size());
+    file.append(renderMosaic(scene, options));
+    const auto mosaicLength = quint32(file.size()) - mosaicOffset;
+
+    const auto preview = options.previewSize.isEmpty() ?
+                         QByteArray() : renderPreview(scene, options);
+    const auto previewOffset = quint32(file.size());
+    file.append(preview);
+    if (file.size() % 2)
+    {
+        file.append('\0');
+    }
+
+    // XYZ to linear sRGB, so the camera colours are sRGB
+    const auto rawIfd = vector<TiffEntry>{
+        entry(254, TiffEntry::Long, {0}),
+        entry(256, TiffEntry::Long, {width}),
+        entry(257, TiffEntry::Long, {height}),
+        entry(258, TiffEntry::Short, {16}),
+        entry(259, TiffEntry::Short, {1}),
+        entry(262, TiffEntry::Short, {32803}),
+        ascii(271, "QtRaw"),
+        ascii(272, "Synthetic"),
+        entry(273, TiffEntry::Long, {mosaicOffset}),
+        entry(274, TiffEntry::Short, {quint32(options.orientation)}),
+        entry(277, TiffEntry::Short, {1}),
+        entry(278, TiffEntry::Long, {height}),
+        entry(279, TiffEntry::Long, {mosaicLength}),
+        entry(284, TiffEntry::Short, {1}),
+        entry(33421, TiffEntry::Short, {2, 2}),
+        entry(33422, TiffEntry::Byte, {0, 1, 1, 2}),
+        entry(50706, TiffEntry::Byte, {1, 4, 0, 0}),
+        ascii(50708, "QtRaw Synthetic"),
+        entry(50714, TiffEntry::Long, {BlackLevel}),
+        entry(50717, TiffEntry::Long, {WhiteLevel}),
+        rationals(50721, TiffEntry::SRational, {3.2405, -1.5371, -0.4985,
+                                                -0.9693, 1.8760, 0.0416,
+                                                0.0556, -0.2040, 1.0572}),
+        rationals(50728, TiffEntry::Rational, {1.0, 1.0, 1.0}),
+        entry(50778, TiffEntry::Short, {21})
+    };
+    patch(&file, 4, quint32(file.size()));
+    const auto next = appendIfd(&file, rawIfd);
+
+    if (!preview.isEmpty())
+    {
+        const auto previewWidth = quint32(options.previewSize.width());
+        const auto previewHeight = quint32(options.previewSize.height());
+        const auto previewIfd = vector<TiffEntry>{
+            entry(254, TiffEntry::Long, {1}),
+            entry(256, TiffEntry::Long, {previewWidth}),
+            entry(257, TiffEntry::Long, {previewHeight}),
+            entry(258, TiffEntry::Short, {8, 8, 8}),
+            entry(259, TiffEntry::Short, {7}),
+            entry(262, TiffEntry::Short, {6}),
+            entry(273, TiffEntry::Long, {previewOffset}),
+            entry(277, TiffEntry::Short, {3}),
+            entry(278, TiffEntry::Long, {previewHeight}),
+            entry(279, TiffEntry::Long, {quint32(preview.size())}),
+            entry(284, TiffEntry::Short, {1})
+        };
+        if (file.size() % 2)
+        {
+            file.append('\0');
+        }
+        patch(&file, next, quint32(file.size()));
+        appendIfd(&file, previewIfd);
+    }
+    return file;
+}
+}
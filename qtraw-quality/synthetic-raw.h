@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYNTHETIC_RAW_H
+#define SYNTHETIC_RAW_H
+
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief The parameters of a synthetic raw image.
+ */
+struct SyntheticRawOptions
+{
+    /**
+     * The size of the sensor.
+     */
+    QSize size{3000, 2000};
+
+    /**
+     * The size of the embedded JPEG preview. An empty size leaves the
+     * preview out.
+     */
+    QSize previewSize{1500, 1000};
+
+    /**
+     * The standard deviation of the Gaussian noise that is added to the
+     * sensor values, as a fraction of the white level.
+     */
+    double noise{0.0};
+
+    /**
+     * The seed of the noise, so a corpus can be rendered again exactly.
+     */
+    quint32 seed{1};
+
+    /**
+     * The TIFF orientation of the camera, e.g. 6 if the camera was turned
+     * 90 degrees clockwise.
+     */
+    int orientation{1};
+};
+
+/**
+ * @brief The SyntheticRaw namespace renders test scenes into DNG files.
+ *
+ * The scenes are given in linear sRGB. The sensor of the DNG has an RGGB
+ * Bayer pattern whose colours are linear sRGB, and the DNG declares a neutral
+ * white balance, so LibRaw's processed sRGB output of a scene is known in
+ * advance. The embedded preview is the scene with the BT.709 curve of LibRaw.
+ * Every scene has a white bar along its top edge that is large enough to pin
+ * LibRaw's auto brightness to the white level.
+ */
+namespace SyntheticRaw
+{
+/**
+ * @brief Returns the names of all scenes.
+ *
+ * - "gradients": smooth ramps of hue, saturation and brightness
+ * - "zone-plate": concentric rings whose frequency rises up to the Nyquist
+ *   frequency of the sensor, to provoke aliasing
+ * - "patches": a chart of colour patches with sharp edges
+ * - "lines": black and white lines from one to four pixels wide, to measure
+ *   the loss of detail
+ */
+QStringList scenes();
+
+/**
+ * @brief Renders the scene @a scene into a DNG file.
+ * @returns the DNG file, or an empty array if there is no such scene
+ */
+QByteArray render(const QString& scene, const SyntheticRawOptions& options);
+}
+
+#endif // SYNTHETIC_RAW_H
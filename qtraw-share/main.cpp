@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "shared-frame.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QLoggingCategory>
+#include <QProcess>
+
+using namespace std;
+
+//============================================================================
+/**
+ * @brief Returns a checksum over one byte of every page of @a image, so the
+ * consumer in the benchmark touches all the memory it has received.
+ */
+static quint64 touch(const QImage& image)
+{
+    auto sum = quint64{};
+    for (int y = 0; y < image.height(); ++y)
+    {
+        const auto* line = image.constScanLine(y);
+        for (int x = 0; x < image.bytesPerLine(); x += 4096)
+        {
+            sum += line[x];
+        }
+    }
+    return sum;
+}
+
+//============================================================================
+/**
+ * @brief The consumer side of the benchmark. Reads the commands of bench()
+ * from stdin and answers every frame it receives with its checksum.
+ * @returns the exit code
+ */
+static int consume()
+{
+    char line[512];
+    while (fgets(line, sizeof(line), stdin))
+    {
+        auto image = QImage();
+        const auto fields = QByteArray(line).trimmed().split(' ');
+        if (fields.value(0) == "pipe" && fields.size() == 5)
+        {
+            image = QImage(fields[1].toInt(), fields[2].toInt(),
+                           QImage::Format(fields[4].toInt()));
+            if (image.bytesPerLine() != fields[3].toInt())
+            {
+                return 1;
+            }
+            const auto size = size_t(image.bytesPerLine()) * size_t(image.height());
+            if (fread(image.bits(), 1, size, stdin) != size)
+            {
+                return 1;
+            }
+        }
+        else if (fields.value(0) == "shm" && fields.size() == 2)
+        {
+            image = SharedFrame::take(QString::fromLocal8Bit(fields[1]));
+        }
+        else
+        {
+            return 0;
+        }
+        printf("%llu\n", static_cast<unsigned long long>(touch(image)));
+        fflush(stdout);
+    }
+    return 0;
+}
+
+//============================================================================
+/**
+ * @brief Waits for the answer of the @a consumer to a frame.
+ * @returns the checksum, or -1 if the consumer has died
+ */
+static qint64 answer(QProcess* consumer)
+{
+    while (consumer->bytesToWrite() > 0)
+    {
+        if (!consumer->waitForBytesWritten(-1))
+        {
+            return -1;
+        }
+    }
+    while (!consumer->canReadLine())
+    {
+        if (!consumer->waitForReadyRead(-1))
+        {
+            return -1;
+        }
+    }
+    return consumer->readLine().trimmed().toLongLong();
+}
+
+//============================================================================
+/**
+ * @brief Returns the median of @a times in milliseconds.
+ */
+static double median(vector<qint64> times)
+{
+    sort(times.begin(), times.end());
+    return double(times[times.size() / 2]) / 1e6;
+}
+
+//============================================================================
+/**
+ * @brief Hands the decoded @a file @a runs times to a consumer process,
+ * through a pipe and through shared memory, and prints how long that takes.
+ * @returns the exit code
+ */
+static int bench(const QString& file, int runs)
+{
+    QImageReader reader(file);
+    const auto frame = reader.read().convertToFormat(QImage::Format_RGB32);
+    if (frame.isNull())
+    {
+        fprintf(stderr, "Cannot read %s: %s\n", qPrintable(file),
+                qPrintable(reader.errorString()));
+        return 1;
+    }
+
+    QProcess consumer;
+    consumer.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    consumer.start(QCoreApplication::applicationFilePath(), {QStringLiteral("--consumer")});
+    if (!consumer.waitForStarted())
+    {
+        fprintf(stderr, "Cannot start the consumer: %s\n", qPrintable(consumer.errorString()));
+        return 1;
+    }
+
+    const auto expected = qint64(touch(frame));
+    const auto frameSize = qint64(frame.bytesPerLine()) * frame.height();
+    auto pipeTimes = vector<qint64>();
+    auto shmTimes = vector<qint64>();
+    for (int run = 0; run < runs; ++run)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        consumer.write(QStringLiteral("pipe %1 %2 %3 %4\n")
+                       .arg(frame.width()).arg(frame.height())
+                       .arg(frame.bytesPerLine()).arg(int(frame.format())).toLatin1());
+        consumer.write(reinterpret_cast<const char*>(frame.constBits()), frameSize);
+        if (answer(&consumer) != expected)
+        {
+            fprintf(stderr, "The consumer did not receive the frame through the pipe\n");
+            return 1;
+        }
+        pipeTimes.push_back(timer.nsecsElapsed());
+
+        // the decoder writes into the segment in place, so filling it is
+        // not part of the handoff
+        const auto name = QStringLiteral("/qtraw-share-%1-%2")
+                          .arg(QCoreApplication::applicationPid()).arg(run);
+        SharedFrameWriter writer(name);
+        if (!writer.create(frame.size(), frame.format()))
+        {
+            fprintf(stderr, "%s\n", qPrintable(writer.errorString()));
+            return 1;
+        }
+        auto* image = writer.image();
+        for (int y = 0; y < frame.height(); ++y)
+        {
+            memcpy(image->scanLine(y), frame.constScanLine(y), size_t(frame.bytesPerLine()));
+        }
+
+        timer.start();
+        if (!writer.publish())
+        {
+            fprintf(stderr, "%s\n", qPrintable(writer.errorString()));
+            return 1;
+        }
+        consumer.write(QStringLiteral("shm %1\n").arg(name).toLocal8Bit());
+        if (answer(&consumer) != expected)
+        {
+            SharedFrame::remove(name);
+            fprintf(stderr, "The consumer did not receive the frame through shared memory\n");
+            return 1;
+        }
+        shmTimes.push_back(timer.nsecsElapsed());
+    }
+    consumer.write("quit\n");
+    consumer.waitForFinished();
+
+    const auto megabytes = double(frameSize) / (1024 * 1024);
+    printf("%dx%d frame, %.1f MiB, median of %d runs\n", frame.width(), frame.height(),
+           megabytes, runs);
+    for (const auto& result : {make_pair("pipe", median(pipeTimes)),
+                               make_pair("shared memory", median(shmTimes))})
+    {
+        printf("  %-14s %8.2f ms  %8.0f MiB/s\n", result.first, result.second,
+               megabytes / result.second * 1000);
+    }
+    return 0;
+}
+
+//============================================================================
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qtraw-share"));
+
+    // the handler is chatty on the debug channel
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Decodes an image into a named shared memory segment for another process, "
+        "takes a frame out of a segment, or compares the handoff through shared "
+        "memory with a pipe."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("The image to share."));
+    const auto nameOption = QCommandLineOption(
+        QStringLiteral("name"),
+        QStringLiteral("The <name> of the segment, starting with a slash (default: /qtraw-<pid>)."),
+        QStringLiteral("name"));
+    const auto sizeOption = QCommandLineOption(
+        {QStringLiteral("s"), QStringLiteral("size")},
+        QStringLiteral("Decode to <width>x<height> instead of the full size."),
+        QStringLiteral("size"));
+    const auto takeOption = QCommandLineOption(
+        QStringLiteral("take"),
+        QStringLiteral("Take the frame out of the segment <name> and write it to <file>."),
+        QStringLiteral("name"));
+    const auto benchOption = QCommandLineOption(
+        QStringLiteral("bench"),
+        QStringLiteral("Hand <file> to a consumer process <runs> times through a pipe and "
+                       "through shared memory."),
+        QStringLiteral("runs"));
+    auto consumerOption = QCommandLineOption(QStringLiteral("consumer"));
+    consumerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOptions({nameOption, sizeOption, takeOption, benchOption, consumerOption});
+    parser.process(app);
+
+    if (parser.isSet(consumerOption))
+    {
+        return consume();
+    }
+    const auto args = parser.positionalArguments();
+    if (args.size() != 1)
+    {
+        parser.showHelp(1);
+    }
+    if (parser.isSet(benchOption))
+    {
+        return bench(args.first(), qMax(1, parser.value(benchOption).toInt()));
+    }
+    if (parser.isSet(takeOption))
+    {
+        auto error = QString();
+        const auto image = SharedFrame::take(parser.value(takeOption), &error);
+        if (image.isNull() || !image.save(args.first()))
+        {
+            fprintf(stderr, "Cannot take %s: %s\n", qPrintable(parser.value(takeOption)),
+                    qPrintable(image.isNull() ? error : QStringLiteral("cannot write the file")));
+            return 1;
+        }
+        return 0;
+    }
+
+    QImageReader reader(args.first());
+    if (parser.isSet(sizeOption))
+    {
+        const auto size = parser.value(sizeOption).split(QLatin1Char('x'));
+        reader.setScaledSize(QSize(size.value(0).toInt(), size.value(1).toInt()));
+    }
+    const auto name = parser.isSet(nameOption) ?
+                      parser.value(nameOption) :
+                      QStringLiteral("/qtraw-%1").arg(QCoreApplication::applicationPid());
+    SharedFrameWriter writer(name);
+    if (!writer.decode(&reader))
+    {
+        fprintf(stderr, "Cannot share %s: %s\n", qPrintable(args.first()),
+                qPrintable(writer.errorString()));
+        return 1;
+    }
+    // the consumer takes the frame over with the name
+    printf("%s\n", qPrintable(name));
+    return 0;
+}
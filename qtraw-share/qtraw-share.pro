@@ -0,0 +1,18 @@
+include(../common-config.pri)
+
+TARGET = qtraw-share
+TEMPLATE = app
+QT += \
+    core \
+    gui
+CONFIG += c++14 \
+    console
+CONFIG -= app_bundle
+
+include(../src/qtraw-core.pri)
+
+SOURCES += \
+    main.cpp
+
+target.path = $${INSTALL_PREFIX}/bin
+INSTALLS += target
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thumbnail-server.h"
+
+#include "buffer-pool.h"
+
+#include <cstdio>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QLoggingCategory>
+#include <QStandardPaths>
+#include <QThread>
+
+/**
+ * @brief The unit of the size options.
+ */
+static constexpr qint64 MiB = 1024 * 1024;
+
+//============================================================================
+/**
+ * @brief Sends the single @a request to the daemon on the socket @a name and
+ * prints its answer.
+ * @returns the exit code
+ */
+static int query(const QString& name, const QJsonObject& request)
+{
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    if (!socket.waitForConnected(5000))
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", qPrintable(name),
+                qPrintable(socket.errorString()));
+        return 1;
+    }
+    socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+    while (!socket.canReadLine())
+    {
+        if (!socket.waitForReadyRead(-1))
+        {
+            fprintf(stderr, "No answer from %s: %s\n", qPrintable(name),
+                    qPrintable(socket.errorString()));
+            return 1;
+        }
+    }
+    const auto answer = socket.readLine();
+    printf("%s", answer.constData());
+    return QJsonDocument::fromJson(answer).object().value("status") ==
+           QLatin1String("ok") ? 0 : 1;
+}
+
+//============================================================================
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qtraw-thumbd"));
+
+    // the handler is chatty on the debug channel
+    QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+        "Serves thumbnails of raw images on a local socket. Every request is a "
+        "line of JSON like {\"path\": \"a.arw\", \"width\": 256, \"height\": 256}."));
+    parser.addHelpOption();
+    const auto socketOption = QCommandLineOption(
+        QStringLiteral("socket"),
+        QStringLiteral("The <name> or path of the local socket (default: qtraw-thumbd)."),
+        QStringLiteral("name"), QStringLiteral("qtraw-thumbd"));
+    const auto cacheOption = QCommandLineOption(
+        QStringLiteral("cache"),
+        QStringLiteral("The <directory> the thumbnails are stored in."),
+        QStringLiteral("directory"),
+        QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+            .filePath(QStringLiteral("thumbnails")));
+    const auto threadsOption = QCommandLineOption(
+        {QStringLiteral("j"), QStringLiteral("threads")},
+        QStringLiteral("Decode <n> images in parallel (default: the number of cores)."),
+        QStringLiteral("n"), QString::number(QThread::idealThreadCount()));
+    const auto queryOption = QCommandLineOption(
+        QStringLiteral("query"),
+        QStringLiteral("Don't serve, but ask a running daemon for the thumbnail of <file>."),
+        QStringLiteral("file"));
+    const auto sizeOption = QCommandLineOption(
+        {QStringLiteral("s"), QStringLiteral("size")},
+        QStringLiteral("The <width>x<height> of the queried thumbnail."),
+        QStringLiteral("size"), QStringLiteral("256x256"));
+    const auto statsOption = QCommandLineOption(
+        QStringLiteral("stats"),
+        QStringLiteral("Don't serve, but print the statistics of a running daemon."));
+    const auto cacheSizeOption = QCommandLineOption(
+        QStringLiteral("cache-size"),
+        QStringLiteral("Keep at most <MiB> of thumbnails in the cache (default: %1).")
+            .arg(ThumbnailServer::DefaultMaxCacheSize / MiB),
+        QStringLiteral("MiB"), QString::number(ThumbnailServer::DefaultMaxCacheSize / MiB));
+    const auto retainOption = QCommandLineOption(
+        QStringLiteral("retain-memory"),
+        QStringLiteral("Keep at most <MiB> of idle decode buffers (default: %1).")
+            .arg(BufferPool::DefaultRetainLimit / MiB),
+        QStringLiteral("MiB"), QString::number(BufferPool::DefaultRetainLimit / MiB));
+    parser.addOptions({socketOption, cacheOption, threadsOption, queryOption,
+                       sizeOption, statsOption, cacheSizeOption, retainOption});
+    parser.process(app);
+
+    const auto name = parser.value(socketOption);
+    if (parser.isSet(statsOption))
+    {
+        return query(name, {{"command", "stats"}});
+    }
+    if (parser.isSet(queryOption))
+    {
+        const auto size = parser.value(sizeOption).split(QLatin1Char('x'));
+        return query(name, {
+            {"path", QFileInfo(parser.value(queryOption)).absoluteFilePath()},
+            {"width", size.value(0).toInt()},
+            {"height", size.value(1).toInt()}
+        });
+    }
+
+    // the daemon decodes for as long as it runs, so LibRaw's buffers are kept
+    BufferPool::serveLibRaw();
+    BufferPool::global().setRetainLimit(parser.value(retainOption).toLongLong() * MiB);
+    ThumbnailServer server(parser.value(cacheOption), parser.value(threadsOption).toInt());
+    server.setMaxCacheSize(parser.value(cacheSizeOption).toLongLong() * MiB);
+    if (!server.listen(name))
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", qPrintable(name),
+                qPrintable(server.errorString()));
+        return 1;
+    }
+    return app.exec();
+}
@@ -0,0 +1,22 @@
+include(../common-config.pri)
+
+TARGET = qtraw-thumbd
+TEMPLATE = app
+QT += \
+    core \
+    gui \
+    network
+CONFIG += c++14 \
+    console
+CONFIG -= app_bundle
+
+include(../src/qtraw-core.pri)
+
+HEADERS += \
+    thumbnail-server.h
+SOURCES += \
+    main.cpp \
+    thumbnail-server.cpp
+
+target.path = $${INSTALL_PREFIX}/bin
+INSTALLS += target
@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thumbnail-server.h"
+
+#include "preview-locator.h"
+#include "raw-io-handler.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageWriter>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QRunnable>
+#include <QSaveFile>
+
+using namespace std;
+
+/**
+ * @brief The number of latencies the percentiles are computed from.
+ */
+static constexpr size_t LatencyWindow = 10000;
+
+constexpr qint64 ThumbnailServer::DefaultMaxCacheSize;
+
+/**
+ * @brief Decodes one thumbnail on a thread of the pool.
+ */
+class ThumbnailJob : public QRunnable
+{
+public:
+    ThumbnailServer* server;
+    QString key;
+    QString path;
+    QString file;
+    QSize size;
+    QByteArray format;
+    int quality;
+    QString source;
+
+    void run() override
+    {
+        const auto error = decode();
+        QMetaObject::invokeMethod(server, "finish", Qt::QueuedConnection,
+                                  Q_ARG(QString, key), Q_ARG(QString, file),
+                                  Q_ARG(QString, error));
+    }
+
+private:
+    /**
+     * @brief Decodes the thumbnail and writes it to the cache.
+     * @returns the error message, or an empty string on success
+     */
+    QString decode() const
+    {
+        // the frame buffer of every thread lives as long as the pool
+        static thread_local QImage image;
+
+        QFile input(path);
+        if (!input.open(QIODevice::ReadOnly))
+        {
+            return input.errorString();
+        }
+        RawIOHandler handler;
+        handler.setDevice(&input);
+        handler.setRawOption(RawIOHandler::Source, source);
+        if (size.isValid() && source == QLatin1String("auto"))
+        {
+            // A preview that is larger than the thumbnail is found without
+            // LibRaw in TIFF based files, so they are never identified
+            PreviewLocator locator(&input);
+            auto preview = EmbeddedPreview{};
+            if (locator.locate(&preview))
+            {
+                const auto previewSize = (preview.orientation & 4) ?
+                                         preview.size.transposed() : preview.size;
+                if (previewSize.width() > size.width() ||
+                    previewSize.height() > size.height())
+                {
+                    handler.setRawOption(RawIOHandler::Source, RawIOHandler::PreviewSource);
+                }
+            }
+        }
+        if (size.isValid())
+        {
+            const auto fullSize = handler.option(QImageIOHandler::Size).toSize();
+            if (fullSize.width() > size.width() || fullSize.height() > size.height())
+            {
+                handler.setOption(QImageIOHandler::ScaledSize,
+                                  fullSize.scaled(size, Qt::KeepAspectRatio));
+            }
+        }
+        if (!handler.read(&image))
+        {
+            return QStringLiteral("could not decode the raw image");
+        }
+
+        // QSaveFile makes the thumbnail appear atomically in the cache
+        QSaveFile output(file);
+        if (!output.open(QIODevice::WriteOnly))
+        {
+            return output.errorString();
+        }
+        QImageWriter writer(&output, format);
+        writer.setQuality(quality);
+        if (!writer.write(image))
+        {
+            return writer.errorString();
+        }
+        return output.commit() ? QString() : output.errorString();
+    }
+};
+
+//============================================================================
+ThumbnailServer::ThumbnailServer(const QString& cacheDirectory, int threads,
+                                 QObject* parent) :
+    QObject(parent),
+    m_server(new QLocalServer(this)),
+    m_cacheDirectory(cacheDirectory)
+{
+    m_pool.setMaxThreadCount(max(1, threads));
+    // keep the decoder threads and their frame buffers alive between requests
+    m_pool.setExpiryTimeout(-1);
+    m_clock.start();
+    m_latencies.reserve(LatencyWindow);
+    connect(m_server, &QLocalServer::newConnection,
+            this, &ThumbnailServer::acceptConnection);
+}
+
+//============================================================================
+ThumbnailServer::~ThumbnailServer()
+{
+    m_pool.waitForDone();
+}
+
+//============================================================================
+bool ThumbnailServer::listen(const QString& name)
+{
+    if (!QDir().mkpath(m_cacheDirectory))
+    {
+        return false;
+    }
+    m_cacheSize = 0;
+    for (const auto& info : cachedFiles())
+    {
+        m_cacheSize += info.size();
+    }
+    evict();
+
+    // a crashed daemon leaves its socket file behind
+    QLocalServer::removeServer(name);
+    return m_server->listen(name);
+}
+
+//============================================================================
+QString ThumbnailServer::errorString() const
+{
+    return m_server->errorString();
+}
+
+//============================================================================
+void ThumbnailServer::setMaxCacheSize(qint64 maxSize)
+{
+    m_maxCacheSize = maxSize;
+    evict();
+}
+
+//============================================================================
+void ThumbnailServer::acceptConnection()
+{
+    while (auto* socket = m_server->nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::readyRead,
+                this, [this, socket] { readRequests(socket); });
+        connect(socket, &QLocalSocket::disconnected,
+                socket, &QLocalSocket::deleteLater);
+    }
+}
+
+//============================================================================
+void ThumbnailServer::readRequests(QLocalSocket* socket)
+{
+    while (socket->canReadLine())
+    {
+        const auto document = QJsonDocument::fromJson(socket->readLine());
+        if (!document.isObject())
+        {
+            send(socket, {{"status", "error"}, {"error", "malformed request"}});
+            continue;
+        }
+        handleRequest(socket, document.object());
+    }
+}
+
+//============================================================================
+void ThumbnailServer::handleRequest(QLocalSocket* socket, const QJsonObject& request)
+{
+    const auto waiter = Waiter{socket, m_clock.nsecsElapsed()};
+    if (request.value("command").toString() == QLatin1String("stats"))
+    {
+        send(socket, statistics());
+        return;
+    }
+
+    ++m_requests;
+    const auto info = QFileInfo(request.value("path").toString());
+    if (!info.isFile())
+    {
+        reply(waiter, {{"status", "error"}, {"error", "no such file"}});
+        return;
+    }
+    const auto size = QSize(request.value("width").toInt(),
+                            request.value("height").toInt());
+    const auto format = request.value("format").toString(QStringLiteral("jpg")).toLower();
+    const auto quality = request.value("quality").toInt(-1);
+    const auto source = request.value("source").toString(QStringLiteral("auto"));
+    if (!QImageWriter::supportedImageFormats().contains(format.toLatin1()))
+    {
+        reply(waiter, {{"status", "error"}, {"error", "unsupported format"}});
+        return;
+    }
+
+    // a modified raw file gets a new thumbnail
+    const auto path = info.canonicalFilePath();
+    const auto key = QString::fromLatin1(QCryptographicHash::hash(
+        QStringList{path, QString::number(info.lastModified().toMSecsSinceEpoch()),
+                    QString::number(info.size()), QString::number(size.width()),
+                    QString::number(size.height()), format, QString::number(quality),
+                    source}.join(QLatin1Char('\n')).toUtf8(),
+        QCryptographicHash::Sha1).toHex());
+    const auto file = QDir(m_cacheDirectory).filePath(key + QLatin1Char('.') + format);
+
+    QFile cached(file);
+    if (cached.open(QIODevice::ReadOnly))
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+        // the modification time orders the thumbnails for the eviction
+        cached.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#endif
+        ++m_cacheHits;
+        reply(waiter, {{"status", "ok"}, {"file", file}, {"cached", true}});
+        return;
+    }
+
+    auto& waiters = m_pending[key];
+    waiters << waiter;
+    if (waiters.size() > 1)
+    {
+        // the thumbnail is being decoded already
+        ++m_coalesced;
+        return;
+    }
+
+    auto* job = new ThumbnailJob;
+    job->server = this;
+    job->key = key;
+    job->path = path;
+    job->file = file;
+    job->size = size.isEmpty() ? QSize() : size;
+    job->format = format.toLatin1();
+    job->quality = quality;
+    job->source = source;
+    m_pool.start(job);
+}
+
+//============================================================================
+void ThumbnailServer::finish(const QString& key, const QString& file,
+                             const QString& error)
+{
+    const auto waiters = m_pending.take(key);
+    if (!error.isEmpty())
+    {
+        m_failures += waiters.size();
+    }
+    else
+    {
+        m_cacheSize += QFileInfo(file).size();
+        evict();
+    }
+    for (const auto& waiter : waiters)
+    {
+        reply(waiter, error.isEmpty() ?
+                      QJsonObject{{"status", "ok"}, {"file", file}, {"cached", false}} :
+                      QJsonObject{{"status", "error"}, {"error", error}});
+    }
+}
+
+//============================================================================
+void ThumbnailServer::reply(const Waiter& waiter, QJsonObject answer)
+{
+    const auto latency = m_clock.nsecsElapsed() - waiter.start;
+    if (m_latencies.size() < LatencyWindow)
+    {
+        m_latencies.push_back(latency);
+    }
+    else
+    {
+        m_latencies[m_nextLatency] = latency;
+    }
+    m_nextLatency = (m_nextLatency + 1) % LatencyWindow;
+
+    if (waiter.socket)
+    {
+        answer.insert("ms", latency / 1e6);
+        send(waiter.socket, answer);
+    }
+}
+
+//============================================================================
+void ThumbnailServer::send(QLocalSocket* socket, const QJsonObject& answer)
+{
+    socket->write(QJsonDocument(answer).toJson(QJsonDocument::Compact) + '\n');
+}
+
+//============================================================================
+QFileInfoList ThumbnailServer::cachedFiles() const
+{
+    auto files = QDir(m_cacheDirectory).entryInfoList(QDir::Files,
+                                                      QDir::Time | QDir::Reversed);
+    // the temporary files of QSaveFile have a second suffix
+    files.erase(remove_if(files.begin(), files.end(), [](const QFileInfo& info) {
+        return info.fileName().count(QLatin1Char('.')) != 1;
+    }), files.end());
+    return files;
+}
+
+//============================================================================
+void ThumbnailServer::evict()
+{
+    if (m_cacheSize <= m_maxCacheSize)
+    {
+        return;
+    }
+
+    // the running total avoids scanning the directory for every thumbnail,
+    // the scan corrects it
+    const auto files = cachedFiles();
+    m_cacheSize = 0;
+    for (const auto& info : files)
+    {
+        m_cacheSize += info.size();
+    }
+    for (const auto& info : files)
+    {
+        if (m_cacheSize <= m_maxCacheSize)
+        {
+            break;
+        }
+        if (QFile::remove(info.filePath()))
+        {
+            m_cacheSize -= info.size();
+        }
+    }
+}
+
+//============================================================================
+QJsonObject ThumbnailServer::statistics() const
+{
+    auto latencies = m_latencies;
+    sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](double p)
+    {
+        if (latencies.empty())
+        {
+            return 0.0;
+        }
+        const auto index = size_t(p * (latencies.size() - 1) + 0.5);
+        return latencies[index] / 1e6;
+    };
+    //------------------------------------------------------------------------
+
+    return {
+        {"status", "ok"},
+        {"requests", m_requests},
+        {"cacheHits", m_cacheHits},
+        {"coalesced", m_coalesced},
+        {"failures", m_failures},
+        {"pending", m_pending.size()},
+        {"p50ms", percentile(0.5)},
+        {"p90ms", percentile(0.9)},
+        {"p99ms", percentile(0.99)},
+        {"maxms", percentile(1.0)}
+    };
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef THUMBNAIL_SERVER_H
+#define THUMBNAIL_SERVER_H
+
+#include <QElapsedTimer>
+#include <QFileInfoList>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QThreadPool>
+
+#include <vector>
+
+class QJsonObject;
+class QLocalServer;
+class QLocalSocket;
+
+/**
+ * @brief The ThumbnailServer class answers thumbnail requests on a local
+ * socket (a UNIX domain socket on Unix).
+ *
+ * Every request is one line of JSON, e.g.
+ * {"path": "/photos/a.arw", "width": 256, "height": 256}, optionally with
+ * "format", "quality" and "source" (see RawIOHandler::Source). The answer is
+ * one line of JSON as well, which names the file that holds the thumbnail:
+ * {"status": "ok", "file": "...", "cached": false, "ms": 12.5}. The request
+ * {"command": "stats"} returns the request counters and latency
+ * percentiles.
+ *
+ * The server stays warm between requests: the decoder threads and their
+ * frame buffers are kept alive, finished thumbnails are cached on disk, and
+ * identical requests that arrive while a thumbnail is being decoded share a
+ * single decode. When the cached thumbnails grow beyond the maximum cache
+ * size, the ones that have not been requested for the longest time are
+ * removed.
+ */
+class ThumbnailServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr qint64 DefaultMaxCacheSize = qint64(1024) * 1024 * 1024;
+
+    /**
+     * @brief Construct a new ThumbnailServer that stores the thumbnails in
+     * @a cacheDirectory and decodes up to @a threads images at a time.
+     */
+    ThumbnailServer(const QString& cacheDirectory, int threads,
+                    QObject* parent = nullptr);
+
+    /**
+     * @brief Destruct the ThumbnailServer after the running decodes have
+     * finished.
+     */
+    ~ThumbnailServer() override;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(ThumbnailServer);
+    ThumbnailServer(const ThumbnailServer&& rhs) = delete;
+    ThumbnailServer& operator=(const ThumbnailServer&& rhs) = delete;
+
+    /**
+     * @brief Starts listening on the local socket @a name.
+     * @returns false if the socket could not be created
+     */
+    bool listen(const QString& name);
+
+    /**
+     * @brief Returns a description of the last error.
+     */
+    QString errorString() const;
+
+    /**
+     * @brief Sets the number of bytes the cached thumbnails may take to
+     * @a maxSize.
+     */
+    void setMaxCacheSize(qint64 maxSize);
+
+    /**
+     * @brief Called by the decoder threads when the thumbnail @a key has been
+     * written to @a file, with an empty @a error on success.
+     */
+    Q_INVOKABLE void finish(const QString& key, const QString& file,
+                            const QString& error);
+
+private:
+    /**
+     * @brief A client that waits for a thumbnail.
+     */
+    struct Waiter
+    {
+        QPointer<QLocalSocket> socket;
+        qint64 start;
+    };
+
+    void acceptConnection();
+    void readRequests(QLocalSocket* socket);
+    void handleRequest(QLocalSocket* socket, const QJsonObject& request);
+
+    /**
+     * @brief Sends @a answer to the client @a waiter and records the latency
+     * of its request.
+     */
+    void reply(const Waiter& waiter, QJsonObject answer);
+
+    /**
+     * @brief Sends @a answer as one line of JSON to @a socket.
+     */
+    static void send(QLocalSocket* socket, const QJsonObject& answer);
+
+    /**
+     * @brief Returns the request counters and latency percentiles.
+     */
+    QJsonObject statistics() const;
+
+    /**
+     * @brief Returns the cached thumbnails, the least recently used first.
+     */
+    QFileInfoList cachedFiles() const;
+
+    /**
+     * @brief Removes the least recently used thumbnails until the cache fits
+     * into its maximum size.
+     */
+    void evict();
+
+    QLocalServer* m_server;
+    QString m_cacheDirectory;
+    QThreadPool m_pool;
+    QElapsedTimer m_clock;
+    QHash<QString, QList<Waiter>> m_pending;
+    qint64 m_maxCacheSize{DefaultMaxCacheSize};
+    qint64 m_cacheSize{};
+    std::vector<qint64> m_latencies;
+    size_t m_nextLatency{};
+    qint64 m_requests{};
+    qint64 m_cacheHits{};
+    qint64 m_coalesced{};
+    qint64 m_failures{};
+};
+
+#endif // THUMBNAIL_SERVER_H
@@ -7,9 +7,15 @@ win32: {
         LibRaw/buildfiles/libraw.pro \
 }
 SUBDIRS += \
+    qtraw-core \
     src \
     tests \
-    example
+    example \
+    qtraw-convert \
+    qtraw-thumbd \
+    qtraw-index \
+    qtraw-share \
+    qtraw-quality
 
 CONFIG += ordered
 
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "buffer-pool.h"
+
+#include "libraw.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+/**
+ * @brief The size of a transparent huge page and the granularity of the size
+ * classes.
+ */
+static constexpr qint64 HugePageSize = 2 * 1024 * 1024;
+
+/**
+ * @brief Returns a pooled buffer to its pool once the QImage that uses it is
+ * gone.
+ */
+struct PooledImage
+{
+    BufferPool* pool;
+    void* data;
+
+    static void cleanup(void* info)
+    {
+        auto* image = static_cast<PooledImage*>(info);
+        image->pool->release(image->data);
+        delete image;
+    }
+};
+
+//============================================================================
+BufferPool& BufferPool::global()
+{
+    // never destroyed, so images that outlive static destruction can still
+    // release their buffers
+    static auto* pool = new BufferPool;
+    return *pool;
+}
+
+//============================================================================
+BufferPool::BufferPool()
+{
+    m_clock.start();
+}
+
+//============================================================================
+BufferPool::~BufferPool()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_trimCondition.notify_one();
+    if (m_trimThread.joinable())
+    {
+        m_trimThread.join();
+    }
+    trim(0);
+}
+
+//============================================================================
+qint64 BufferPool::sizeClass(qint64 size)
+{
+    // eight classes per power of two waste at most 12.5 %, and whole huge
+    // pages keep the buffers aligned
+    auto power = qint64{1};
+    while (power < size)
+    {
+        power <<= 1;
+    }
+    const auto granule = max(HugePageSize, power / 8);
+    return (size + granule - 1) / granule * granule;
+}
+
+//============================================================================
+void* BufferPool::allocate(qint64 size) const
+{
+#ifdef Q_OS_UNIX
+    if (!m_hugePages)
+    {
+        auto* data = mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return data == MAP_FAILED ? nullptr : data;
+    }
+
+    // huge pages need a 2 MiB aligned range, so a larger range is mapped and
+    // cut down to the aligned part
+    const auto span = size + HugePageSize;
+    auto* base = static_cast<char*>(mmap(nullptr, size_t(span), PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    const auto misalignment = qint64(quintptr(base) % quintptr(HugePageSize));
+    const auto head = misalignment > 0 ? HugePageSize - misalignment : 0;
+    const auto tail = span - head - size;
+    if (head > 0)
+    {
+        munmap(base, size_t(head));
+    }
+    if (tail > 0)
+    {
+        munmap(base + head + size, size_t(tail));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(base + head, size_t(size), MADV_HUGEPAGE);
+#endif
+    return base + head;
+#else
+    return ::malloc(size_t(size));
+#endif
+}
+
+//============================================================================
+void BufferPool::deallocate(void* data, qint64 size)
+{
+#ifdef Q_OS_UNIX
+    munmap(data, size_t(size));
+#else
+    Q_UNUSED(size)
+    ::free(data);
+#endif
+}
+
+//============================================================================
+void* BufferPool::acquire(qint64 size)
+{
+    if (size < MinimumSize)
+    {
+        auto* data = ::malloc(size_t(qMax(size, qint64(1))));
+        if (data)
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_inUse.emplace(data, 0);
+        }
+        return data;
+    }
+
+    const auto classSize = sizeClass(size);
+    auto* data = static_cast<void*>(nullptr);
+    auto expired = vector<pair<void*, qint64>>{};
+    {
+        lock_guard<mutex> lock(m_mutex);
+        expired = trimLocked(m_retainLimit);
+        auto it = m_free.find(classSize);
+        if (it != m_free.end() && !it->second.empty())
+        {
+            // the most recently released buffer is the most likely to still
+            // be in the caches
+            data = it->second.back().data;
+            it->second.pop_back();
+            m_statistics.bytesRetained -= classSize;
+            ++m_statistics.hits;
+        }
+        else
+        {
+            ++m_statistics.misses;
+        }
+    }
+    for (const auto& block : expired)
+    {
+        deallocate(block.first, block.second);
+    }
+
+    if (!data)
+    {
+        data = allocate(classSize);
+        if (!data)
+        {
+            return nullptr;
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    m_inUse.emplace(data, classSize);
+    m_statistics.bytesInUse += classSize;
+    m_statistics.peakBytesInUse = max(m_statistics.peakBytesInUse,
+                                      m_statistics.bytesInUse);
+    return data;
+}
+
+//============================================================================
+void BufferPool::release(void* data)
+{
+    if (!data)
+    {
+        return;
+    }
+
+    auto expired = vector<pair<void*, qint64>>{};
+    {
+        lock_guard<mutex> lock(m_mutex);
+        const auto it = m_inUse.find(data);
+        Q_ASSERT(it != m_inUse.end());
+        if (it == m_inUse.end())
+        {
+            return;
+        }
+        const auto classSize = it->second;
+        m_inUse.erase(it);
+        if (classSize == 0)
+        {
+            ::free(data);
+            return;
+        }
+
+        m_statistics.bytesInUse -= classSize;
+        m_statistics.bytesRetained += classSize;
+        m_free[classSize].push_back({data, m_clock.elapsed()});
+        expired = trimLocked(m_retainLimit);
+        if (!m_trimThread.joinable())
+        {
+            // started with the first retained buffer, so pools that never
+            // retain one don't have a thread
+            m_trimThread = thread(&BufferPool::trimIdleBuffers, this);
+        }
+    }
+    for (const auto& block : expired)
+    {
+        deallocate(block.first, block.second);
+    }
+}
+
+//============================================================================
+QImage BufferPool::image(const QSize& size, QImage::Format format)
+{
+    const auto bitsPerPixel = int(QImage::toPixelFormat(format).bitsPerPixel());
+    const auto bytesPerLine = (qint64(size.width()) * bitsPerPixel + 31) / 32 * 4;
+    const auto bytes = bytesPerLine * size.height();
+    if (size.isEmpty() || bytesPerLine > INT_MAX)
+    {
+        return QImage();
+    }
+
+    auto* data = acquire(bytes);
+    if (!data)
+    {
+        return QImage();
+    }
+    auto* info = new PooledImage{this, data};
+    auto image = QImage(static_cast<uchar*>(data), size.width(), size.height(),
+                        int(bytesPerLine), format, &PooledImage::cleanup, info);
+    if (image.isNull())
+    {
+        // the cleanup function is only called for valid images
+        PooledImage::cleanup(info);
+    }
+    return image;
+}
+
+//============================================================================
+void BufferPool::setRetainLimit(qint64 bytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_retainLimit = bytes;
+}
+
+//============================================================================
+void BufferPool::setMaxIdleTime(qint64 ms)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_maxIdleTime = ms;
+    }
+    m_trimCondition.notify_one();
+}
+
+//============================================================================
+void BufferPool::setHugePages(bool enabled)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_hugePages = enabled;
+}
+
+//============================================================================
+void BufferPool::trim(qint64 keepBytes)
+{
+    auto expired = vector<pair<void*, qint64>>{};
+    {
+        lock_guard<mutex> lock(m_mutex);
+        expired = trimLocked(keepBytes);
+    }
+    for (const auto& block : expired)
+    {
+        deallocate(block.first, block.second);
+    }
+}
+
+//============================================================================
+vector<pair<void*, qint64>> BufferPool::trimLocked(qint64 keepBytes)
+{
+    auto expired = vector<pair<void*, qint64>>{};
+    const auto idleSince = m_clock.elapsed() - m_maxIdleTime;
+    for (auto& entry : m_free)
+    {
+        auto& blocks = entry.second;
+        const auto stale = remove_if(blocks.begin(), blocks.end(),
+                                     [idleSince](const Block& block)
+                                     {
+                                         return block.releasedAt < idleSince;
+                                     });
+        for (auto it = stale; it != blocks.end(); ++it)
+        {
+            expired.emplace_back(it->data, entry.first);
+        }
+        blocks.erase(stale, blocks.end());
+    }
+    for (const auto& block : expired)
+    {
+        m_statistics.bytesRetained -= block.second;
+    }
+
+    while (m_statistics.bytesRetained > keepBytes)
+    {
+        // the oldest buffer is the least likely to be needed again soon
+        auto oldest = m_free.end();
+        for (auto it = m_free.begin(); it != m_free.end(); ++it)
+        {
+            if (!it->second.empty() &&
+                (oldest == m_free.end() ||
+                 it->second.front().releasedAt < oldest->second.front().releasedAt))
+            {
+                oldest = it;
+            }
+        }
+        if (oldest == m_free.end())
+        {
+            break;
+        }
+        expired.emplace_back(oldest->second.front().data, oldest->first);
+        oldest->second.erase(oldest->second.begin());
+        m_statistics.bytesRetained -= oldest->first;
+    }
+
+    for (const auto& block : expired)
+    {
+        m_statistics.bytesTrimmed += block.second;
+    }
+    return expired;
+}
+
+//============================================================================
+void BufferPool::trimIdleBuffers()
+{
+    unique_lock<mutex> lock(m_mutex);
+    while (!m_stopping)
+    {
+        // the buffers of a class are released in order, so the first one of
+        // each class is its oldest
+        auto oldest = qint64(-1);
+        for (const auto& entry : m_free)
+        {
+            if (!entry.second.empty() &&
+                (oldest < 0 || entry.second.front().releasedAt < oldest))
+            {
+                oldest = entry.second.front().releasedAt;
+            }
+        }
+        if (oldest < 0)
+        {
+            m_trimCondition.wait(lock);
+            continue;
+        }
+        // trimLocked() gives back buffers that are idle for longer than the
+        // maximum idle time, hence the extra ms
+        const auto wait = oldest + m_maxIdleTime + 1 - m_clock.elapsed();
+        if (wait > 0)
+        {
+            m_trimCondition.wait_for(lock, chrono::milliseconds(wait));
+            continue;
+        }
+
+        const auto expired = trimLocked(m_retainLimit);
+        lock.unlock();
+        for (const auto& block : expired)
+        {
+            deallocate(block.first, block.second);
+        }
+        lock.lock();
+    }
+}
+
+//============================================================================
+BufferPoolStatistics BufferPool::statistics() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_statistics;
+}
+
+//============================================================================
+qint64 BufferPool::bufferSize(const void* data) const
+{
+    lock_guard<mutex> lock(m_mutex);
+    const auto it = m_inUse.find(const_cast<void*>(data));
+    return it != m_inUse.end() ? it->second : 0;
+}
+
+#ifdef LIBRAW_ALLOC_HOOKS
+//============================================================================
+/**
+ * @brief The allocation hooks of LibRaw. The small blocks are left to the C
+ * library.
+ */
+static void* libRawMalloc(size_t size)
+{
+    return qint64(size) >= BufferPool::MinimumSize ?
+           BufferPool::global().acquire(qint64(size)) : nullptr;
+}
+
+static bool libRawFree(void* data)
+{
+    auto& pool = BufferPool::global();
+    if (pool.bufferSize(data) == 0)
+    {
+        return false;
+    }
+    pool.release(data);
+    return true;
+}
+
+static size_t libRawSize(void* data)
+{
+    return size_t(BufferPool::global().bufferSize(data));
+}
+#endif
+
+//============================================================================
+bool BufferPool::serveLibRaw()
+{
+#ifdef LIBRAW_ALLOC_HOOKS
+    // blocks LibRaw allocated before are recognized by the hooks as not
+    // pooled, so they can be installed at any time
+    libraw_alloc_hooks = {libRawMalloc, libRawFree, libRawSize};
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "qtraw-export.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QtGlobal>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The statistics of a BufferPool.
+ */
+struct BufferPoolStatistics
+{
+    /**
+     * The number of acquired buffers that were taken from the pool.
+     */
+    qint64 hits{};
+
+    /**
+     * The number of acquired buffers that had to be allocated.
+     */
+    qint64 misses{};
+
+    /**
+     * The bytes of the buffers that are currently acquired.
+     */
+    qint64 bytesInUse{};
+
+    /**
+     * The largest value bytesInUse has ever had.
+     */
+    qint64 peakBytesInUse{};
+
+    /**
+     * The bytes of the released buffers that the pool keeps for reuse.
+     */
+    qint64 bytesRetained{};
+
+    /**
+     * The bytes that have been given back to the system by the trim policy.
+     */
+    qint64 bytesTrimmed{};
+};
+
+/**
+ * @brief The BufferPool class keeps large buffers, e.g. frame buffers of
+ * 50 to 200 MB, around for reuse.
+ *
+ * The system allocator maps such buffers freshly for every decode and unmaps
+ * them afterwards, so every page of every frame is faulted in and zeroed
+ * again. The pool rounds the requested sizes up to a few size classes and
+ * hands out released buffers of the same class again, with their pages
+ * already in place. Optionally the buffers are backed by transparent huge
+ * pages.
+ *
+ * Released buffers are given back to the system when they would push the
+ * retained bytes over the retain limit, oldest first, or when they have not
+ * been reused for the maximum idle time. A thread of the pool that sleeps
+ * until the oldest buffer expires enforces the idle time, so a process that
+ * stops decoding gives the memory back as well.
+ */
+class QTRAW_EXPORT BufferPool
+{
+public:
+    /**
+     * @brief Smaller buffers are not pooled, they come from malloc().
+     */
+    static constexpr qint64 MinimumSize = 1024 * 1024;
+
+    /**
+     * @brief The default number of released bytes that are kept for reuse.
+     */
+    static constexpr qint64 DefaultRetainLimit = 512 * 1024 * 1024;
+
+    /**
+     * @brief The default time in ms after which an unused buffer is given
+     * back to the system.
+     */
+    static constexpr qint64 DefaultMaxIdleTime = 30 * 1000;
+
+    /**
+     * @brief Returns the pool that QtRaw takes its frame buffers from.
+     */
+    static BufferPool& global();
+
+    /**
+     * @brief Construct a new, empty BufferPool.
+     */
+    BufferPool();
+
+    /**
+     * @brief Destruct the BufferPool, stop its trim thread and free the
+     * retained buffers. Buffers that are still acquired must not be released
+     * afterwards.
+     */
+    ~BufferPool();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(BufferPool);
+    BufferPool(const BufferPool&& rhs) = delete;
+    BufferPool& operator=(const BufferPool&& rhs) = delete;
+
+    /**
+     * @brief Returns a buffer of at least @a size bytes, or nullptr if it
+     * could not be allocated. The contents of the buffer are undefined.
+     */
+    void* acquire(qint64 size);
+
+    /**
+     * @brief Gives the buffer @a data back to the pool.
+     */
+    void release(void* data);
+
+    /**
+     * @brief Returns an uninitialized QImage of the given @a size and
+     * @a format whose pixels live in a pooled buffer. The buffer is released
+     * when the last copy of the image is gone.
+     */
+    QImage image(const QSize& size, QImage::Format format);
+
+    /**
+     * @brief Sets the number of released bytes that are kept for reuse.
+     */
+    void setRetainLimit(qint64 bytes);
+
+    /**
+     * @brief Sets the time in ms after which a buffer that has not been reused
+     * is given back to the system.
+     */
+    void setMaxIdleTime(qint64 ms);
+
+    /**
+     * @brief Backs the buffers that are allocated from now on by transparent
+     * huge pages if @a enabled. This is only supported on Linux.
+     */
+    void setHugePages(bool enabled);
+
+    /**
+     * @brief Gives released buffers back to the system until at most
+     * @a keepBytes are retained.
+     */
+    void trim(qint64 keepBytes = 0);
+
+    /**
+     * @brief Returns the statistics of the pool.
+     */
+    BufferPoolStatistics statistics() const;
+
+    /**
+     * @brief Returns the size of the buffer @a data, or 0 if it is not a
+     * buffer of at least MinimumSize from this pool.
+     */
+    qint64 bufferSize(const void* data) const;
+
+    /**
+     * @brief Serves the large raw and image buffers of LibRaw from the global
+     * pool, so they are reused between decodes like the frame buffers and
+     * count against the same retain limit.
+     *
+     * This needs the allocation hooks the patches of this repository add to
+     * LibRaw. Processes that decode many images, like the command line tools,
+     * call it before they decode.
+     * @returns true if LibRaw has the hooks
+     */
+    static bool serveLibRaw();
+
+private:
+    /**
+     * @brief A buffer that has been released to the pool.
+     */
+    struct Block
+    {
+        void* data;
+        qint64 releasedAt;
+    };
+
+    /**
+     * @brief Returns the size class that a buffer of @a size bytes is taken
+     * from.
+     */
+    static qint64 sizeClass(qint64 size);
+
+    /**
+     * @brief Allocates a new buffer of @a size bytes from the system.
+     */
+    void* allocate(qint64 size) const;
+
+    /**
+     * @brief Gives the buffer @a data of @a size bytes back to the system.
+     */
+    static void deallocate(void* data, qint64 size);
+
+    /**
+     * @brief Takes the released buffers that have been idle for too long and,
+     * oldest first, the ones beyond @a keepBytes out of the pool. m_mutex
+     * must be held.
+     * @returns the buffers and their sizes, which the caller deallocates
+     * after unlocking m_mutex
+     */
+    std::vector<std::pair<void*, qint64>> trimLocked(qint64 keepBytes);
+
+    /**
+     * @brief The trim thread: gives the buffers back to the system that have
+     * not been reused for the maximum idle time, until the pool is destroyed.
+     */
+    void trimIdleBuffers();
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_trimCondition;
+    std::thread m_trimThread;
+    bool m_stopping{};
+    std::map<qint64, std::vector<Block>> m_free;
+    std::unordered_map<void*, qint64> m_inUse;
+    BufferPoolStatistics m_statistics;
+    QElapsedTimer m_clock;
+    qint64 m_retainLimit{DefaultRetainLimit};
+    qint64 m_maxIdleTime{DefaultMaxIdleTime};
+    bool m_hugePages{};
+};
+
+#endif // BUFFER_POOL_H
@@ -19,6 +19,7 @@
  */
 
 #include "datastream.h"
+#include "decode-metrics.h"
 
 #include <QIODevice>
 #include <QTextStream>
@@ -40,7 +41,9 @@ int Datastream::valid()
 //============================================================================
 int Datastream::read(void* ptr, size_t size, size_t nmemb)
 {
-    return int(m_device->read(static_cast<char*>(ptr), size * nmemb));
+    const auto bytes = m_device->read(static_cast<char*>(ptr), size * nmemb);
+    DecodeMetrics::global().recordBytesRead(bytes);
+    return int(bytes);
 }
 
 //============================================================================
@@ -59,7 +62,7 @@ int Datastream::seek(INT64 offset, int whence)
         break;
 
     case SEEK_END:
-        pos = m_device->size();
+        pos = m_device->size() + offset;
         break;
 
     default:
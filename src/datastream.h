@@ -24,6 +24,7 @@
 #include <QImageIOHandler>
 
 #include "libraw_datastream.h"
+#include "qtraw-export.h"
 
 class QIODevice;
 
@@ -31,7 +32,7 @@ class QIODevice;
  * @brief The Datastream class provides an interface that makes it possible to
  * use a QIODevice as source for a LibRaw_datastream.
  */
-class Datastream : public LibRaw_abstract_datastream
+class QTRAW_EXPORT Datastream : public LibRaw_abstract_datastream
 {
 public:
     /**
@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "decode-metrics.h"
+#include "buffer-pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include <QLockFile>
+#include <QSaveFile>
+
+#include "libraw.h"
+
+using namespace std;
+
+//============================================================================
+/**
+ * @brief Returns the bucket bounds of a LatencyHistogram in nanoseconds.
+ */
+static const array<qint64, LatencyHistogram::BucketCount - 1>& boundsInNanoseconds()
+{
+    static const auto bounds = []
+    {
+        auto result = array<qint64, LatencyHistogram::BucketCount - 1>{};
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result[i] = qint64(LatencyHistogram::bounds()[i] * 1e9 + 0.5);
+        }
+        return result;
+    }();
+    return bounds;
+}
+
+//============================================================================
+const array<double, LatencyHistogram::BucketCount - 1>& LatencyHistogram::bounds()
+{
+    static const auto bounds = array<double, BucketCount - 1>{{
+        0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+    }};
+    return bounds;
+}
+
+//============================================================================
+void LatencyHistogram::observe(qint64 nanoseconds)
+{
+    const auto& bounds = boundsInNanoseconds();
+    auto bucket = size_t{};
+    while (bucket < bounds.size() && nanoseconds > bounds[bucket])
+    {
+        ++bucket;
+    }
+    m_buckets[bucket].fetch_add(1, memory_order_relaxed);
+    m_count.fetch_add(1, memory_order_relaxed);
+    m_sum.fetch_add(quint64(qMax(qint64(0), nanoseconds)), memory_order_relaxed);
+}
+
+//============================================================================
+qint64 LatencyHistogram::count() const
+{
+    return qint64(m_count.load(memory_order_relaxed));
+}
+
+//============================================================================
+double LatencyHistogram::sum() const
+{
+    return double(m_sum.load(memory_order_relaxed)) / 1e9;
+}
+
+//============================================================================
+array<qint64, LatencyHistogram::BucketCount> LatencyHistogram::buckets() const
+{
+    auto result = array<qint64, BucketCount>{};
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        result[i] = qint64(m_buckets[i].load(memory_order_relaxed));
+    }
+    return result;
+}
+
+//============================================================================
+double LatencyHistogram::quantile(double q) const
+{
+    const auto counts = buckets();
+    auto total = qint64{};
+    for (const auto count : counts)
+    {
+        total += count;
+    }
+    if (total == 0)
+    {
+        return 0.0;
+    }
+
+    const auto rank = qMax(qint64(1), qint64(q * double(total) + 0.5));
+    auto cumulative = qint64{};
+    for (size_t i = 0; i < bounds().size(); ++i)
+    {
+        cumulative += counts[i];
+        if (cumulative >= rank)
+        {
+            return bounds()[i];
+        }
+    }
+    return numeric_limits<double>::infinity();
+}
+
+//============================================================================
+void LatencyHistogram::reset()
+{
+    for (auto& bucket : m_buckets)
+    {
+        bucket.store(0, memory_order_relaxed);
+    }
+    m_count.store(0, memory_order_relaxed);
+    m_sum.store(0, memory_order_relaxed);
+}
+
+//============================================================================
+/**
+ * @brief Writes @a metrics to @a fileName. The file is replaced atomically,
+ * so a collector never sees half of it.
+ * @returns true on success
+ */
+static bool writeDump(const DecodeMetrics& metrics, const QString& fileName)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    file.write(metrics.toPrometheus());
+    return file.commit();
+}
+
+/**
+ * @brief Writes the metrics to a file on a thread of its own.
+ */
+class MetricsDumper
+{
+public:
+    MetricsDumper(const DecodeMetrics* metrics, const QString& fileName, int interval,
+                  unique_ptr<QLockFile> ownership) :
+        m_metrics(metrics),
+        m_fileName(fileName),
+        m_interval(interval),
+        m_ownership(move(ownership)),
+        m_thread([this] { run(); })
+    {
+    }
+
+    /**
+     * @brief Stops the thread after it has written the file a last time.
+     */
+    ~MetricsDumper()
+    {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_wakeUp.notify_all();
+        m_thread.join();
+    }
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(MetricsDumper);
+    MetricsDumper(const MetricsDumper&& rhs) = delete;
+    MetricsDumper& operator=(const MetricsDumper&& rhs) = delete;
+
+private:
+    void run()
+    {
+        unique_lock<mutex> lock(m_mutex);
+        while (!m_stopped)
+        {
+            m_wakeUp.wait_for(lock, chrono::milliseconds(m_interval), [this] { return m_stopped; });
+            writeDump(*m_metrics, m_fileName);
+        }
+    }
+
+    const DecodeMetrics* m_metrics;
+    QString m_fileName;
+    int m_interval;
+    unique_ptr<QLockFile> m_ownership;
+    mutex m_mutex;
+    condition_variable m_wakeUp;
+    bool m_stopped{};
+    thread m_thread;
+};
+
+//============================================================================
+/**
+ * @brief Returns the running dump, which is stopped when the process exits.
+ */
+static unique_ptr<MetricsDumper>& dumper(unique_lock<mutex>* lock)
+{
+    static mutex dumperMutex;
+    static auto instance = unique_ptr<MetricsDumper>();
+    *lock = unique_lock<mutex>(dumperMutex);
+    return instance;
+}
+
+//============================================================================
+/**
+ * @brief Starts to dump @a metrics to @a fileName every @a interval
+ * milliseconds.
+ */
+static bool startDumpOf(const DecodeMetrics* metrics, const QString& fileName, int interval)
+{
+    auto lock = unique_lock<mutex>();
+    auto& running = dumper(&lock);
+    running.reset();
+
+    // One dump owns the file. The lock is only stale once its process is
+    // gone, however long a dump runs.
+    auto ownership = make_unique<QLockFile>(fileName + QStringLiteral(".lock"));
+    ownership->setStaleLockTime(0);
+    if (!ownership->tryLock(0))
+    {
+        qWarning("The metrics in %s are written by another process", qPrintable(fileName));
+        return false;
+    }
+    if (!writeDump(*metrics, fileName))
+    {
+        return false;
+    }
+    running.reset(new MetricsDumper(metrics, fileName, qMax(100, interval),
+                                    move(ownership)));
+    return true;
+}
+
+//============================================================================
+DecodeMetrics& DecodeMetrics::global()
+{
+    // never destroyed, so handlers that are still decoding during static
+    // destruction can record their metrics
+    static auto* metrics = []
+    {
+        auto* result = new DecodeMetrics;
+        const auto fileName = QString::fromLocal8Bit(qgetenv("QTRAW_METRICS_FILE"));
+        if (!fileName.isEmpty())
+        {
+            auto ok = false;
+            const auto seconds = qEnvironmentVariableIntValue("QTRAW_METRICS_INTERVAL", &ok);
+            if (!startDumpOf(result, fileName, ok ? seconds * 1000 : DefaultDumpInterval))
+            {
+                qWarning("Cannot write the metrics to %s", qPrintable(fileName));
+            }
+        }
+        return result;
+    }();
+    return *metrics;
+}
+
+//============================================================================
+const char* DecodeMetrics::pathName(Path path)
+{
+    static const char* const names[] = {"thumbnail", "full", "scaled", "mosaic"};
+    return path >= 0 && path < PathCount ? names[path] : "unknown";
+}
+
+//============================================================================
+const char* DecodeMetrics::stageName(Stage stage)
+{
+    static const char* const names[] = {"open", "unpack", "process", "output", "preview"};
+    return stage >= 0 && stage < StageCount ? names[stage] : "unknown";
+}
+
+//============================================================================
+bool DecodeMetrics::startDump(const QString& fileName, int interval)
+{
+    return startDumpOf(&global(), fileName, interval);
+}
+
+//============================================================================
+void DecodeMetrics::stopDump()
+{
+    auto lock = unique_lock<mutex>();
+    dumper(&lock).reset();
+}
+
+//============================================================================
+void DecodeMetrics::recordDecode(Path path, Result result, qint64 nanoseconds,
+                                 qint64 peakMemory)
+{
+    m_decodes[size_t(path)][size_t(result)].fetch_add(1, memory_order_relaxed);
+    if (result == Succeeded)
+    {
+        m_decodeLatency[size_t(path)].observe(nanoseconds);
+    }
+    auto peak = m_peakMemory.load(memory_order_relaxed);
+    while (peakMemory > peak &&
+           !m_peakMemory.compare_exchange_weak(peak, peakMemory, memory_order_relaxed))
+    {
+    }
+}
+
+//============================================================================
+void DecodeMetrics::recordStage(Stage stage, qint64 nanoseconds)
+{
+    m_stageLatency[size_t(stage)].observe(nanoseconds);
+}
+
+//============================================================================
+void DecodeMetrics::recordBytesRead(qint64 bytes)
+{
+    if (bytes > 0)
+    {
+        m_bytesRead.fetch_add(quint64(bytes), memory_order_relaxed);
+    }
+}
+
+//============================================================================
+void DecodeMetrics::recordLibRawError(int errorCode)
+{
+    lock_guard<mutex> lock(m_errorMutex);
+    ++m_libRawErrors[errorCode];
+}
+
+//============================================================================
+qint64 DecodeMetrics::decodeCount(Path path, Result result) const
+{
+    return qint64(m_decodes[size_t(path)][size_t(result)].load(memory_order_relaxed));
+}
+
+//============================================================================
+const LatencyHistogram& DecodeMetrics::decodeLatency(Path path) const
+{
+    return m_decodeLatency[size_t(path)];
+}
+
+//============================================================================
+const LatencyHistogram& DecodeMetrics::stageLatency(Stage stage) const
+{
+    return m_stageLatency[size_t(stage)];
+}
+
+//============================================================================
+qint64 DecodeMetrics::bytesRead() const
+{
+    return qint64(m_bytesRead.load(memory_order_relaxed));
+}
+
+//============================================================================
+qint64 DecodeMetrics::peakMemory() const
+{
+    return m_peakMemory.load(memory_order_relaxed);
+}
+
+//============================================================================
+QMap<int, qint64> DecodeMetrics::libRawErrors() const
+{
+    lock_guard<mutex> lock(m_errorMutex);
+    return m_libRawErrors;
+}
+
+//============================================================================
+/**
+ * @brief Appends the HELP and TYPE lines of the metric @a name to @a out.
+ */
+static void appendHeader(QByteArray* out, const char* name, const char* type,
+                         const char* help)
+{
+    *out += QByteArray("# HELP ") + name + ' ' + help + "\n# TYPE " + name + ' ' + type + '\n';
+}
+
+//============================================================================
+/**
+ * @brief Appends the sample @a value of the metric @a name with the given
+ * @a labels to @a out.
+ */
+static void appendSample(QByteArray* out, const QByteArray& name, const QByteArray& labels,
+                         const QByteArray& value)
+{
+    *out += name;
+    if (!labels.isEmpty())
+    {
+        *out += '{' + labels + '}';
+    }
+    *out += ' ' + value + '\n';
+}
+
+//============================================================================
+/**
+ * @brief Appends the buckets, the sum and the count of @a histogram to
+ * @a out.
+ */
+static void appendHistogram(QByteArray* out, const QByteArray& name, const QByteArray& labels,
+                            const LatencyHistogram& histogram)
+{
+    const auto counts = histogram.buckets();
+    auto cumulative = qint64{};
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        cumulative += counts[i];
+        const auto bound = i < LatencyHistogram::bounds().size() ?
+                           QByteArray::number(LatencyHistogram::bounds()[i], 'g', 6) :
+                           QByteArray("+Inf");
+        appendSample(out, name + "_bucket", labels + ",le=\"" + bound + '"',
+                     QByteArray::number(cumulative));
+    }
+    appendSample(out, name + "_sum", labels, QByteArray::number(histogram.sum(), 'g', 10));
+    appendSample(out, name + "_count", labels, QByteArray::number(cumulative));
+}
+
+//============================================================================
+/**
+ * @brief Returns @a value as a label value, with quotes.
+ */
+static QByteArray labelValue(const QByteArray& value)
+{
+    auto escaped = value;
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return '"' + escaped + '"';
+}
+
+//============================================================================
+QByteArray DecodeMetrics::toPrometheus() const
+{
+    static const char* const results[] = {"succeeded", "failed", "canceled"};
+
+    auto out = QByteArray();
+    appendHeader(&out, "qtraw_decodes_total", "counter", "Decodes by path and result.");
+    for (int path = 0; path < PathCount; ++path)
+    {
+        for (int result = 0; result < ResultCount; ++result)
+        {
+            appendSample(&out, "qtraw_decodes_total",
+                         "path=" + labelValue(pathName(Path(path))) +
+                         ",result=" + labelValue(results[result]),
+                         QByteArray::number(decodeCount(Path(path), Result(result))));
+        }
+    }
+
+    appendHeader(&out, "qtraw_decode_duration_seconds", "histogram",
+                 "Latency of the successful decodes by path.");
+    for (int path = 0; path < PathCount; ++path)
+    {
+        appendHistogram(&out, "qtraw_decode_duration_seconds",
+                        "path=" + labelValue(pathName(Path(path))),
+                        decodeLatency(Path(path)));
+    }
+
+    appendHeader(&out, "qtraw_stage_duration_seconds", "histogram",
+                 "Latency of the decode stages.");
+    for (int stage = 0; stage < StageCount; ++stage)
+    {
+        appendHistogram(&out, "qtraw_stage_duration_seconds",
+                        "stage=" + labelValue(stageName(Stage(stage))),
+                        stageLatency(Stage(stage)));
+    }
+
+    appendHeader(&out, "qtraw_read_bytes_total", "counter",
+                 "Bytes LibRaw has read from devices.");
+    appendSample(&out, "qtraw_read_bytes_total", QByteArray(), QByteArray::number(bytesRead()));
+    appendHeader(&out, "qtraw_decode_peak_memory_bytes", "gauge",
+                 "The largest peak memory of a single decode.");
+    appendSample(&out, "qtraw_decode_peak_memory_bytes", QByteArray(),
+                 QByteArray::number(peakMemory()));
+
+    appendHeader(&out, "qtraw_libraw_errors_total", "counter", "LibRaw failures by error code.");
+    const auto errors = libRawErrors();
+    for (auto it = errors.cbegin(); it != errors.cend(); ++it)
+    {
+        appendSample(&out, "qtraw_libraw_errors_total",
+                     "code=" + labelValue(QByteArray::number(it.key())) +
+                     ",message=" + labelValue(libraw_strerror(it.key())),
+                     QByteArray::number(it.value()));
+    }
+
+    const auto pool = BufferPool::global().statistics();
+    appendHeader(&out, "qtraw_buffer_pool_hits_total", "counter",
+                 "Frame buffers that were taken from the pool.");
+    appendSample(&out, "qtraw_buffer_pool_hits_total", QByteArray(),
+                 QByteArray::number(pool.hits));
+    appendHeader(&out, "qtraw_buffer_pool_misses_total", "counter",
+                 "Frame buffers that had to be allocated.");
+    appendSample(&out, "qtraw_buffer_pool_misses_total", QByteArray(),
+                 QByteArray::number(pool.misses));
+    appendHeader(&out, "qtraw_buffer_pool_in_use_bytes", "gauge",
+                 "Bytes of the frame buffers in use.");
+    appendSample(&out, "qtraw_buffer_pool_in_use_bytes", QByteArray(),
+                 QByteArray::number(pool.bytesInUse));
+    appendHeader(&out, "qtraw_buffer_pool_retained_bytes", "gauge",
+                 "Bytes of the released frame buffers kept for reuse.");
+    appendSample(&out, "qtraw_buffer_pool_retained_bytes", QByteArray(),
+                 QByteArray::number(pool.bytesRetained));
+    return out;
+}
+
+//============================================================================
+void DecodeMetrics::reset()
+{
+    for (auto& path : m_decodes)
+    {
+        for (auto& count : path)
+        {
+            count.store(0, memory_order_relaxed);
+        }
+    }
+    for (auto& histogram : m_decodeLatency)
+    {
+        histogram.reset();
+    }
+    for (auto& histogram : m_stageLatency)
+    {
+        histogram.reset();
+    }
+    m_bytesRead.store(0, memory_order_relaxed);
+    m_peakMemory.store(0, memory_order_relaxed);
+    lock_guard<mutex> lock(m_errorMutex);
+    m_libRawErrors.clear();
+}
+
+//============================================================================
+StageClock::StageClock()
+{
+    m_timer.start();
+}
+
+//============================================================================
+void StageClock::lap(DecodeMetrics::Stage stage)
+{
+    DecodeMetrics::global().recordStage(stage, m_timer.nsecsElapsed());
+    m_timer.restart();
+}
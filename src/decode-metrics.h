@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DECODE_METRICS_H
+#define DECODE_METRICS_H
+
+#include "qtraw-export.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+/**
+ * @brief The LatencyHistogram class counts durations in fixed buckets from
+ * one millisecond to ten seconds, lock-free.
+ */
+class QTRAW_EXPORT LatencyHistogram
+{
+public:
+    /**
+     * @brief The number of buckets, including the one for longer durations.
+     */
+    static constexpr int BucketCount = 14;
+
+    /**
+     * @brief Returns the upper bounds of the buckets in seconds, without the
+     * last bucket, which has no bound.
+     */
+    static const std::array<double, BucketCount - 1>& bounds();
+
+    LatencyHistogram() = default;
+    ~LatencyHistogram() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(LatencyHistogram);
+    LatencyHistogram(const LatencyHistogram&& rhs) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&& rhs) = delete;
+
+    /**
+     * @brief Counts a duration of @a nanoseconds.
+     */
+    void observe(qint64 nanoseconds);
+
+    /**
+     * @brief Returns the number of durations that have been counted.
+     */
+    qint64 count() const;
+
+    /**
+     * @brief Returns the sum of all durations in seconds.
+     */
+    double sum() const;
+
+    /**
+     * @brief Returns the number of durations in every bucket, not
+     * accumulated.
+     */
+    std::array<qint64, BucketCount> buckets() const;
+
+    /**
+     * @brief Returns an estimate of the @a q quantile in seconds, the upper
+     * bound of the bucket that contains it, or 0 if nothing has been counted.
+     */
+    double quantile(double q) const;
+
+    /**
+     * @brief Forgets all durations.
+     */
+    void reset();
+
+private:
+    std::array<std::atomic<quint64>, BucketCount> m_buckets{};
+    std::atomic<quint64> m_count{0};
+    std::atomic<quint64> m_sum{0};
+};
+
+/**
+ * @brief The DecodeMetrics class collects process wide metrics of all
+ * decodes: counts and latencies per decode path, latencies per stage, the
+ * bytes read, the peak memory and the LibRaw errors.
+ *
+ * Every RawIOHandler records into global(). The counters are atomic, so
+ * recording costs a few nanoseconds and takes no lock, except for LibRaw
+ * errors.
+ *
+ * The metrics can be written to a file in the Prometheus text format, e.g.
+ * for the textfile collector of the node exporter. startDump() rewrites the
+ * file periodically. Applications don't need to call it themselves: if the
+ * environment variable QTRAW_METRICS_FILE names a file, the dump starts with
+ * the first decode, every QTRAW_METRICS_INTERVAL seconds (default 15).
+ *
+ * The registry lives in the qtraw-core library, so the image format plugin
+ * and an application that links the library share it. A dump owns its file
+ * through a lock file next to it, and a second process that tries to dump
+ * to the same file is refused.
+ */
+class QTRAW_EXPORT DecodeMetrics
+{
+public:
+    /**
+     * @brief The ways a decode can take.
+     */
+    enum Path
+    {
+        ThumbnailPath,
+        FullPath,
+        ScaledPath,
+        MosaicPath,
+        PathCount
+    };
+
+    /**
+     * @brief How a decode ended.
+     */
+    enum Result
+    {
+        Succeeded,
+        Failed,
+        Canceled,
+        ResultCount
+    };
+
+    /**
+     * @brief The stages of a decode.
+     */
+    enum Stage
+    {
+        /**
+         * Opening the file and parsing its header.
+         */
+        OpenStage,
+
+        /**
+         * Unpacking the raw data.
+         */
+        UnpackStage,
+
+        /**
+         * Demosaicing and color conversion by dcraw_process().
+         */
+        ProcessStage,
+
+        /**
+         * Copying, scaling and orienting the output into the QImage.
+         */
+        OutputStage,
+
+        /**
+         * Decoding the embedded preview.
+         */
+        PreviewStage,
+
+        StageCount
+    };
+
+    /**
+     * @brief The default period of the dump in milliseconds.
+     */
+    static constexpr int DefaultDumpInterval = 15 * 1000;
+
+    /**
+     * @brief Returns the metrics every RawIOHandler records into.
+     */
+    static DecodeMetrics& global();
+
+    /**
+     * @brief Returns the name of @a path in the metrics labels.
+     */
+    static const char* pathName(Path path);
+
+    /**
+     * @brief Returns the name of @a stage in the metrics labels.
+     */
+    static const char* stageName(Stage stage);
+
+    /**
+     * @brief Starts to write global() to @a fileName every @a interval
+     * milliseconds, replacing a dump that is already running.
+     * @returns false if the file can't be written or another process
+     * dumps to it
+     */
+    static bool startDump(const QString& fileName, int interval = DefaultDumpInterval);
+
+    /**
+     * @brief Stops the dump after writing the file a last time.
+     */
+    static void stopDump();
+
+    DecodeMetrics() = default;
+    ~DecodeMetrics() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(DecodeMetrics);
+    DecodeMetrics(const DecodeMetrics&& rhs) = delete;
+    DecodeMetrics& operator=(const DecodeMetrics&& rhs) = delete;
+
+    /**
+     * @brief Records a decode along @a path that ended with @a result after
+     * @a nanoseconds and used at most @a peakMemory bytes.
+     */
+    void recordDecode(Path path, Result result, qint64 nanoseconds, qint64 peakMemory);
+
+    /**
+     * @brief Records that @a stage took @a nanoseconds.
+     */
+    void recordStage(Stage stage, qint64 nanoseconds);
+
+    /**
+     * @brief Records that @a bytes have been read from a device.
+     */
+    void recordBytesRead(qint64 bytes);
+
+    /**
+     * @brief Records that LibRaw has failed with @a errorCode.
+     */
+    void recordLibRawError(int errorCode);
+
+    /**
+     * @brief Returns the number of decodes along @a path that ended with
+     * @a result.
+     */
+    qint64 decodeCount(Path path, Result result) const;
+
+    /**
+     * @brief Returns the latencies of the decodes along @a path.
+     */
+    const LatencyHistogram& decodeLatency(Path path) const;
+
+    /**
+     * @brief Returns the latencies of @a stage.
+     */
+    const LatencyHistogram& stageLatency(Stage stage) const;
+
+    /**
+     * @brief Returns the number of bytes LibRaw has read from devices.
+     */
+    qint64 bytesRead() const;
+
+    /**
+     * @brief Returns the largest peak memory of a single decode.
+     */
+    qint64 peakMemory() const;
+
+    /**
+     * @brief Returns the number of failures by LibRaw error code.
+     */
+    QMap<int, qint64> libRawErrors() const;
+
+    /**
+     * @brief Returns the metrics, together with the statistics of the global
+     * BufferPool, in the Prometheus text format.
+     */
+    QByteArray toPrometheus() const;
+
+    /**
+     * @brief Forgets all metrics.
+     */
+    void reset();
+
+private:
+    std::array<std::array<std::atomic<quint64>, ResultCount>, PathCount> m_decodes{};
+    std::array<LatencyHistogram, PathCount> m_decodeLatency;
+    std::array<LatencyHistogram, StageCount> m_stageLatency;
+    std::atomic<quint64> m_bytesRead{0};
+    std::atomic<qint64> m_peakMemory{0};
+    QMap<int, qint64> m_libRawErrors;
+    mutable std::mutex m_errorMutex;
+};
+
+/**
+ * @brief The StageClock class measures consecutive stages of a decode for
+ * the global DecodeMetrics.
+ */
+class QTRAW_EXPORT StageClock
+{
+public:
+    /**
+     * @brief Construct a new StageClock, which starts the first stage.
+     */
+    StageClock();
+    ~StageClock() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(StageClock);
+    StageClock(const StageClock&& rhs) = delete;
+    StageClock& operator=(const StageClock&& rhs) = delete;
+
+    /**
+     * @brief Records the time since the construction or the last lap as
+     * @a stage and starts the next stage.
+     */
+    void lap(DecodeMetrics::Stage stage);
+
+private:
+    QElapsedTimer m_timer;
+};
+
+#endif // DECODE_METRICS_H
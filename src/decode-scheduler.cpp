@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "decode-scheduler.h"
+#include "raw-decode-control.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFutureInterface>
+#include <QImageReader>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief A decode that has been submitted to a DecodeScheduler.
+ */
+struct DecodeTask
+{
+    QFutureInterface<QImage> future;
+    QString path;
+    QIODevice* device{};
+    DecodeOptions options;
+    int priority{};
+    quint64 sequence{};
+    QSharedPointer<RawDecodeControl> control;
+};
+
+/**
+ * @brief The private data of the DecodeScheduler.
+ */
+class DecodeSchedulerPrivate
+{
+public:
+    /**
+     * @brief Queues the @a task and starts a runner for it.
+     */
+    QFuture<QImage> submit(unique_ptr<DecodeTask> task);
+
+    /**
+     * @brief Runs the most urgent pending decode. Called by the runners.
+     */
+    void runNext();
+
+    /**
+     * @brief Decodes the image of @a task.
+     * @returns the image, or a null image on failure
+     */
+    static QImage decode(DecodeTask* task);
+
+    mutable mutex lock;
+    vector<unique_ptr<DecodeTask>> pending;
+    vector<DecodeTask*> running;
+    quint64 nextSequence{};
+    QThreadPool pool;
+};
+
+/**
+ * @brief Takes whichever decode is the most urgent once a thread of the pool
+ * is free, so priorities can still change while the runner waits.
+ */
+class DecodeRunner : public QRunnable
+{
+public:
+    explicit DecodeRunner(DecodeSchedulerPrivate* scheduler) :
+        m_scheduler(scheduler)
+    {
+    }
+
+    void run() override
+    {
+        m_scheduler->runNext();
+    }
+
+private:
+    DecodeSchedulerPrivate* m_scheduler;
+};
+
+//============================================================================
+/**
+ * @brief Returns the size that @a fullSize is decoded to if it has to fit
+ * into @a bounds, or an invalid size if it fits already.
+ */
+static QSize fitInto(const QSize& fullSize, const QSize& bounds)
+{
+    if (!bounds.isValid() || !fullSize.isValid() ||
+        (fullSize.width() <= bounds.width() && fullSize.height() <= bounds.height()))
+    {
+        return QSize();
+    }
+    return fullSize.scaled(bounds, Qt::KeepAspectRatio);
+}
+
+//============================================================================
+QFuture<QImage> DecodeSchedulerPrivate::submit(unique_ptr<DecodeTask> task)
+{
+    task->control = QSharedPointer<RawDecodeControl>::create();
+    task->future.setProgressRange(0, 1000);
+    task->future.reportStarted();
+    const auto future = task->future.future();
+    {
+        lock_guard<mutex> guard(lock);
+        task->sequence = nextSequence++;
+        pending.push_back(move(task));
+    }
+    pool.start(new DecodeRunner(this));
+    return future;
+}
+
+//============================================================================
+void DecodeSchedulerPrivate::runNext()
+{
+    auto task = unique_ptr<DecodeTask>();
+    {
+        lock_guard<mutex> guard(lock);
+        if (pending.empty())
+        {
+            return;
+        }
+        const auto next = max_element(pending.begin(), pending.end(),
+                                      [](const auto& a, const auto& b)
+        {
+            return a->priority != b->priority ? a->priority < b->priority :
+                                                a->sequence > b->sequence;
+        });
+        task = move(*next);
+        pending.erase(next);
+        running.push_back(task.get());
+    }
+
+    if (!task->future.isCanceled())
+    {
+        const auto image = decode(task.get());
+        if (!task->future.isCanceled())
+        {
+            task->future.reportResult(image);
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        running.erase(find(running.begin(), running.end(), task.get()));
+    }
+    task->future.reportFinished();
+}
+
+//============================================================================
+QImage DecodeSchedulerPrivate::decode(DecodeTask* task)
+{
+    QFile file;
+    auto* device = task->device;
+    if (!device)
+    {
+        file.setFileName(task->path);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            qCritical() << "Cannot open" << task->path << ":" << file.errorString();
+            return QImage();
+        }
+        device = &file;
+    }
+    const auto& bounds = task->options.size;
+
+    auto image = QImage();
+    if (!RawIOHandler::canRead(device))
+    {
+        QImageReader reader(device);
+        reader.setAutoTransform(true);
+        // the reader scales before it applies the orientation
+        const auto rotated = reader.transformation() & QImageIOHandler::TransformationRotate90;
+        const auto scaledSize = fitInto(reader.size(), rotated ? bounds.transposed() : bounds);
+        if (scaledSize.isValid())
+        {
+            reader.setScaledSize(scaledSize);
+        }
+        if (!reader.read(&image))
+        {
+            qCritical() << "Cannot decode" << task->path << ":" << reader.errorString();
+            return QImage();
+        }
+        return image;
+    }
+
+    RawIOHandler handler;
+    handler.setDevice(device);
+    for (auto it = task->options.rawOptions.cbegin(); it != task->options.rawOptions.cend(); ++it)
+    {
+        handler.setRawOption(it.key(), it.value());
+    }
+    auto* future = &task->future;
+    auto* control = task->control.data();
+    control->setProgressHandler([future, control](double progress)
+    {
+        future->setProgressValue(int(progress * 1000));
+        // QFuture::cancel() can't notify anyone, so it is checked whenever
+        // LibRaw reports progress
+        if (future->isCanceled())
+        {
+            control->cancel();
+        }
+    });
+    handler.setRawOption(RawIOHandler::DecodeControl, QVariant::fromValue(task->control));
+    const auto scaledSize = fitInto(handler.option(QImageIOHandler::Size).toSize(), bounds);
+    if (scaledSize.isValid())
+    {
+        handler.setOption(QImageIOHandler::ScaledSize, scaledSize);
+    }
+    if (!handler.read(&image))
+    {
+        if (!control->isCanceled())
+        {
+            qCritical() << "Cannot decode the raw image" << task->path;
+        }
+        return QImage();
+    }
+    return image;
+}
+
+//============================================================================
+DecodeScheduler& DecodeScheduler::global()
+{
+    static DecodeScheduler scheduler;
+    return scheduler;
+}
+
+//============================================================================
+DecodeScheduler::DecodeScheduler(int threads) :
+    d(new DecodeSchedulerPrivate)
+{
+    d->pool.setMaxThreadCount(max(1, threads));
+}
+
+//============================================================================
+DecodeScheduler::~DecodeScheduler()
+{
+    {
+        lock_guard<mutex> guard(d->lock);
+        for (auto& task : d->pending)
+        {
+            task->future.cancel();
+            task->future.reportFinished();
+        }
+        d->pending.clear();
+        for (auto* task : d->running)
+        {
+            task->future.cancel();
+            task->control->cancel();
+        }
+    }
+    d->pool.waitForDone();
+}
+
+//============================================================================
+QFuture<QImage> DecodeScheduler::decode(const QString& path, const DecodeOptions& options,
+                                        int priority)
+{
+    auto task = unique_ptr<DecodeTask>(new DecodeTask);
+    task->path = path;
+    task->options = options;
+    task->priority = priority;
+    return d->submit(move(task));
+}
+
+//============================================================================
+QFuture<QImage> DecodeScheduler::decode(QIODevice* device, const DecodeOptions& options,
+                                        int priority)
+{
+    auto task = unique_ptr<DecodeTask>(new DecodeTask);
+    task->device = device;
+    task->options = options;
+    task->priority = priority;
+    return d->submit(move(task));
+}
+
+//============================================================================
+bool DecodeScheduler::setPriority(const QFuture<QImage>& future, int priority)
+{
+    lock_guard<mutex> guard(d->lock);
+    for (auto& task : d->pending)
+    {
+        if (task->future.future() == future)
+        {
+            task->priority = priority;
+            return true;
+        }
+    }
+    return false;
+}
+
+//============================================================================
+int DecodeScheduler::pendingCount() const
+{
+    lock_guard<mutex> guard(d->lock);
+    return int(count_if(d->pending.cbegin(), d->pending.cend(),
+                        [](const unique_ptr<DecodeTask>& task)
+    {
+        return !task->future.isCanceled();
+    }));
+}
+
+//============================================================================
+QFuture<QImage> QtRaw::decodeAsync(const QString& path, const DecodeOptions& options,
+                                   int priority)
+{
+    return DecodeScheduler::global().decode(path, options, priority);
+}
+
+//============================================================================
+QFuture<QImage> QtRaw::decodeAsync(QIODevice* device, const DecodeOptions& options,
+                                   int priority)
+{
+    return DecodeScheduler::global().decode(device, options, priority);
+}
+
+//============================================================================
+bool QtRaw::setPriority(const QFuture<QImage>& future, int priority)
+{
+    return DecodeScheduler::global().setPriority(future, priority);
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DECODE_SCHEDULER_H
+#define DECODE_SCHEDULER_H
+
+#include "qtraw-export.h"
+#include "raw-io-handler.h"
+
+#include <QFuture>
+#include <QImage>
+#include <QMap>
+#include <QSize>
+#include <QString>
+#include <QThread>
+#include <QVariant>
+
+#include <memory>
+
+class QIODevice;
+
+class DecodeSchedulerPrivate;
+
+/**
+ * @brief The options of an asynchronous decode.
+ */
+struct DecodeOptions
+{
+    /**
+     * Decode to fit into this size, keeping the aspect ratio. Smaller images
+     * are not scaled up. The default decodes the full size.
+     *
+     * Unlike QImageReader::setScaledSize() and the ScaledSize option of the
+     * RawIOHandler, which scale to exactly the given size, a 4288x2856 image
+     * decoded with a size of 800x600 comes out as 800x532.
+     */
+    QSize size;
+
+    /**
+     * The raw options of the RawIOHandler, e.g. the Source or the ColorSpace.
+     * The DecodeControl is set by the scheduler.
+     */
+    QMap<RawIOHandler::RawOption, QVariant> rawOptions;
+};
+
+/**
+ * @brief The DecodeScheduler class decodes images on its own threads and
+ * returns them as QFutures.
+ *
+ * The pending decodes are started by priority, and among the same priority
+ * in the order they were submitted. The priority of a pending decode can be
+ * changed with setPriority(), e.g. when an image that was prefetched becomes
+ * visible. A decode that is running is not interrupted for one of a higher
+ * priority.
+ *
+ * QFuture::cancel() removes a pending decode, and makes a running one stop
+ * at the next progress report of LibRaw and release its buffers. The
+ * progress of a running decode is reported from 0 to 1000.
+ *
+ * Raw images are decoded by a RawIOHandler, other images by a QImageReader.
+ * A future whose decode has failed has a null image as its result, one that
+ * has been canceled has no result.
+ */
+class QTRAW_EXPORT DecodeScheduler
+{
+public:
+    /**
+     * @brief Priorities for the typical decodes of an image viewer. Any
+     * other int can be used as well, higher priorities are started first.
+     */
+    enum Priority
+    {
+        PrefetchPriority = 0,
+        NormalPriority = 50,
+        VisiblePriority = 100
+    };
+
+    /**
+     * @brief Returns the scheduler behind QtRaw::decodeAsync(), which uses a
+     * thread per core.
+     */
+    static DecodeScheduler& global();
+
+    /**
+     * @brief Construct a new DecodeScheduler with up to @a threads decodes
+     * running at the same time.
+     */
+    explicit DecodeScheduler(int threads = QThread::idealThreadCount());
+
+    /**
+     * @brief Cancels all decodes and waits for the running ones to stop.
+     */
+    ~DecodeScheduler();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(DecodeScheduler);
+    DecodeScheduler(const DecodeScheduler&& rhs) = delete;
+    DecodeScheduler& operator=(const DecodeScheduler&& rhs) = delete;
+
+    /**
+     * @brief Decodes the image file @a path with the given @a options and
+     * @a priority.
+     */
+    QFuture<QImage> decode(const QString& path, const DecodeOptions& options = {},
+                           int priority = NormalPriority);
+
+    /**
+     * @brief Decodes the image from @a device with the given @a options and
+     * @a priority.
+     *
+     * The device is read on one of the threads of the scheduler, so it must
+     * not be used otherwise until the future has finished.
+     */
+    QFuture<QImage> decode(QIODevice* device, const DecodeOptions& options = {},
+                           int priority = NormalPriority);
+
+    /**
+     * @brief Changes the @a priority of the pending decode @a future.
+     * @returns false if the decode has already started or finished
+     */
+    bool setPriority(const QFuture<QImage>& future, int priority);
+
+    /**
+     * @brief Returns the number of decodes that have not started yet.
+     */
+    int pendingCount() const;
+
+private:
+    std::unique_ptr<DecodeSchedulerPrivate> d;
+};
+
+/**
+ * @brief Asynchronous decoding with the global DecodeScheduler.
+ */
+namespace QtRaw
+{
+/**
+ * @brief Decodes the image file @a path, see DecodeScheduler::decode().
+ */
+QTRAW_EXPORT QFuture<QImage> decodeAsync(const QString& path,
+                                         const DecodeOptions& options = {},
+                                         int priority = DecodeScheduler::NormalPriority);
+
+/**
+ * @brief Decodes the image from @a device, see DecodeScheduler::decode().
+ */
+QTRAW_EXPORT QFuture<QImage> decodeAsync(QIODevice* device,
+                                         const DecodeOptions& options = {},
+                                         int priority = DecodeScheduler::NormalPriority);
+
+/**
+ * @brief Changes the @a priority of the pending decode @a future, see
+ * DecodeScheduler::setPriority().
+ */
+QTRAW_EXPORT bool setPriority(const QFuture<QImage>& future, int priority);
+}
+
+#endif // DECODE_SCHEDULER_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "device-spool.h"
+
+#include <limits>
+
+#include <QEventLoop>
+#include <QFileDevice>
+#include <QIODevice>
+#include <QTemporaryFile>
+#include <QTimer>
+
+using namespace std;
+
+/**
+ * @brief The number of bytes that are read from the device at once.
+ */
+static constexpr qint64 ChunkSize = 1024 * 1024;
+
+/**
+ * @brief The time in milliseconds to wait for new data before giving up.
+ */
+static constexpr int Timeout = 30000;
+
+//============================================================================
+DeviceSpool::DeviceSpool(QIODevice* device, qint64 memoryLimit) :
+    m_device(device),
+    m_memoryLimit(qBound(qint64(0), memoryLimit, qint64(numeric_limits<int>::max())))
+{
+    // connected as early as possible, so that a device which finishes while
+    // the handler inspects it is not waited for
+    const auto finish = [this] { m_finished = true; };
+    m_connections[0] = QObject::connect(device, &QIODevice::readChannelFinished, finish);
+    m_connections[1] = QObject::connect(device, &QIODevice::aboutToClose, finish);
+}
+
+//============================================================================
+DeviceSpool::~DeviceSpool()
+{
+    for (const auto& connection : m_connections)
+    {
+        QObject::disconnect(connection);
+    }
+    if (m_map)
+    {
+        m_file->unmap(m_map);
+    }
+}
+
+//============================================================================
+bool DeviceSpool::spool()
+{
+    auto chunk = QByteArray(int(ChunkSize), Qt::Uninitialized);
+    auto success = true;
+    forever
+    {
+        const auto length = m_device->read(chunk.data(), ChunkSize);
+        if (length < 0)
+        {
+            // the end of a sequential device, e.g. an exited process or a
+            // disconnected socket
+            break;
+        }
+        if (length > 0)
+        {
+            if (!append(chunk.constData(), length))
+            {
+                success = false;
+                break;
+            }
+            continue;
+        }
+        if (qobject_cast<QFileDevice*>(m_device) || isFinished())
+        {
+            // a pipe opened as QFile blocks in read() and reports its end
+            // with 0 bytes
+            break;
+        }
+        if (!waitForData())
+        {
+            success = false;
+            break;
+        }
+    }
+    if (!success || m_size == 0)
+    {
+        return false;
+    }
+    if (m_file)
+    {
+        m_file->flush();
+        m_map = m_file->map(0, m_size);
+    }
+    return true;
+}
+
+//============================================================================
+bool DeviceSpool::append(const char* data, qint64 length)
+{
+    if (!m_file && m_size + length > m_memoryLimit)
+    {
+        // spill everything we have so far into a temporary file
+        m_file = make_unique<QTemporaryFile>();
+        if (!m_file->open() || m_file->write(m_buffer) != m_buffer.size())
+        {
+            return false;
+        }
+        m_buffer = QByteArray();
+    }
+
+    if (m_file)
+    {
+        if (m_file->write(data, length) != length)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        m_buffer.append(data, int(length));
+    }
+    m_size += length;
+    return true;
+}
+
+//============================================================================
+bool DeviceSpool::waitForData()
+{
+    if (m_device->waitForReadyRead(Timeout) || m_device->bytesAvailable() > 0 ||
+        isFinished())
+    {
+        return true;
+    }
+
+    // Devices like QNetworkReply can't block, they need an event loop to
+    // make progress
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(m_device, &QIODevice::readyRead, &loop, &QEventLoop::quit);
+    QObject::connect(m_device, &QIODevice::readChannelFinished, &loop, &QEventLoop::quit);
+    QObject::connect(m_device, &QIODevice::aboutToClose, &loop, &QEventLoop::quit);
+    QObject::connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    timer.start(Timeout);
+    loop.exec();
+    return timer.isActive() || isFinished();
+}
+
+//============================================================================
+bool DeviceSpool::isFinished() const
+{
+    if (m_finished || !m_device->isOpen())
+    {
+        return true;
+    }
+    if (m_device->bytesAvailable() > 0)
+    {
+        return false;
+    }
+    // a sequential device is at its end whenever nothing is buffered, so
+    // only the signals tell that no more data can arrive
+    return !m_device->isSequential() && m_device->atEnd();
+}
+
+//============================================================================
+const uchar* DeviceSpool::data() const
+{
+    if (m_file)
+    {
+        return m_map;
+    }
+    return reinterpret_cast<const uchar*>(m_buffer.constData());
+}
+
+//============================================================================
+QIODevice* DeviceSpool::file() const
+{
+    return m_file.get();
+}
+
+//============================================================================
+qint64 DeviceSpool::size() const
+{
+    return m_size;
+}
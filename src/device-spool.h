@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef DEVICE_SPOOL_H
+#define DEVICE_SPOOL_H
+
+#include "qtraw-export.h"
+
+#include <QByteArray>
+#include <QMetaObject>
+#include <QtGlobal>
+
+#include <array>
+#include <memory>
+
+class QIODevice;
+class QTemporaryFile;
+
+/**
+ * @brief The DeviceSpool class reads a sequential QIODevice (e.g. a socket, a
+ * QProcess or a QNetworkReply) exactly once and keeps its data around, so that
+ * LibRaw can access it randomly.
+ *
+ * The data is held in memory up to a given threshold. Larger inputs are
+ * spilled into a temporary file, which is memory mapped once the device has
+ * been read completely.
+ */
+class QTRAW_EXPORT DeviceSpool
+{
+public:
+    /**
+     * @brief The default amount of memory that may be used before the data is
+     * spilled into a temporary file.
+     */
+    static constexpr qint64 DefaultMemoryLimit = 64 * 1024 * 1024;
+
+    /**
+     * @brief Construct a new DeviceSpool that reads from @a device and keeps
+     * up to @a memoryLimit bytes in memory.
+     */
+    explicit DeviceSpool(QIODevice* device, qint64 memoryLimit = DefaultMemoryLimit);
+
+    /**
+     * @brief Destruct the DeviceSpool and remove its temporary file.
+     */
+    ~DeviceSpool();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(DeviceSpool);
+    DeviceSpool(const DeviceSpool&& rhs) = delete;
+    DeviceSpool& operator=(const DeviceSpool&& rhs) = delete;
+
+    /**
+     * @brief Reads the device until its read channel is finished.
+     * @returns true on success
+     * @returns false if reading failed or no data arrived in time
+     */
+    bool spool();
+
+    /**
+     * @brief Returns the spooled data as one contiguous block, or nullptr if
+     * the temporary file could not be mapped.
+     */
+    const uchar* data() const;
+
+    /**
+     * @brief Returns the temporary file that holds the data if it has been
+     * spilled to disk, or nullptr if the data is held in memory.
+     */
+    QIODevice* file() const;
+
+    /**
+     * @brief Returns the number of spooled bytes.
+     */
+    qint64 size() const;
+
+private:
+    /**
+     * @brief Appends the @a length bytes at @a data to the spool.
+     */
+    bool append(const char* data, qint64 length);
+
+    /**
+     * @brief Waits until new data is available on the device.
+     * @returns false if a timeout occurred
+     */
+    bool waitForData();
+
+    /**
+     * @brief Returns true if no more data can arrive on the device: it has
+     * finished its read channel or has been closed, or a random access device
+     * is at its end.
+     */
+    bool isFinished() const;
+
+    QIODevice* m_device;
+    qint64 m_memoryLimit;
+    qint64 m_size{};
+    QByteArray m_buffer;
+    std::unique_ptr<QTemporaryFile> m_file;
+    uchar* m_map{};
+    bool m_finished{};
+    std::array<QMetaObject::Connection, 2> m_connections;
+};
+
+#endif // DEVICE_SPOOL_H
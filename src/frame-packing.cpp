@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "buffer-pool.h"
+#include "frame-packing.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+using namespace std;
+
+namespace FramePacking
+{
+//============================================================================
+/**
+ * @brief Returns the 8 bit value of the colour sample @a s.
+ */
+static inline int to8Bit(uchar s)
+{
+    return s;
+}
+
+static inline int to8Bit(ushort s)
+{
+    return s >> 8;
+}
+
+//============================================================================
+bool prepareTarget(QImage* image, const QSize& size)
+{
+    if (image->size() == size &&
+        image->format() == QImage::Format_RGB32 &&
+        image->isDetached())
+    {
+        return true;
+    }
+    *image = BufferPool::global().image(size, QImage::Format_RGB32);
+    return false;
+}
+
+//============================================================================
+QImageIOHandler::Transformations transformationFromFlip(int flip)
+{
+    static const auto transformations = array<QImageIOHandler::Transformation, 8>{{
+        QImageIOHandler::TransformationNone,
+        QImageIOHandler::TransformationMirror,
+        QImageIOHandler::TransformationFlip,
+        QImageIOHandler::TransformationRotate180,
+        QImageIOHandler::TransformationFlipAndRotate90,
+        QImageIOHandler::TransformationRotate270,
+        QImageIOHandler::TransformationRotate90,
+        QImageIOHandler::TransformationMirrorAndRotate90
+    }};
+    return (flip >= 0 && flip < 8) ? transformations[size_t(flip)] :
+                                     QImageIOHandler::TransformationNone;
+}
+
+//============================================================================
+/**
+ * @brief Packs the interleaved @a source frame of the given @a sourceSize with
+ * @a colors samples per pixel into the Format_RGB32 image @a target.
+ *
+ * If @a target is smaller than @a sourceSize the frame is downscaled with an
+ * area average while it is being packed, so no full size RGB32 copy of the
+ * frame is ever created. The @a transformation is applied on the way as
+ * well, so @a target has the transformed size.
+ */
+template<typename T>
+static void packFrame(const T* source, const QSize& sourceSize, int colors,
+                      QImage* target,
+                      QImageIOHandler::Transformations transformation,
+                      ImageStatistics* statistics)
+{
+    const auto srcWidth = sourceSize.width();
+    const auto srcHeight = sourceSize.height();
+    const auto srcStride = size_t(srcWidth) * size_t(colors);
+    const auto isColor = colors == 3;
+    const auto targetRows = OrientedRows(target, transformation);
+
+    if (targetRows.size() == sourceSize)
+    {
+        for (int y = 0; y < srcHeight; ++y)
+        {
+            const auto* src = source + y * srcStride;
+            const auto dst = targetRows.line(y);
+            for (int x = 0; x < srcWidth; ++x, src += colors)
+            {
+                const auto r = to8Bit(src[0]);
+                const auto pixel = isColor ? qRgb(r, to8Bit(src[1]), to8Bit(src[2]))
+                                           : qRgb(r, r, r);
+                dst[x] = pixel;
+                if (statistics)
+                {
+                    statistics->add(pixel);
+                }
+            }
+        }
+        return;
+    }
+
+    /**
+     * @brief Maps every source pixel along one axis onto the target pixels it
+     * overlaps.
+     *
+     * Coordinates are multiplied by the extent of the other image, so all the
+     * weights are integral. As we only ever downscale here, a source pixel
+     * covers at most two target pixels: the weight @a w0 goes to the target
+     * pixel @a t0 and the weight @a w1 to the target pixel @a t0 + 1.
+     */
+    struct Span
+    {
+        int t0;
+        int w0;
+        int w1;
+    };
+    const auto spans = [](int srcExtent, int dstExtent)
+    {
+        auto result = vector<Span>(size_t(srcExtent));
+        for (int i = 0; i < srcExtent; ++i)
+        {
+            const auto begin = qint64(i) * dstExtent;
+            const auto end = begin + dstExtent;
+            const auto t0 = int(begin / srcExtent);
+            const auto boundary = qMin(end, qint64(t0 + 1) * srcExtent);
+            result[size_t(i)] = {t0, int(boundary - begin), int(end - boundary)};
+        }
+        return result;
+    };
+    //------------------------------------------------------------------------
+
+    const auto dstWidth = targetRows.size().width();
+    const auto dstHeight = targetRows.size().height();
+    const auto columns = spans(srcWidth, dstWidth);
+    const auto rows = spans(srcHeight, dstHeight);
+    const auto norm = quint64(srcWidth) * quint64(srcHeight);
+    auto line = vector<quint32>(size_t(dstWidth) * 3 + 3);
+    auto sum = vector<quint64>(line.size());
+
+    for (int y = 0; y < srcHeight; ++y)
+    {
+        fill(line.begin(), line.end(), 0);
+        const auto* src = source + y * srcStride;
+        for (int x = 0; x < srcWidth; ++x, src += colors)
+        {
+            const auto& column = columns[size_t(x)];
+            const auto r = quint32(to8Bit(src[0]));
+            const auto g = isColor ? quint32(to8Bit(src[1])) : r;
+            const auto b = isColor ? quint32(to8Bit(src[2])) : r;
+            auto* l = &line[size_t(column.t0) * 3];
+            l[0] += r * quint32(column.w0);
+            l[1] += g * quint32(column.w0);
+            l[2] += b * quint32(column.w0);
+            l[3] += r * quint32(column.w1);
+            l[4] += g * quint32(column.w1);
+            l[5] += b * quint32(column.w1);
+        }
+
+        const auto& row = rows[size_t(y)];
+        for (size_t i = 0; i < sum.size(); ++i)
+        {
+            sum[i] += quint64(line[i]) * quint64(row.w0);
+        }
+        if (row.w1 == 0 &&
+            qint64(y + 1) * dstHeight != qint64(row.t0 + 1) * srcHeight)
+        {
+            continue;
+        }
+
+        // the target row t0 is complete now
+        const auto dst = targetRows.line(row.t0);
+        for (int x = 0; x < dstWidth; ++x)
+        {
+            const auto* s = &sum[size_t(x) * 3];
+            const auto pixel = qRgb(int((s[0] + norm / 2) / norm),
+                                    int((s[1] + norm / 2) / norm),
+                                    int((s[2] + norm / 2) / norm));
+            dst[x] = pixel;
+            if (statistics)
+            {
+                statistics->add(pixel);
+            }
+        }
+        for (size_t i = 0; i < sum.size(); ++i)
+        {
+            sum[i] = quint64(line[i]) * quint64(row.w1);
+        }
+    }
+}
+
+//============================================================================
+bool packBitmap(const libraw_processed_image_t& output, const QSize& size,
+                QImageIOHandler::Transformations transformation,
+                QImage* image, ImageStatistics* statistics)
+{
+    const auto sourceSize = QSize(output.width, output.height);
+    const auto packInto = [&output, &sourceSize, transformation](QImage* target,
+                                                                 ImageStatistics* stats)
+    {
+        if (output.bits == 16)
+        {
+            packFrame(reinterpret_cast<const ushort*>(output.data), sourceSize,
+                      output.colors, target, transformation, stats);
+        }
+        else
+        {
+            packFrame(output.data, sourceSize, output.colors, target,
+                      transformation, stats);
+        }
+    };
+    //------------------------------------------------------------------------
+
+    const auto orientedSize = (transformation & QImageIOHandler::TransformationRotate90) ?
+                              sourceSize.transposed() : sourceSize;
+    if (size.width() > orientedSize.width() || size.height() > orientedSize.height())
+    {
+        // upscaling is rare enough not to deserve a fused code path
+        auto unscaled = QImage(orientedSize, QImage::Format_RGB32);
+        if (unscaled.isNull())
+        {
+            return false;
+        }
+        packInto(&unscaled, nullptr);
+        *image = unscaled.scaled(size, Qt::IgnoreAspectRatio,
+                                 Qt::SmoothTransformation);
+        if (statistics && !image->isNull())
+        {
+            statistics->add(*image);
+        }
+        return !image->isNull();
+    }
+
+    prepareTarget(image, size);
+    if (image->isNull())
+    {
+        return false;
+    }
+    packInto(image, statistics);
+    return true;
+}
+
+//============================================================================
+int renderInto(LibRaw* raw, int colors, QImage* target,
+               ImageStatistics* statistics)
+{
+    const auto width = target->width();
+    const auto offset = (4 - colors) * width;
+    const auto bytesPerLine = target->bytesPerLine();
+    auto* bits = target->bits();
+
+    const auto ErrorCode = raw->copy_mem_image(bits + offset, bytesPerLine, 0);
+    if (ErrorCode != LIBRAW_SUCCESS)
+    {
+        return ErrorCode;
+    }
+
+    for (int y = 0; y < target->height(); ++y)
+    {
+        auto* line = bits + y * bytesPerLine;
+        const auto* src = line + offset;
+        auto* dst = reinterpret_cast<QRgb*>(line);
+        for (int x = 0; x < width; ++x, src += colors)
+        {
+            const auto pixel = colors == 3 ? qRgb(src[0], src[1], src[2])
+                                           : qRgb(src[0], src[0], src[0]);
+            dst[x] = pixel;
+            if (statistics)
+            {
+                statistics->add(pixel);
+            }
+        }
+    }
+    return LIBRAW_SUCCESS;
+}
+}
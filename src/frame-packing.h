@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FRAME_PACKING_H
+#define FRAME_PACKING_H
+
+#include <QImage>
+#include <QImageIOHandler>
+
+#include <cstddef>
+
+#include "image-statistics.h"
+#include "libraw.h"
+#include "qtraw-export.h"
+
+/**
+ * @brief The FramePacking namespace turns the output of LibRaw into
+ * Format_RGB32 QImages.
+ *
+ * Scaling and orientation are applied while the pixels are written, so every
+ * output pixel is written exactly once. The same pass optionally accumulates
+ * the ImageStatistics of the output.
+ */
+namespace FramePacking
+{
+/**
+ * @brief Prepares @a image to receive a Format_RGB32 frame of the given @a size.
+ *
+ * The buffer of @a image is kept if it already has the right size and format
+ * and is not shared with any other QImage. That way callers that read into
+ * the same QImage over and over don't pay for a new frame buffer every time.
+ * A new buffer is taken from the global BufferPool, so even callers that
+ * read into a fresh QImage every time reuse the pages of earlier frames.
+ * @returns true if the buffer of @a image was reused
+ */
+QTRAW_EXPORT bool prepareTarget(QImage* image, const QSize& size);
+
+/**
+ * @brief Returns the Qt transformation that corresponds to LibRaw's @a flip.
+ */
+QTRAW_EXPORT QImageIOHandler::Transformations transformationFromFlip(int flip);
+
+/**
+ * @brief Addresses the pixels of a Format_RGB32 image in the orientation they
+ * have before a transformation is applied.
+ *
+ * A pixel written through a Line ends up where the transformed image has it,
+ * so the packing loops apply the orientation while they write their output
+ * and no separate transformation pass is needed. As in QImageReader, mirror
+ * and flip are applied first, followed by the clockwise rotation.
+ */
+class OrientedRows
+{
+public:
+    /**
+     * @brief One source row, whose pixels are @a step pixels apart in the
+     * target image.
+     */
+    struct Line
+    {
+        QRgb* first;
+        ptrdiff_t step;
+
+        QRgb& operator[](int x) const
+        {
+            return first[x * step];
+        }
+    };
+
+    OrientedRows(QImage* target, QImageIOHandler::Transformations transformation) :
+        m_bits(reinterpret_cast<QRgb*>(target->bits())),
+        m_stride(target->bytesPerLine() / ptrdiff_t(sizeof(QRgb))),
+        m_size(target->size()),
+        m_mirror(transformation & QImageIOHandler::TransformationMirror),
+        m_flip(transformation & QImageIOHandler::TransformationFlip),
+        m_rotate(transformation & QImageIOHandler::TransformationRotate90)
+    {
+        if (m_rotate)
+        {
+            m_size.transpose();
+        }
+    }
+
+    /**
+     * @brief Returns the size of the image before the transformation.
+     */
+    QSize size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Returns the target pixels of the source row @a y.
+     */
+    Line line(int y) const
+    {
+        const auto width = ptrdiff_t(m_size.width());
+        const auto row = m_flip ? m_size.height() - 1 - y : y;
+        if (!m_rotate)
+        {
+            auto* begin = m_bits + row * m_stride;
+            return m_mirror ? Line{begin + width - 1, -1} : Line{begin, 1};
+        }
+
+        // the source row becomes a target column
+        auto* column = m_bits + (m_size.height() - 1 - row);
+        return m_mirror ? Line{column + (width - 1) * m_stride, -m_stride} :
+                          Line{column, m_stride};
+    }
+
+private:
+    QRgb* m_bits;
+    ptrdiff_t m_stride;
+    QSize m_size;
+    bool m_mirror;
+    bool m_flip;
+    bool m_rotate;
+};
+
+/**
+ * @brief Packs the bitmap @a output of LibRaw into @a image, applying the
+ * @a transformation and scaling it to @a size on the way. If @a statistics
+ * is given, the output pixels are accounted for in it.
+ * @returns true on success
+ * @returns false if the frame buffer could not be allocated
+ */
+QTRAW_EXPORT bool packBitmap(const libraw_processed_image_t& output, const QSize& size,
+                             QImageIOHandler::Transformations transformation,
+                             QImage* image, ImageStatistics* statistics = nullptr);
+
+/**
+ * @brief Lets LibRaw render its processed image straight into the
+ * Format_RGB32 image @a target, which skips the intermediate
+ * libraw_processed_image_t altogether.
+ *
+ * LibRaw writes the packed 8 bit pixels with @a colors samples each into the
+ * right part of every scan line. They are then expanded to RGB32 in place,
+ * row by row and from left to right, so every pixel is read before it gets
+ * overwritten. If @a statistics is given, the pixels are accounted for in it
+ * during the expansion.
+ * @returns the LibRaw error code
+ */
+QTRAW_EXPORT int renderInto(LibRaw* raw, int colors, QImage* target,
+                            ImageStatistics* statistics = nullptr);
+}
+
+#endif // FRAME_PACKING_H
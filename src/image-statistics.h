@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef IMAGE_STATISTICS_H
+#define IMAGE_STATISTICS_H
+
+#include <QImage>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+#include <array>
+
+/**
+ * @brief The ImageStatistics struct holds the histograms and clipping counts
+ * of a decoded image.
+ *
+ * They are accumulated while the pixels are packed, so they cost no extra
+ * pass over the image. Partial statistics of parts of an image, e.g. of
+ * several threads, are combined with merge().
+ */
+struct ImageStatistics
+{
+    using Histogram = std::array<qint64, 256>;
+
+    Histogram red{};
+    Histogram green{};
+    Histogram blue{};
+    Histogram luminance{};
+
+    /**
+     * The number of pixels with at least one channel at 255.
+     */
+    qint64 clippedHighlights{};
+
+    /**
+     * The number of pixels with all channels at 0.
+     */
+    qint64 clippedShadows{};
+
+    /**
+     * @brief Accounts for the @a pixel.
+     */
+    void add(QRgb pixel)
+    {
+        const auto r = qRed(pixel);
+        const auto g = qGreen(pixel);
+        const auto b = qBlue(pixel);
+        ++red[size_t(r)];
+        ++green[size_t(g)];
+        ++blue[size_t(b)];
+        ++luminance[size_t(qGray(r, g, b))];
+        clippedHighlights += (r == 255 || g == 255 || b == 255) ? 1 : 0;
+        clippedShadows += (r | g | b) == 0 ? 1 : 0;
+    }
+
+    /**
+     * @brief Accounts for all pixels of the Format_RGB32 @a image.
+     */
+    void add(const QImage& image)
+    {
+        for (int y = 0; y < image.height(); ++y)
+        {
+            const auto* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+            for (int x = 0; x < image.width(); ++x)
+            {
+                add(line[x]);
+            }
+        }
+    }
+
+    /**
+     * @brief Adds the partial statistics @a other.
+     */
+    void merge(const ImageStatistics& other)
+    {
+        for (size_t i = 0; i < red.size(); ++i)
+        {
+            red[i] += other.red[i];
+            green[i] += other.green[i];
+            blue[i] += other.blue[i];
+            luminance[i] += other.luminance[i];
+        }
+        clippedHighlights += other.clippedHighlights;
+        clippedShadows += other.clippedShadows;
+    }
+
+    /**
+     * @brief Inserts the statistics into the text keys @a text, with the
+     * histograms as comma separated lists of 256 counts.
+     */
+    void toText(QMap<QString, QString>* text) const
+    {
+        const auto join = [](const Histogram& histogram)
+        {
+            auto counts = QStringList{};
+            counts.reserve(int(histogram.size()));
+            for (const auto count : histogram)
+            {
+                counts << QString::number(count);
+            }
+            return counts.join(QLatin1Char(','));
+        };
+        //--------------------------------------------------------------------
+
+        text->insert(QStringLiteral("HistogramRed"), join(red));
+        text->insert(QStringLiteral("HistogramGreen"), join(green));
+        text->insert(QStringLiteral("HistogramBlue"), join(blue));
+        text->insert(QStringLiteral("HistogramLuminance"), join(luminance));
+        text->insert(QStringLiteral("ClippedHighlights"), QString::number(clippedHighlights));
+        text->insert(QStringLiteral("ClippedShadows"), QString::number(clippedShadows));
+    }
+};
+
+#endif // IMAGE_STATISTICS_H
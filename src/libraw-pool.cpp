@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "libraw-pool.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+
+using namespace std;
+
+//============================================================================
+LibRawPool& LibRawPool::global()
+{
+    // never destroyed, so handlers that are destroyed during static
+    // destruction can still release their instances
+    static auto* pool = []
+    {
+        auto* result = new LibRawPool;
+        result->setCameraFile(QString::fromLocal8Bit(qgetenv("QTRAW_RAWSPEED_CAMERAS")));
+        return result;
+    }();
+    return *pool;
+}
+
+//============================================================================
+LibRawPool::LibRawPool(int capacity) :
+    m_capacity(size_t(max(0, capacity)))
+{
+}
+
+//============================================================================
+unique_ptr<LibRaw> LibRawPool::acquire()
+{
+    auto cameraFile = QString();
+    {
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_idle.empty())
+        {
+            auto raw = move(m_idle.back());
+            m_idle.pop_back();
+            return raw;
+        }
+        cameraFile = m_cameraFile;
+        ++m_created;
+    }
+
+    // the construction is what the pool saves, so it happens outside the lock
+    QElapsedTimer timer;
+    timer.start();
+    auto raw = make_unique<LibRaw>();
+    // LibRaw ignores the file if it is built without rawspeed
+    if (!cameraFile.isEmpty())
+    {
+        auto path = QFile::encodeName(cameraFile);
+        if (raw->set_rawspeed_camerafile(path.data()) != 0)
+        {
+            qWarning("Could not load the rawspeed cameras from %s", path.constData());
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    m_constructionTime += timer.nsecsElapsed();
+    if (!m_defaults)
+    {
+        m_defaults = make_unique<libraw_output_params_t>(raw->imgdata.params);
+    }
+    return raw;
+}
+
+//============================================================================
+void LibRawPool::release(unique_ptr<LibRaw> raw)
+{
+    if (!raw)
+    {
+        return;
+    }
+    raw->recycle();
+    raw->set_progress_handler(nullptr, nullptr);
+    raw->clearCancelFlag();
+
+    lock_guard<mutex> lock(m_mutex);
+    if (m_idle.size() >= m_capacity || !m_defaults)
+    {
+        return;
+    }
+    raw->imgdata.params = *m_defaults;
+    m_idle.push_back(move(raw));
+}
+
+//============================================================================
+void LibRawPool::setCapacity(int capacity)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_capacity = size_t(max(0, capacity));
+    if (m_idle.size() > m_capacity)
+    {
+        m_idle.resize(m_capacity);
+    }
+}
+
+//============================================================================
+void LibRawPool::setCameraFile(const QString& fileName)
+{
+    auto idle = vector<unique_ptr<LibRaw>>();
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_cameraFile = fileName;
+        idle.swap(m_idle);
+    }
+}
+
+//============================================================================
+qint64 LibRawPool::createdCount() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_created;
+}
+
+//============================================================================
+qint64 LibRawPool::constructionTime() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_constructionTime;
+}
+
+//============================================================================
+void LibRawPool::clear()
+{
+    auto idle = vector<unique_ptr<LibRaw>>();
+    lock_guard<mutex> lock(m_mutex);
+    idle.swap(m_idle);
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIBRAW_POOL_H
+#define LIBRAW_POOL_H
+
+#include <QString>
+#include <QThread>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "libraw.h"
+#include "qtraw-export.h"
+
+/**
+ * @brief The LibRawPool class keeps idle LibRaw instances around, so a
+ * decode doesn't have to construct a new one.
+ *
+ * Constructing LibRaw is expensive: it allocates several hundred kilobytes of
+ * state and, if LibRaw is built with USE_RAWSPEED, builds the camera
+ * database of rawspeed. With the patches of this repository rawspeed builds
+ * it from a table that is generated from cameras.xml at build time, so no
+ * XML is parsed. The pool pays the rest once per instance instead of once
+ * per image. Instances are only created on demand, so processes that never
+ * decode never pay it.
+ *
+ * A released instance is recycled and gets the default parameters of LibRaw
+ * back, so it can't leak options from one decode into the next.
+ */
+class QTRAW_EXPORT LibRawPool
+{
+public:
+    /**
+     * @brief Returns the pool the RawIOHandler takes its LibRaw instances
+     * from. The environment variable QTRAW_RAWSPEED_CAMERAS can name a
+     * cameras.xml that is parsed instead of using the compiled-in camera
+     * table.
+     */
+    static LibRawPool& global();
+
+    /**
+     * @brief Construct a new LibRawPool that keeps up to @a capacity idle
+     * instances.
+     */
+    explicit LibRawPool(int capacity = QThread::idealThreadCount());
+    ~LibRawPool() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(LibRawPool);
+    LibRawPool(const LibRawPool&& rhs) = delete;
+    LibRawPool& operator=(const LibRawPool&& rhs) = delete;
+
+    /**
+     * @brief Returns an idle instance, or a new one if there is none.
+     */
+    std::unique_ptr<LibRaw> acquire();
+
+    /**
+     * @brief Gives @a raw back to the pool. It is destroyed if the pool is
+     * full.
+     */
+    void release(std::unique_ptr<LibRaw> raw);
+
+    /**
+     * @brief Sets the number of idle instances that are kept to @a capacity.
+     */
+    void setCapacity(int capacity);
+
+    /**
+     * @brief Sets the rawspeed camera database of the instances that are
+     * created from now on to the cameras.xml @a fileName, e.g. to support
+     * new cameras without rebuilding rawspeed. Every new instance parses the
+     * file, on top of building the compiled-in table. An empty name restores
+     * the compiled-in table. Idle instances are dropped.
+     *
+     * This only has an effect if LibRaw is built with USE_RAWSPEED.
+     */
+    void setCameraFile(const QString& fileName);
+
+    /**
+     * @brief Returns the number of instances the pool has constructed.
+     */
+    qint64 createdCount() const;
+
+    /**
+     * @brief Returns the time in nanoseconds the pool has spent constructing
+     * instances, including the camera database of rawspeed.
+     */
+    qint64 constructionTime() const;
+
+    /**
+     * @brief Destroys all idle instances.
+     */
+    void clear();
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<LibRaw>> m_idle;
+    std::unique_ptr<libraw_output_params_t> m_defaults;
+    QString m_cameraFile;
+    size_t m_capacity;
+    qint64 m_created{};
+    qint64 m_constructionTime{};
+};
+
+#endif // LIBRAW_POOL_H
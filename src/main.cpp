@@ -23,6 +23,7 @@
 #include <QIODevice>
 #include <QStringList>
 
+#include "raw-formats.h"
 #include "raw-io-handler.h"
 
 class RawPlugin : public QImageIOPlugin
@@ -42,23 +43,26 @@ public:
 
 QStringList RawPlugin::keys() const
 {
-    return QStringList() <<
-           QLatin1String("crw") << QLatin1String("cr2") <<
-           QLatin1String("arw") <<
-           QLatin1String("nef") <<
-           QLatin1String("raf") <<
-           QLatin1String("dng");
+    return RawFormats::keys();
 }
 
 QImageIOPlugin::Capabilities
 RawPlugin::capabilities(QIODevice* device, const QByteArray& format) const
 {
-    if (keys().contains(format) ||
-        format == "tif" ||
-        format == "tiff")
+    if (keys().contains(format))
     {
         return {CanRead};
     }
+    if (format == "tif" || format == "tiff")
+    {
+        // Only claim TIFF files that actually contain raw data, everything
+        // else is left to the much faster TIFF plugin
+        if (device && device->isReadable() && RawFormats::isRawTiff(device))
+        {
+            return {CanRead};
+        }
+        return nullptr;
+    }
     if (!format.isEmpty())
     {
         return nullptr;
@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "preview-locator.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QtEndian>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+/**
+ * @brief TIFF tags that are used to locate the preview.
+ */
+enum TiffTag : quint16
+{
+    JpgFromRaw = 46,            // Panasonic RW2
+    BitsPerSample = 258,
+    Compression = 259,
+    PhotometricInterpretation = 262,
+    StripOffsets = 273,
+    Orientation = 274,
+    StripByteCounts = 279,
+    SubIFDs = 330,
+    JpegInterchangeFormat = 513,
+    JpegInterchangeFormatLength = 514
+};
+
+/**
+ * @brief The magic numbers of the TIFF header that are accepted.
+ */
+enum TiffMagic : quint16
+{
+    Tiff = 42,
+    OlympusRO = 0x4f52,
+    OlympusRS = 0x5352,
+    Panasonic = 0x55
+};
+
+/**
+ * @brief PhotometricInterpretation values of raw sensor data.
+ */
+enum Photometric : quint16
+{
+    CFA = 32803,
+    LinearRaw = 34892
+};
+
+/**
+ * @brief Limits that keep broken or malicious files from sending the walk
+ * in circles or through huge tables.
+ */
+constexpr auto MaxIfds = 64;
+constexpr auto MaxEntries = 1024;
+constexpr auto MaxSubIfds = 16;
+constexpr auto MaxJpegMarkers = 64;
+
+//============================================================================
+/**
+ * @brief Returns the size in bytes of one value of the TIFF field type
+ * @a type, or 0 for unknown types.
+ */
+qint64 typeSize(quint16 type)
+{
+    switch (type)
+    {
+    case 1: case 2: case 6: case 7:
+        return 1;
+    case 3: case 8:
+        return 2;
+    case 4: case 9: case 11: case 13:
+        return 4;
+    case 5: case 10: case 12:
+        return 8;
+    default:
+        return 0;
+    }
+}
+}
+
+//============================================================================
+PreviewLocator::PreviewLocator(QIODevice* device) :
+    m_device(device)
+{
+    if (!device)
+    {
+        return;
+    }
+    if (auto* buffer = qobject_cast<QBuffer*>(device))
+    {
+        // A shallow copy keeps the data alive even if the buffer is changed
+        m_buffered = buffer->data();
+        m_memory = reinterpret_cast<const uchar*>(m_buffered.constData());
+        m_size = m_buffered.size();
+        return;
+    }
+    if (device->isSequential())
+    {
+        // nothing can be read without consuming it
+        return;
+    }
+
+    m_size = device->size();
+    m_file = qobject_cast<QFile*>(device);
+    if (m_file && m_size > 0)
+    {
+        // the mapping itself reads nothing, only the touched pages are
+        m_mapped = m_file->map(0, m_size);
+        m_memory = m_mapped;
+    }
+}
+
+//============================================================================
+PreviewLocator::~PreviewLocator()
+{
+    // a QFile that is gone has taken its mappings with it
+    if (m_mapped && m_file)
+    {
+        m_file->unmap(m_mapped);
+    }
+}
+
+//============================================================================
+QByteArray PreviewLocator::read(qint64 offset, qint64 length) const
+{
+    if (offset < 0 || length <= 0 || offset > m_size || length > m_size - offset ||
+        length > qint64(numeric_limits<int>::max()))
+    {
+        return QByteArray();
+    }
+    if (m_memory)
+    {
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(m_memory + offset),
+                                       int(length));
+    }
+    if (!m_device->seek(offset))
+    {
+        return QByteArray();
+    }
+    const auto data = m_device->read(length);
+    return data.size() == length ? data : QByteArray();
+}
+
+//============================================================================
+QByteArray PreviewLocator::data(const EmbeddedPreview& preview) const
+{
+    return read(preview.offset, preview.length);
+}
+
+//============================================================================
+bool PreviewLocator::readJpegSize(qint64 offset, qint64 length, QSize* size) const
+{
+    const auto end = offset + length;
+    const auto soi = read(offset, 2);
+    if (soi.size() != 2 || uchar(soi[0]) != 0xff || uchar(soi[1]) != 0xd8)
+    {
+        return false;
+    }
+
+    auto position = offset + 2;
+    for (int i = 0; i < MaxJpegMarkers && position + 4 <= end; ++i)
+    {
+        const auto segment = read(position, 4);
+        if (segment.size() != 4 || uchar(segment[0]) != 0xff)
+        {
+            return false;
+        }
+        const auto marker = uchar(segment[1]);
+        if (marker == 0xff)
+        {
+            // a fill byte
+            ++position;
+            continue;
+        }
+
+        // SOF0, SOF1 and SOF2 are the frames Qt's JPEG decoder handles
+        if (marker >= 0xc0 && marker <= 0xc2)
+        {
+            const auto frame = read(position + 4, 6);
+            if (frame.size() != 6)
+            {
+                return false;
+            }
+            const auto* bytes = reinterpret_cast<const uchar*>(frame.constData());
+            const auto precision = bytes[0];
+            const auto height = qFromBigEndian<quint16>(bytes + 1);
+            const auto width = qFromBigEndian<quint16>(bytes + 3);
+            const auto components = bytes[5];
+            if (precision != 8 || width == 0 || height == 0 ||
+                (components != 1 && components != 3))
+            {
+                return false;
+            }
+            *size = QSize(width, height);
+            return true;
+        }
+
+        // the lossless frames of the raw data, or a scan without a frame
+        const auto otherFrame = marker >= 0xc3 && marker <= 0xcf &&
+                                marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+        if (otherFrame || marker == 0xda || marker == 0xd9)
+        {
+            return false;
+        }
+        const auto* bytes = reinterpret_cast<const uchar*>(segment.constData());
+        position += 2 + qFromBigEndian<quint16>(bytes + 2);
+    }
+    return false;
+}
+
+//============================================================================
+bool PreviewLocator::locate(EmbeddedPreview* preview)
+{
+    const auto header = read(0, 8);
+    if (header.size() != 8)
+    {
+        return false;
+    }
+    m_littleEndian = header.startsWith("II");
+    if (!m_littleEndian && !header.startsWith("MM"))
+    {
+        return false;
+    }
+
+    const auto u16 = [this](const QByteArray& data, qint64 position)
+    {
+        const auto* bytes = reinterpret_cast<const uchar*>(data.constData()) + position;
+        return m_littleEndian ? qFromLittleEndian<quint16>(bytes)
+                              : qFromBigEndian<quint16>(bytes);
+    };
+    const auto u32 = [this](const QByteArray& data, qint64 position)
+    {
+        const auto* bytes = reinterpret_cast<const uchar*>(data.constData()) + position;
+        return m_littleEndian ? qFromLittleEndian<quint32>(bytes)
+                              : qFromBigEndian<quint32>(bytes);
+    };
+    //------------------------------------------------------------------------
+
+    const auto magic = u16(header, 2);
+    if (magic != Tiff && magic != OlympusRO && magic != OlympusRS && magic != Panasonic)
+    {
+        return false;
+    }
+
+    struct Candidate
+    {
+        qint64 offset;
+        qint64 length;
+    };
+    auto candidates = vector<Candidate>();
+    auto pending = vector<qint64>{u32(header, 4)};
+    auto visited = vector<qint64>();
+    auto orientation = 0;
+
+    while (!pending.empty() && visited.size() < size_t(MaxIfds))
+    {
+        const auto ifd = pending.back();
+        pending.pop_back();
+        if (ifd < 8 || find(visited.begin(), visited.end(), ifd) != visited.end())
+        {
+            continue;
+        }
+        const auto first = visited.empty();
+        visited.push_back(ifd);
+
+        const auto countData = read(ifd, 2);
+        if (countData.isEmpty())
+        {
+            continue;
+        }
+        const auto count = qMin(int(u16(countData, 0)), MaxEntries);
+        const auto entries = read(ifd + 2, count * 12 + 4);
+        if (entries.isEmpty())
+        {
+            continue;
+        }
+
+        // Returns up to maxCount integral values of the entry at position
+        const auto values = [&](qint64 position, int maxCount)
+        {
+            auto result = vector<quint32>();
+            const auto type = u16(entries, position + 2);
+            const auto size = typeSize(type);
+            const auto n = qMin(qint64(u32(entries, position + 4)), qint64(maxCount));
+            if ((size != 2 && size != 4) || type == 11 || n == 0)
+            {
+                return result;
+            }
+            const auto inlined = size * qint64(u32(entries, position + 4)) <= 4;
+            const auto data = inlined ? entries.mid(int(position + 8), 4)
+                                      : read(u32(entries, position + 8), size * n);
+            if (data.size() < size * n)
+            {
+                return result;
+            }
+            for (qint64 i = 0; i < n; ++i)
+            {
+                result.push_back(size == 2 ? u16(data, i * 2) : u32(data, i * 4));
+            }
+            return result;
+        };
+        const auto value = [&values](qint64 position)
+        {
+            const auto result = values(position, 1);
+            return result.empty() ? 0u : result.front();
+        };
+        //--------------------------------------------------------------------
+
+        auto compression = 0u;
+        auto photometric = 0u;
+        auto bitsPerSample = 0u;
+        auto stripCount = 0u;
+        auto stripOffset = 0u;
+        auto stripLength = 0u;
+        auto jpegOffset = 0u;
+        auto jpegLength = 0u;
+        for (int i = 0; i < count; ++i)
+        {
+            const auto position = qint64(i) * 12;
+            switch (u16(entries, position))
+            {
+            case Compression:
+                compression = value(position);
+                break;
+
+            case PhotometricInterpretation:
+                photometric = value(position);
+                break;
+
+            case BitsPerSample:
+                bitsPerSample = value(position);
+                break;
+
+            case StripOffsets:
+                stripCount = u32(entries, position + 4);
+                stripOffset = value(position);
+                break;
+
+            case StripByteCounts:
+                stripLength = value(position);
+                break;
+
+            case Orientation:
+                if (first)
+                {
+                    orientation = int(value(position));
+                }
+                break;
+
+            case SubIFDs:
+                for (const auto subIfd : values(position, MaxSubIfds))
+                {
+                    pending.push_back(subIfd);
+                }
+                break;
+
+            case JpegInterchangeFormat:
+                jpegOffset = value(position);
+                break;
+
+            case JpegInterchangeFormatLength:
+                jpegLength = value(position);
+                break;
+
+            case JpgFromRaw:
+                // a complete JPEG file as the value of the entry
+                if (magic == Panasonic && u32(entries, position + 4) > 4)
+                {
+                    candidates.push_back({u32(entries, position + 8),
+                                          u32(entries, position + 4)});
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+        const auto next = u32(entries, qint64(count) * 12);
+        if (next)
+        {
+            pending.push_back(next);
+        }
+
+        if (jpegOffset && jpegLength)
+        {
+            candidates.push_back({jpegOffset, jpegLength});
+        }
+        // JPEG compressed strips that don't hold sensor data, e.g. the
+        // previews of CR2 and DNG
+        if (stripCount == 1 && stripLength && (compression == 6 || compression == 7) &&
+            photometric != CFA && photometric != LinearRaw && bitsPerSample <= 8)
+        {
+            candidates.push_back({stripOffset, stripLength});
+        }
+    }
+
+    auto found = false;
+    for (const auto& candidate : candidates)
+    {
+        auto size = QSize();
+        if (candidate.offset + candidate.length > m_size ||
+            !readJpegSize(candidate.offset, candidate.length, &size))
+        {
+            continue;
+        }
+        if (!found || qint64(size.width()) * size.height() >
+                      qint64(preview->size.width()) * preview->size.height())
+        {
+            preview->offset = candidate.offset;
+            preview->length = candidate.length;
+            preview->size = size;
+            found = true;
+        }
+    }
+
+    // the TIFF orientation as LibRaw's flip
+    static const char flips[] = "50132467";
+    preview->orientation = (orientation >= 1 && orientation <= 8) ?
+                           flips[orientation & 7] - '0' : 0;
+    return found;
+}
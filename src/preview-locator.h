@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PREVIEW_LOCATOR_H
+#define PREVIEW_LOCATOR_H
+
+#include "qtraw-export.h"
+
+#include <QByteArray>
+#include <QPointer>
+#include <QSize>
+
+class QFile;
+class QIODevice;
+
+/**
+ * @brief The location of an embedded JPEG preview.
+ */
+struct EmbeddedPreview
+{
+    /**
+     * The position of the JPEG data in the file.
+     */
+    qint64 offset{};
+    qint64 length{};
+
+    /**
+     * The size of the JPEG image before the orientation is applied.
+     */
+    QSize size;
+
+    /**
+     * The orientation of the camera as LibRaw's flip, see RawHeader.
+     */
+    int orientation{};
+};
+
+/**
+ * @brief The PreviewLocator class finds the embedded JPEG preview of a TIFF
+ * based raw file (CR2, NEF, ARW, DNG, PEF, ORF, RW2, ...) without LibRaw.
+ *
+ * LibRaw only hands out the preview after it has identified the whole file.
+ * The locator instead walks the IFDs, including the sub IFDs, and reads the
+ * frame header of every JPEG it finds, which takes a handful of small reads.
+ * Whatever it doesn't understand is left to LibRaw: locate() fails for files
+ * that aren't TIFF based, have no baseline JPEG preview or only keep it in
+ * their maker notes.
+ *
+ * The data of a QBuffer is used where it is, and a QFile is mapped into
+ * memory, so data() doesn't copy the preview. Other devices are read with
+ * seek(); sequential devices aren't supported.
+ */
+class QTRAW_EXPORT PreviewLocator
+{
+public:
+    /**
+     * @brief Construct a new PreviewLocator for the file on @a device.
+     */
+    explicit PreviewLocator(QIODevice* device);
+
+    /**
+     * @brief Unmaps the file.
+     */
+    ~PreviewLocator();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(PreviewLocator);
+    PreviewLocator(const PreviewLocator&& rhs) = delete;
+    PreviewLocator& operator=(const PreviewLocator&& rhs) = delete;
+
+    /**
+     * @brief Finds the largest JPEG preview of the file and stores it in
+     * @a preview.
+     * @returns false if the preview has to be left to LibRaw
+     */
+    bool locate(EmbeddedPreview* preview);
+
+    /**
+     * @brief Returns the JPEG data of @a preview. The array refers to the
+     * memory of the device if possible, so it must not outlive the locator
+     * or the device.
+     */
+    QByteArray data(const EmbeddedPreview& preview) const;
+
+private:
+    /**
+     * @brief Returns @a length bytes at @a offset of the file, or an empty
+     * array if they are out of its range.
+     */
+    QByteArray read(qint64 offset, qint64 length) const;
+
+    /**
+     * @brief Reads the frame header of the JPEG data at @a offset and stores
+     * its size in @a size.
+     * @returns false if there is no baseline or progressive JPEG with 8 bit
+     * samples
+     */
+    bool readJpegSize(qint64 offset, qint64 length, QSize* size) const;
+
+    QIODevice* m_device;
+    QPointer<QFile> m_file;
+    QByteArray m_buffered;
+    uchar* m_mapped{};
+    const uchar* m_memory{};
+    qint64 m_size{};
+    bool m_littleEndian{};
+};
+
+#endif // PREVIEW_LOCATOR_H
@@ -0,0 +1,31 @@
+# Links the core of QtRaw, the shared library qtraw-core: the RawIOHandler and
+# everything it depends on, the RawDeveloper, the DecodeScheduler and the
+# shared frames. The image format plugin, the command line tools and the tests
+# all link it, so a process that uses the plugin and the core directly has a
+# single instance of the global pools and the decode metrics.
+
+CONFIG += link_pkgconfig
+
+# the reentrant LibRaw, as decodes run on several threads at once
+unix: {
+    PKGCONFIG += \
+        libraw_r
+}
+
+INCLUDEPATH += \
+    $$PWD
+
+LIBS += -L$$OUT_PWD/../libs
+win32:CONFIG(debug, debug|release) {
+    LIBS += -lqtraw-cored
+} else {
+    LIBS += -lqtraw-core
+}
+# the tools run from the build tree as well
+unix: QMAKE_RPATHDIR += $$OUT_PWD/../libs
+
+win32: {
+    INCLUDEPATH *= $$PWD/../LibRaw/libraw/
+
+    LIBS += -llibraw_r
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef QTRAW_EXPORT_H
+#define QTRAW_EXPORT_H
+
+#include <QtGlobal>
+
+/**
+ * @brief Marks the classes and functions of the qtraw-core library, which the
+ * image format plugin, the tools and applications link against.
+ */
+#if defined(QTRAW_CORE_LIBRARY)
+#  define QTRAW_EXPORT Q_DECL_EXPORT
+#else
+#  define QTRAW_EXPORT Q_DECL_IMPORT
+#endif
+
+#endif // QTRAW_EXPORT_H
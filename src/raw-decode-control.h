@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RAW_DECODE_CONTROL_H
+#define RAW_DECODE_CONTROL_H
+
+#include <QMetaType>
+#include <QSharedPointer>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+/**
+ * @brief The RawDecodeControl class lets the owner of a read() cancel it and
+ * follow its progress from any thread.
+ *
+ * A control is handed to the RawIOHandler through the RawIOHandler::DecodeControl
+ * raw option, or through QImageReader as a dynamic property of the device:
+ * @code
+ * auto control = QSharedPointer<RawDecodeControl>::create();
+ * file.setProperty("qtraw_decode_control", QVariant::fromValue(control));
+ * @endcode
+ * A canceled read() returns false within milliseconds, as LibRaw checks for
+ * the cancellation inside its decoding loops, and all of its buffers are
+ * released. A control is meant for a single read().
+ *
+ * This class is header-only and doesn't depend on LibRaw, so applications
+ * that only use the plugin can include it.
+ */
+class RawDecodeControl
+{
+public:
+    RawDecodeControl() = default;
+    ~RawDecodeControl() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(RawDecodeControl);
+    RawDecodeControl(const RawDecodeControl&& rhs) = delete;
+    RawDecodeControl& operator=(const RawDecodeControl&& rhs) = delete;
+
+    /**
+     * @brief Cancels the read() this control belongs to.
+     */
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_canceled = true;
+        if (m_cancelHook)
+        {
+            m_cancelHook();
+        }
+    }
+
+    /**
+     * @brief Returns true if cancel() has been called.
+     */
+    bool isCanceled() const
+    {
+        return m_canceled;
+    }
+
+    /**
+     * @brief Returns the progress of the read() from 0 to 1.
+     */
+    double progress() const
+    {
+        return m_progress;
+    }
+
+    /**
+     * @brief Sets the @a handler that is called whenever the progress of the
+     * read() advances.
+     *
+     * The handler is called on the thread that decodes the image, so it has
+     * to be quick. It may call cancel().
+     */
+    void setProgressHandler(std::function<void(double)> handler)
+    {
+        m_progressHandler = std::move(handler);
+    }
+
+    /**
+     * @brief Sets the @a hook that makes the decoder stop. The RawIOHandler
+     * installs it for as long as LibRaw is decoding.
+     */
+    void setCancelHook(std::function<void()> hook)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelHook = std::move(hook);
+    }
+
+    /**
+     * @brief Reports the @a progress of the read(). Called by the RawIOHandler.
+     */
+    void reportProgress(double progress)
+    {
+        m_progress = progress;
+        if (m_progressHandler)
+        {
+            m_progressHandler(progress);
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::function<void()> m_cancelHook;
+    std::function<void(double)> m_progressHandler;
+    std::atomic<bool> m_canceled{false};
+    std::atomic<double> m_progress{0.0};
+};
+
+Q_DECLARE_METATYPE(QSharedPointer<RawDecodeControl>)
+
+#endif // RAW_DECODE_CONTROL_H
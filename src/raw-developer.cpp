@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "datastream.h"
+#include "frame-packing.h"
+#include "libraw-pool.h"
+#include "raw-developer.h"
+#include "unpack-cache.h"
+
+#include <cmath>
+
+#include <QBuffer>
+#include <QDebug>
+#include <QFile>
+#include <QImage>
+#include <QString>
+
+#include "libraw.h"
+
+using namespace std;
+using namespace FramePacking;
+
+using ProcessedImage = unique_ptr<libraw_processed_image_t,
+                                  void(*)(libraw_processed_image_t*)>;
+
+/**
+ * @brief Private data of the RawDeveloper class - pimpl.
+ */
+class RawDeveloperPrivate
+{
+public:
+    /**
+     * @brief Opens the raw data on @a device and unpacks it.
+     * @returns true on success
+     */
+    bool unpack(QIODevice* device);
+
+    /**
+     * @brief Sets the parameters of dcraw_process() from @a parameters.
+     */
+    void setProcessParameters(const DevelopParameters& parameters);
+
+    /**
+     * @brief Sets the parameters of the conversion to 8 bit from
+     * @a parameters.
+     */
+    void setToneParameters(const DevelopParameters& parameters);
+
+    /**
+     * @brief Returns true if @a a and @a b lead to the same demosaiced image.
+     */
+    static bool sameProcessing(const DevelopParameters& a, const DevelopParameters& b);
+
+    /**
+     * @brief Gives LibRaw back to the pool before the data it reads from.
+     */
+    ~RawDeveloperPrivate();
+
+    /**
+     * @brief Gives the LibRaw instance back to the pool.
+     */
+    void releaseLibRaw();
+
+    // LibRaw is declared last, so it goes before the file, the datastream
+    // and the cached mosaic it reads from
+    unique_ptr<QFile> unpackedMapping;
+    unique_ptr<QFile> file;
+    unique_ptr<Datastream> stream;
+    QByteArray buffered;
+    unique_ptr<LibRaw> raw;
+    bool processed{};
+    DevelopParameters processedWith;
+};
+
+//============================================================================
+RawDeveloperPrivate::~RawDeveloperPrivate()
+{
+    releaseLibRaw();
+}
+
+//============================================================================
+void RawDeveloperPrivate::releaseLibRaw()
+{
+    LibRawPool::global().release(move(raw));
+    stream.reset(nullptr);
+    unpackedMapping.reset(nullptr);
+}
+
+//============================================================================
+bool RawDeveloperPrivate::unpack(QIODevice* device)
+{
+    releaseLibRaw();
+    raw = LibRawPool::global().acquire();
+    processed = false;
+
+    auto result = int{};
+    if (auto* buffer = qobject_cast<QBuffer*>(device))
+    {
+        buffered = buffer->data();
+        result = raw->open_buffer(const_cast<char*>(buffered.constData()),
+                                  size_t(buffered.size()));
+    }
+    else
+    {
+        stream = make_unique<Datastream>(device);
+        result = raw->open_datastream(stream.get());
+    }
+    if (result == LIBRAW_SUCCESS)
+    {
+        result = UnpackCache::global().unpack(device, raw.get(), &unpackedMapping);
+    }
+    if (result != LIBRAW_SUCCESS)
+    {
+        qCritical("Could not unpack the raw image: %s", libraw_strerror(result));
+        releaseLibRaw();
+        return false;
+    }
+    return true;
+}
+
+//============================================================================
+void RawDeveloperPrivate::setProcessParameters(const DevelopParameters& parameters)
+{
+    auto& params = raw->imgdata.params;
+    params.exp_correc = parameters.exposure != 0.0 ? 1 : 0;
+    params.exp_shift = float(qBound(0.25, pow(2.0, parameters.exposure), 8.0));
+    params.exp_preser = 0.0f;
+
+    const auto& multipliers = parameters.whiteBalance;
+    const auto userWhiteBalance = multipliers[0] > 0 && multipliers[1] > 0 &&
+                                  multipliers[2] > 0;
+    params.use_auto_wb = parameters.autoWhiteBalance ? 1 : 0;
+    params.use_camera_wb = (parameters.autoWhiteBalance || userWhiteBalance) ? 0 : 1;
+    for (size_t i = 0; i < multipliers.size(); ++i)
+    {
+        params.user_mul[i] = userWhiteBalance ? multipliers[i] : 0.0f;
+    }
+
+    params.highlight = parameters.highlightMode;
+    params.user_qual = parameters.demosaic;
+    params.output_color = parameters.colorSpace;
+    params.half_size = parameters.halfSize ? 1 : 0;
+}
+
+//============================================================================
+void RawDeveloperPrivate::setToneParameters(const DevelopParameters& parameters)
+{
+    auto& params = raw->imgdata.params;
+    params.bright = float(parameters.brightness);
+    params.no_auto_bright = parameters.autoBrightness ? 0 : 1;
+    if (parameters.gamma == 0.0)
+    {
+        params.gamm[0] = 1.0 / 2.222;
+        params.gamm[1] = 4.5;
+    }
+    else if (parameters.gamma == 1.0)
+    {
+        params.gamm[0] = 1.0;
+        params.gamm[1] = 1.0;
+    }
+    else
+    {
+        params.gamm[0] = 1.0 / parameters.gamma;
+        params.gamm[1] = 0.0;
+    }
+}
+
+//============================================================================
+bool RawDeveloperPrivate::sameProcessing(const DevelopParameters& a,
+                                         const DevelopParameters& b)
+{
+    return a.exposure == b.exposure && a.whiteBalance == b.whiteBalance &&
+           a.autoWhiteBalance == b.autoWhiteBalance &&
+           a.highlightMode == b.highlightMode && a.demosaic == b.demosaic &&
+           a.colorSpace == b.colorSpace && a.halfSize == b.halfSize;
+}
+
+//============================================================================
+RawDeveloper::RawDeveloper() :
+    d(make_unique<RawDeveloperPrivate>())
+{
+}
+
+//============================================================================
+RawDeveloper::~RawDeveloper() = default;
+
+//============================================================================
+bool RawDeveloper::open(const QString& fileName)
+{
+    // the previous file may still be read by LibRaw
+    d->releaseLibRaw();
+    d->file = make_unique<QFile>(fileName);
+    if (!d->file->open(QIODevice::ReadOnly))
+    {
+        qCritical() << "Could not open" << fileName << ":" << d->file->errorString();
+        return false;
+    }
+    return d->unpack(d->file.get());
+}
+
+//============================================================================
+bool RawDeveloper::open(QIODevice* device)
+{
+    if (!device)
+    {
+        return false;
+    }
+    return d->unpack(device);
+}
+
+//============================================================================
+bool RawDeveloper::isOpen() const
+{
+    return d->raw != nullptr;
+}
+
+//============================================================================
+QSize RawDeveloper::size() const
+{
+    if (!d->raw)
+    {
+        return QSize();
+    }
+    const auto& sizes = d->raw->imgdata.sizes;
+    auto size = QSize(sizes.width, sizes.height);
+    if (sizes.flip & 4)
+    {
+        size.transpose();
+    }
+    return size;
+}
+
+//============================================================================
+bool RawDeveloper::develop(const DevelopParameters& parameters,
+                           const QSize& targetSize, QImage* image)
+{
+    if (!d->raw)
+    {
+        return false;
+    }
+
+    // LibRaw demosaics from the unpacked raw data on every dcraw_process(),
+    // so it is only needed if more than the tone has changed
+    if (!d->processed || !RawDeveloperPrivate::sameProcessing(parameters, d->processedWith))
+    {
+        d->setProcessParameters(parameters);
+        const auto ErrorCode = d->raw->dcraw_process();
+        if (ErrorCode != LIBRAW_SUCCESS)
+        {
+            qCritical("Could not process the raw image: %s", libraw_strerror(ErrorCode));
+            d->processed = false;
+            return false;
+        }
+        d->processed = true;
+        d->processedWith = parameters;
+    }
+    d->setToneParameters(parameters);
+
+    auto width = 0;
+    auto height = 0;
+    auto colors = 0;
+    auto bps = 0;
+    d->raw->get_mem_image_format(&width, &height, &colors, &bps);
+    const auto size = targetSize.isValid() ? targetSize : QSize(width, height);
+    if (QSize(width, height) == size && bps == 8 && (colors == 1 || colors == 3))
+    {
+        prepareTarget(image, size);
+        if (image->isNull())
+        {
+            return false;
+        }
+        return renderInto(d->raw.get(), colors, image) == LIBRAW_SUCCESS;
+    }
+
+    auto ErrorCode = int{};
+    ProcessedImage output(d->raw->dcraw_make_mem_image(&ErrorCode),
+                          &LibRaw::dcraw_clear_mem);
+    if (!output || ErrorCode != LIBRAW_SUCCESS)
+    {
+        qCritical("Could not convert the raw image: %s", libraw_strerror(ErrorCode));
+        return false;
+    }
+    return packBitmap(*output, size, QImageIOHandler::TransformationNone, image);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RAW_DEVELOPER_H
+#define RAW_DEVELOPER_H
+
+#include "qtraw-export.h"
+
+#include <QSize>
+#include <QtGlobal>
+
+#include <array>
+#include <memory>
+
+class QImage;
+class QIODevice;
+class QString;
+
+class RawDeveloperPrivate;
+
+/**
+ * @brief The parameters of RawDeveloper::develop().
+ *
+ * The tone parameters (brightness, autoBrightness and gamma) only affect the
+ * final conversion to 8 bit. Changing nothing but them reuses the demosaiced
+ * image of the previous develop().
+ */
+struct DevelopParameters
+{
+    /**
+     * The exposure correction in EV, applied before demosaicing (-2 to +3).
+     */
+    double exposure{0.0};
+
+    /**
+     * The white balance multipliers for R, G, B and the second G. All zeros
+     * select the white balance of the camera.
+     */
+    std::array<float, 4> whiteBalance{{0.0f, 0.0f, 0.0f, 0.0f}};
+
+    /**
+     * Compute the white balance from the image instead.
+     */
+    bool autoWhiteBalance{false};
+
+    /**
+     * LibRaw's highlight mode: 0 clips, 1 leaves the highlights unclipped,
+     * 2 blends them and 3 to 9 rebuild them.
+     */
+    int highlightMode{0};
+
+    /**
+     * LibRaw's demosaic algorithm (user_qual), or -1 for its default.
+     */
+    int demosaic{-1};
+
+    /**
+     * The RawIOHandler::OutputColorSpace of the output.
+     */
+    int colorSpace{1};
+
+    /**
+     * Demosaic at half the size, which is a lot faster.
+     */
+    bool halfSize{false};
+
+    /**
+     * The brightness the image is scaled with.
+     */
+    double brightness{1.0};
+
+    /**
+     * Scale the brightness so that a small fraction of the pixels clips.
+     */
+    bool autoBrightness{true};
+
+    /**
+     * The power of the output curve, or 0 for LibRaw's default BT.709 curve.
+     */
+    double gamma{0.0};
+};
+
+/**
+ * @brief The RawDeveloper class develops a raw image over and over with
+ * different parameters, as an editor does.
+ *
+ * Unlike the RawIOHandler, which decodes an image once, the developer opens
+ * and unpacks the raw data only once and keeps it. Every develop() then only
+ * runs the processing that its parameters require.
+ */
+class QTRAW_EXPORT RawDeveloper
+{
+public:
+    /**
+     * @brief Construct a new RawDeveloper.
+     */
+    RawDeveloper();
+
+    /**
+     * @brief Destruct the RawDeveloper and release the raw data.
+     */
+    ~RawDeveloper();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(RawDeveloper);
+    RawDeveloper(const RawDeveloper&& rhs) = delete;
+    RawDeveloper& operator=(const RawDeveloper&& rhs) = delete;
+
+    /**
+     * @brief Opens and unpacks the raw file @a fileName.
+     * @returns true on success
+     */
+    bool open(const QString& fileName);
+
+    /**
+     * @brief Opens and unpacks the raw image on @a device, which has to stay
+     * open as long as the RawDeveloper uses it.
+     * @returns true on success
+     */
+    bool open(QIODevice* device);
+
+    /**
+     * @brief Returns true if a raw image has been unpacked.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Returns the size of the developed image, i.e. the size of
+     * develop() without a target size.
+     */
+    QSize size() const;
+
+    /**
+     * @brief Develops the raw image with the given @a parameters into
+     * @a image, scaled to @a targetSize.
+     *
+     * The buffer of @a image is reused if it already has the right size and
+     * is not shared.
+     * @returns true on success
+     */
+    bool develop(const DevelopParameters& parameters, const QSize& targetSize,
+                 QImage* image);
+
+private:
+    std::unique_ptr<RawDeveloperPrivate> d;
+};
+
+#endif // RAW_DEVELOPER_H
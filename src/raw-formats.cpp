@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "raw-formats.h"
+
+#include <array>
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QtEndian>
+
+using namespace std;
+
+namespace
+{
+/**
+ * @brief Describes a supported raw format.
+ */
+struct RawFormat
+{
+    const char* key;
+    const char* mimeType;
+};
+
+/**
+ * @brief The table of all supported raw formats, generated by qmake from
+ * raw-formats.txt.
+ */
+const RawFormat formats[] = {
+#include "raw-formats.inc"
+};
+
+/**
+ * @brief The number of bytes at the start of a TIFF file that are inspected
+ * by isRawTiff().
+ */
+constexpr qint64 TiffPeekSize = 64 * 1024;
+
+/**
+ * @brief Makers of cameras that write TIFF based raw formats, in upper case.
+ */
+const auto cameraMakers = array<QByteArray, 20>{{
+    "CANON", "EASTMAN KODAK", "EPSON", "FUJIFILM", "HASSELBLAD",
+    "KODAK", "KONICA MINOLTA", "LEAF", "LEICA", "MAMIYA",
+    "MINOLTA", "NIKON", "OLYMPUS", "PANASONIC", "PENTAX",
+    "PHASE ONE", "RICOH", "SAMSUNG", "SEIKO EPSON", "SONY"
+}};
+
+/**
+ * @brief TIFF tags that are used by isRawTiff().
+ */
+enum TiffTag : quint16
+{
+    BitsPerSample = 258,
+    Compression = 259,
+    PhotometricInterpretation = 262,
+    Make = 271,
+    SubIFDs = 330,
+    DNGVersion = 50706
+};
+
+/**
+ * @brief PhotometricInterpretation values of raw sensor data.
+ */
+enum Photometric : quint16
+{
+    CFA = 32803,
+    LinearRaw = 34892
+};
+}
+
+//============================================================================
+QStringList RawFormats::keys()
+{
+    static const auto keys = []
+                             {
+                                 auto result = QStringList{};
+                                 for (const auto& format : formats)
+                                 {
+                                     result << QLatin1String(format.key);
+                                 }
+                                 return result;
+                             }();
+    return keys;
+}
+
+//============================================================================
+QStringList RawFormats::mimeTypes()
+{
+    static const auto mimeTypes = []
+                                  {
+                                      auto result = QStringList{};
+                                      for (const auto& format : formats)
+                                      {
+                                          result << QLatin1String(format.mimeType);
+                                      }
+                                      return result;
+                                  }();
+    return mimeTypes;
+}
+
+//============================================================================
+bool RawFormats::hasRawSignature(const QByteArray& header)
+{
+    static const auto signatures = array<QByteArray, 9>{{
+        QByteArrayLiteral("II*\0"),       // TIFF based formats
+        QByteArrayLiteral("MM\0*"),
+        QByteArrayLiteral("IIRO"),        // Olympus ORF
+        QByteArrayLiteral("IIRS"),
+        QByteArrayLiteral("IIU\0"),       // Panasonic RW2
+        QByteArrayLiteral("FUJIFILM"),    // Fuji RAF
+        QByteArrayLiteral("FOVb"),        // Sigma X3F
+        QByteArrayLiteral("\0MRM"),       // Minolta MRW
+        QByteArrayLiteral("ARRI")
+    }};
+    for (const auto& signature : signatures)
+    {
+        if (header.startsWith(signature))
+        {
+            return true;
+        }
+    }
+    // Canon CRW and CR3
+    return header.mid(6, 8) == "HEAPCCDR" || header.mid(4, 8) == "ftypcrx ";
+}
+
+//============================================================================
+bool RawFormats::isRawTiff(QIODevice* device)
+{
+    const auto header = device->peek(TiffPeekSize);
+    const auto size = quint32(header.size());
+    const auto* data = reinterpret_cast<const uchar*>(header.constData());
+
+    const auto littleEndian = header.startsWith(QByteArrayLiteral("II*\0"));
+    if (size < 16 || (!littleEndian && !header.startsWith(QByteArrayLiteral("MM\0*"))))
+    {
+        return false;
+    }
+    if (header.mid(8, 2) == "CR")
+    {
+        // Canon CR2
+        return true;
+    }
+
+    const auto u16 = [data, littleEndian](quint32 offset)
+    {
+        return littleEndian ? qFromLittleEndian<quint16>(data + offset)
+                            : qFromBigEndian<quint16>(data + offset);
+    };
+    const auto u32 = [data, littleEndian](quint32 offset)
+    {
+        return littleEndian ? qFromLittleEndian<quint32>(data + offset)
+                            : qFromBigEndian<quint32>(data + offset);
+    };
+    //------------------------------------------------------------------------
+
+    const auto ifd = u32(4);
+    if (ifd > size - 2)
+    {
+        // regular TIFF writers often put the first IFD at the very end
+        return false;
+    }
+
+    auto make = QByteArray{};
+    auto bitsPerSample = 0;
+    auto compression = 0;
+    auto photometric = 0;
+    auto hasSubIfds = false;
+    const auto count = u16(ifd);
+    for (quint32 i = 0; i < count; ++i)
+    {
+        const auto entry = ifd + 2 + i * 12;
+        if (entry > size - 12)
+        {
+            break;
+        }
+        const auto valueCount = u32(entry + 4);
+        switch (u16(entry))
+        {
+        case DNGVersion:
+            return true;
+
+        case SubIFDs:
+            hasSubIfds = true;
+            break;
+
+        case Compression:
+            compression = u16(entry + 8);
+            break;
+
+        case PhotometricInterpretation:
+            photometric = u16(entry + 8);
+            break;
+
+        case BitsPerSample:
+        {
+            const auto offset = valueCount > 2 ? u32(entry + 8) : entry + 8;
+            if (offset <= size - 2)
+            {
+                bitsPerSample = u16(offset);
+            }
+            break;
+        }
+
+        case Make:
+        {
+            const auto offset = valueCount > 4 ? u32(entry + 8) : entry + 8;
+            if (offset < size && valueCount <= size - offset)
+            {
+                make = header.mid(int(offset), int(valueCount)).toUpper();
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    auto fromCameraMaker = false;
+    for (const auto& maker : cameraMakers)
+    {
+        fromCameraMaker |= make.startsWith(maker);
+    }
+
+    // Cameras also write plain 8 bit RGB TIFFs, so the maker alone is not
+    // enough to tell raw data from a regular image
+    return fromCameraMaker &&
+           (hasSubIfds || photometric == CFA || photometric == LinearRaw ||
+            compression >= 32767 || bitsPerSample > 8);
+}
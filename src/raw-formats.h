@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RAW_FORMATS_H
+#define RAW_FORMATS_H
+
+#include "qtraw-export.h"
+
+#include <QStringList>
+
+class QByteArray;
+class QIODevice;
+
+/**
+ * @brief The RawFormats namespace knows about the raw formats that QtRaw
+ * supports.
+ *
+ * The list of formats is generated from raw-formats.txt, which is also the
+ * source of the plugin metadata.
+ */
+namespace RawFormats
+{
+/**
+ * @brief Returns the keys, i.e. the file name extensions, of all supported
+ * raw formats.
+ */
+QTRAW_EXPORT QStringList keys();
+
+/**
+ * @brief Returns the MIME types of all supported raw formats in the same
+ * order as keys().
+ */
+QTRAW_EXPORT QStringList mimeTypes();
+
+/**
+ * @brief Checks if @a header starts with the signature of a raw format.
+ *
+ * This is a lot less thorough than letting LibRaw identify the data, but it
+ * only needs the first few bytes.
+ */
+QTRAW_EXPORT bool hasRawSignature(const QByteArray& header);
+
+/**
+ * @brief Checks if the TIFF file on @a device is a raw file rather than a
+ * regular TIFF image.
+ *
+ * Only the first IFD is inspected, using peek(), so the device is left
+ * untouched. This is cheap enough to decide whether QtRaw should claim a
+ * ".tif" file or leave it to the TIFF plugin.
+ */
+QTRAW_EXPORT bool isRawTiff(QIODevice* device);
+}
+
+#endif // RAW_FORMATS_H
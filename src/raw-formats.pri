@@ -0,0 +1,17 @@
+# raw-formats.txt is the single list of the supported raw formats, one
+# "<key> <mime type>" pair per line. The format table behind RawFormats is
+# generated from it in qtraw-core.pro, the plugin metadata (raw.json) and the
+# KDE service file in src.pro, so re-run qmake after changing it.
+RAW_KEYS =
+RAW_MIMETYPES =
+RAW_FORMATS_TABLE =
+RAW_DESKTOP_MIMETYPES =
+for(line, $$list($$cat($$PWD/raw-formats.txt, lines))) {
+    fields = $$split(line, " ")
+    key = $$first(fields)
+    mime = $$last(fields)
+    RAW_KEYS += "\"$$key\""
+    RAW_MIMETYPES += "\"$$mime\""
+    RAW_FORMATS_TABLE += "{\"$$key\", \"$$mime\"},"
+    RAW_DESKTOP_MIMETYPES += $$mime
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "datastream.h"
+#include "raw-header.h"
+
+#include <QIODevice>
+
+#include "libraw.h"
+
+using namespace std;
+
+//============================================================================
+RawHeaderReader::RawHeaderReader() :
+    m_raw(make_unique<LibRaw>())
+{
+}
+
+//============================================================================
+RawHeaderReader::~RawHeaderReader() = default;
+
+//============================================================================
+bool RawHeaderReader::read(QIODevice* device, RawHeader* header)
+{
+    // LibRaw only reads the parts of the file it needs to identify it, so
+    // nothing but the header is ever loaded
+    Datastream stream(device);
+    const auto result = m_raw->open_datastream(&stream);
+    if (result != LIBRAW_SUCCESS)
+    {
+        m_error = QString::fromLatin1(libraw_strerror(result));
+        m_raw->recycle();
+        return false;
+    }
+
+    const auto& data = m_raw->imgdata;
+    header->size = QSize(data.sizes.width, data.sizes.height);
+    header->orientation = data.sizes.flip;
+    header->make = QString::fromLatin1(data.idata.make).trimmed();
+    header->model = QString::fromLatin1(data.idata.model).trimmed();
+    header->lens = QString::fromLatin1(data.lens.Lens).trimmed();
+    header->isoSpeed = data.other.iso_speed;
+    header->shutter = data.other.shutter;
+    header->aperture = data.other.aperture;
+    header->focalLength = data.other.focal_len;
+    header->timestamp = data.other.timestamp > 0 ?
+                        QDateTime::fromSecsSinceEpoch(qint64(data.other.timestamp)) :
+                        QDateTime();
+
+    const auto& thumbnail = data.thumbnail;
+    const auto hasPreview = thumbnail.tlength > 0;
+    header->previewOffset = hasPreview ?
+                            qint64(m_raw->get_internal_data_pointer()->internal_data.toffset) : 0;
+    header->previewLength = hasPreview ? qint64(thumbnail.tlength) : 0;
+    header->previewSize = QSize(thumbnail.twidth, thumbnail.theight);
+    switch (thumbnail.tformat)
+    {
+    case LIBRAW_THUMBNAIL_JPEG:
+        header->previewFormat = "jpeg";
+        break;
+
+    case LIBRAW_THUMBNAIL_BITMAP:
+        header->previewFormat = "bitmap";
+        break;
+
+    default:
+        header->previewFormat = hasPreview ? "other" : "";
+        break;
+    }
+
+    // the datastream goes out of scope, so LibRaw must let go of it
+    m_raw->recycle();
+    m_error.clear();
+    return true;
+}
+
+//============================================================================
+QString RawHeaderReader::errorString() const
+{
+    return m_error;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RAW_HEADER_H
+#define RAW_HEADER_H
+
+#include "qtraw-export.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QSize>
+#include <QString>
+
+#include <memory>
+
+class QIODevice;
+
+class LibRaw;
+
+/**
+ * @brief The metadata of a raw file that LibRaw finds in its header, without
+ * unpacking the raw data.
+ */
+struct RawHeader
+{
+    /**
+     * The size of the raw image before the orientation is applied.
+     */
+    QSize size;
+
+    /**
+     * LibRaw's flip: 0 is unrotated, 3 upside down, 5 rotated 90 degrees
+     * counterclockwise and 6 rotated 90 degrees clockwise.
+     */
+    int orientation{};
+
+    QString make;
+    QString model;
+    QString lens;
+
+    float isoSpeed{};
+
+    /**
+     * The exposure time in seconds.
+     */
+    float shutter{};
+
+    float aperture{};
+
+    /**
+     * The focal length in mm.
+     */
+    float focalLength{};
+
+    QDateTime timestamp;
+
+    /**
+     * The location of the embedded preview in the file, or 0 if there is
+     * none.
+     */
+    qint64 previewOffset{};
+    qint64 previewLength{};
+    QSize previewSize;
+
+    /**
+     * The format of the embedded preview: "jpeg", "bitmap" or "other".
+     */
+    QByteArray previewFormat;
+};
+
+/**
+ * @brief The RawHeaderReader class reads the RawHeader of many files, one
+ * after the other.
+ *
+ * Constructing a LibRaw object is expensive, so the reader keeps one and
+ * recycles it between files. Use one RawHeaderReader per thread.
+ */
+class QTRAW_EXPORT RawHeaderReader
+{
+public:
+    /**
+     * @brief Construct a new RawHeaderReader.
+     */
+    RawHeaderReader();
+
+    /**
+     * @brief Destruct the RawHeaderReader.
+     */
+    ~RawHeaderReader();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(RawHeaderReader);
+    RawHeaderReader(const RawHeaderReader&& rhs) = delete;
+    RawHeaderReader& operator=(const RawHeaderReader&& rhs) = delete;
+
+    /**
+     * @brief Reads the header of the raw file on @a device into @a header.
+     * @returns true on success
+     * @returns false if LibRaw could not identify the file, see errorString()
+     */
+    bool read(QIODevice* device, RawHeader* header);
+
+    /**
+     * @brief Returns why the last read() failed.
+     */
+    QString errorString() const;
+
+private:
+    std::unique_ptr<LibRaw> m_raw;
+    QString m_error;
+};
+
+#endif // RAW_HEADER_H
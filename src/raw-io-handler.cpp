@@ -19,17 +19,71 @@
  */
 
 #include "datastream.h"
+#include "decode-metrics.h"
+#include "device-spool.h"
+#include "frame-packing.h"
+#include "libraw-pool.h"
+#include "preview-locator.h"
+#include "raw-decode-control.h"
+#include "raw-formats.h"
 #include "raw-io-handler.h"
+#include "unpack-cache.h"
 
-#include <array>
+#include <algorithm>
+#include <limits>
 
+#include <QBuffer>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#include <QColorSpace>
+#endif
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
 #include <QImage>
+#include <QImageReader>
+#include <QIODevice>
+#include <QMap>
+#include <QSharedPointer>
+#include <QStringList>
 #include <QVariant>
 
 #include "libraw.h"
 
 using namespace std;
+using namespace FramePacking;
+
+using ProcessedImage = unique_ptr<libraw_processed_image_t,
+                                  void(*)(libraw_processed_image_t*)>;
+
+/**
+ * @brief Keeps track of the large buffers that are alive during a read() to
+ * measure its peak memory usage. A buffer that outlives the read releases its
+ * bytes when it is freed.
+ */
+class MemoryUsage
+{
+public:
+    void acquire(qint64 bytes)
+    {
+        m_current += bytes;
+        m_peak = qMax(m_peak, m_current);
+    }
+
+    void release(qint64 bytes)
+    {
+        m_current -= bytes;
+    }
+
+    qint64 peak() const
+    {
+        return m_peak;
+    }
+
+private:
+    qint64 m_current{};
+    qint64 m_peak{};
+};
 
 /**
  * @brief Private data of the RawIOHandler class - pimpl.
@@ -43,7 +97,10 @@ public:
         q(qq)
     {}
 
-    ~RawIOHandlerPrivate() = default;
+    ~RawIOHandlerPrivate()
+    {
+        releaseLibRaw();
+    }
 
     Q_DISABLE_COPY(RawIOHandlerPrivate);
     RawIOHandlerPrivate(const RawIOHandlerPrivate&& rhs) = delete;
@@ -56,215 +113,1316 @@ public:
      */
     bool openDatastream(QIODevice* device);
 
-    unique_ptr<LibRaw> raw;
-    unique_ptr<Datastream> stream;
-    QSize defaultSize;
-    QSize scaledSize;
-    mutable RawIOHandler* q;
-};
+    /**
+     * @brief Lets the open LibRaw instance identify the current @b frame from
+     * the already open datastream or spool.
+     *
+     * LibRaw resolves the selected shot while it identifies the file, so the
+     * header has to be parsed again for every frame. The data itself is
+     * neither reopened nor read again.
+     * @returns true on success
+     */
+    bool openFrame(QIODevice* device);
+
+    /**
+     * @brief Returns the data of the device if it is in memory already, i.e.
+     * the spool of a sequential device or the data of a QBuffer, or nullptr.
+     * The number of bytes is stored in @a size.
+     */
+    const uchar* memoryData(qint64* size) const;
+
+    /**
+     * @brief Returns a view of the embedded JPEG preview in memoryData(), or
+     * an empty array if the preview isn't a JPEG or not in memory.
+     */
+    QByteArray embeddedJpeg() const;
+
+    /**
+     * @brief Destroys the LibRaw instance together with all of its buffers.
+     *
+     * The next access to the image data has to reopen the device.
+     */
+    void releaseLibRaw();
+
+    /**
+     * @brief Connects the RawDecodeControl of the raw options, if any, to
+     * LibRaw for the duration of a read().
+     * @returns false if the read() has been canceled already
+     */
+    bool attachControl();
+
+    /**
+     * @brief Disconnects the RawDecodeControl from LibRaw.
+     */
+    void detachControl();
+
+    /**
+     * @brief Returns true if the current read() has been canceled.
+     */
+    bool isCanceled() const;
+
+    /**
+     * @brief Checks the result @a ErrorCode of the LibRaw decoding step
+     * @a step.
+     * @returns true if the step succeeded
+     */
+    bool checkStep(int ErrorCode, const char* step) const;
+
+    /**
+     * @brief Returns the statistics the packing pass accumulates into, or
+     * nullptr if they haven't been requested.
+     */
+    ImageStatistics* statisticsTarget();
+
+    /**
+     * @brief Accounts for @a bytes of memory that are owned by LibRaw.
+     */
+    void acquireLibRawMemory(qint64 bytes);
+
+    /**
+     * @brief Returns the value of the RawOption @a option.
+     */
+    QVariant rawOption(RawIOHandler::RawOption option) const;
+
+    /**
+     * @brief Returns true if the orientation of the camera is applied to the
+     * decoded pixels.
+     */
+    bool applyOrientation() const;
+
+    /**
+     * @brief Returns the requested RawIOHandler::ImageSource.
+     */
+    int imageSource() const;
+
+    /**
+     * @brief Returns true if the embedded preview has been requested and the
+     * current frame has one.
+     */
+    bool previewOnly() const;
+
+    /**
+     * @brief Returns the size of the decoded image, which is transposed if the
+     * orientation swaps width and height.
+     */
+    QSize outputSize() const;
+
+    /**
+     * @brief Returns the requested RawIOHandler::OutputColorSpace, or 0 if
+     * the default of LibRaw should be used.
+     */
+    int outputColorSpace() const;
+
+    /**
+     * @brief Returns the power of the output curve for the color space
+     * @a space. A power of 0 stands for the sRGB curve.
+     */
+    double outputGamma(int space) const;
+
+    /**
+     * @brief Sets the output color space and curve of LibRaw according to
+     * the raw options, so the conversion happens in dcraw_process().
+     */
+    void applyOutputColor();
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    /**
+     * @brief Tags @a image with the color space of the output.
+     *
+     * A @a thumbnail carries its own color space, so it is converted if a
+     * different color space has been requested explicitly.
+     */
+    void tagColorSpace(QImage* image, bool thumbnail) const;
+#endif
+
+    /**
+     * @brief Reads the embedded thumbnail into @a image, scaled to @a size.
+     */
+    bool readThumbnail(const QSize& size, QImage* image);
+
+    /**
+     * @brief Looks for the JPEG preview of a TIFF based file on @a device
+     * with a PreviewLocator, once, and keeps it in locatedPreview.
+     * @returns true if there is such a preview
+     */
+    bool locatePreview(QIODevice* device);
+
+    /**
+     * @brief Reads the located preview of the file on @a device into
+     * @a image without ever opening LibRaw, if the requested source allows
+     * it. This only happens as long as LibRaw hasn't identified the file.
+     * @returns false if the image has to be read through LibRaw
+     */
+    bool readLocatedPreview(QIODevice* device, QImage* image);
+
+    /**
+     * @brief Tags the successfully read @a image with its color space and
+     * the text keys. @a thumbnail tells if it is the embedded preview.
+     */
+    void finishRead(QImage* image, bool thumbnail);
+
+    /**
+     * @brief Decodes the raw data into @a image, scaled to @a size.
+     */
+    bool readRawData(const QSize& size, QImage* image);
+
+    /**
+     * @brief Unpacks the raw data and returns its visible area in @a image,
+     * without any processing.
+     */
+    bool readMosaic(QImage* image);
+
+    /**
+     * @brief Adds the black and white levels, the CFA pattern and the color
+     * matrices of the unpacked raw data to the text keys.
+     */
+    void addMosaicText();
+
+    unique_ptr<LibRaw> raw;
+    unique_ptr<QFile> unpackedMapping;
+    unique_ptr<Datastream> stream;
+    unique_ptr<DeviceSpool> spool;
+    unique_ptr<PreviewLocator> locator;
+    EmbeddedPreview locatedPreview;
+    QByteArray buffered;
+    QSize defaultSize;
+    QSize previewSize;
+    QSize scaledSize;
+    int orientation{};
+    int frame{};
+    int frameCount{};
+    QHash<int, QVariant> rawOptions;
+    QMap<QString, QString> text;
+    QSharedPointer<MemoryUsage> memory{QSharedPointer<MemoryUsage>::create()};
+    qint64 libRawMemory{};
+    QSharedPointer<RawDecodeControl> control;
+    ImageStatistics statistics;
+    mutable RawIOHandler* q;
+};
+//============================================================================
+bool RawIOHandlerPrivate::openDatastream(QIODevice* device)
+{
+    if (!device)
+    {
+        return false;
+    }
+
+    if (!device->isSequential())
+    {
+        device->seek(0);
+    }
+    if (raw)
+    {
+        return true;
+    }
+
+    if (auto* buffer = qobject_cast<QBuffer*>(device))
+    {
+        // A shallow copy keeps the data alive even if the buffer is changed
+        buffered = buffer->data();
+    }
+    else if (device->isSequential() && !spool)
+    {
+        // A sequential device can only be read once, so we spool it and
+        // serve LibRaw from the spool
+        const auto limit = rawOption(RawIOHandler::SpoolMemoryLimit);
+        spool = make_unique<DeviceSpool>(device, limit.isValid() ?
+                                         limit.toLongLong() :
+                                         DeviceSpool::DefaultMemoryLimit);
+        if (!spool->spool())
+        {
+            qCritical("Could not spool the sequential device");
+            spool.reset(nullptr);
+            return false;
+        }
+    }
+
+    raw = LibRawPool::global().acquire();
+    if (!openFrame(device))
+    {
+        LibRawPool::global().release(move(raw));
+        stream.reset(nullptr);
+        return false;
+    }
+    frameCount = qMax(1, int(raw->imgdata.idata.raw_count));
+    return true;
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::openFrame(QIODevice* device)
+{
+    raw->imgdata.params.shot_select = unsigned(frame);
+    // the orientation of the file, not the one a previous read asked for
+    raw->imgdata.params.user_flip = -1;
+
+    // LibRaw reads data in memory directly instead of through the virtual
+    // functions of a datastream
+    StageClock clock;
+    auto result = int{};
+    auto size = qint64{};
+    if (const auto* data = memoryData(&size))
+    {
+        // the datastream counts what LibRaw reads, a buffer is counted whole
+        DecodeMetrics::global().recordBytesRead(size);
+        result = raw->open_buffer(const_cast<uchar*>(data), size_t(size));
+    }
+    else
+    {
+        if (!stream)
+        {
+            stream = make_unique<Datastream>(spool ? spool->file() : device);
+        }
+        result = raw->open_datastream(stream.get());
+    }
+    if (result != LIBRAW_SUCCESS)
+    {
+        DecodeMetrics::global().recordLibRawError(result);
+        return false;
+    }
+    clock.lap(DecodeMetrics::OpenStage);
+
+    defaultSize = QSize(raw->imgdata.sizes.width,
+                        raw->imgdata.sizes.height);
+    previewSize = QSize(raw->imgdata.thumbnail.twidth,
+                        raw->imgdata.thumbnail.theight);
+    orientation = raw->imgdata.sizes.flip;
+    return true;
+}
+
+//============================================================================
+const uchar* RawIOHandlerPrivate::memoryData(qint64* size) const
+{
+    if (!buffered.isNull())
+    {
+        *size = buffered.size();
+        return reinterpret_cast<const uchar*>(buffered.constData());
+    }
+    if (spool && spool->data())
+    {
+        *size = spool->size();
+        return spool->data();
+    }
+    *size = 0;
+    return nullptr;
+}
+
+//============================================================================
+QByteArray RawIOHandlerPrivate::embeddedJpeg() const
+{
+    auto size = qint64{};
+    const auto* data = memoryData(&size);
+    const auto offset = qint64(raw->get_internal_data_pointer()->internal_data.toffset);
+    const auto length = qint64(raw->imgdata.thumbnail.tlength);
+    if (!data || offset <= 0 || length < 2 || offset + length > size ||
+        length > qint64(numeric_limits<int>::max()))
+    {
+        return QByteArray();
+    }
+
+    // previews that need conversion by LibRaw don't start with an SOI marker
+    const auto* jpeg = data + offset;
+    if (jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+    {
+        return QByteArray();
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(jpeg), int(length));
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::applyOrientation() const
+{
+    // rotating a mosaic would scramble its CFA pattern
+    if (imageSource() == RawIOHandler::MosaicSource)
+    {
+        return false;
+    }
+    const auto value = rawOption(RawIOHandler::ApplyOrientation);
+    return !value.isValid() || value.toBool();
+}
+
+//============================================================================
+int RawIOHandlerPrivate::imageSource() const
+{
+    const auto value = rawOption(RawIOHandler::Source);
+    auto ok = false;
+    const auto source = value.toInt(&ok);
+    if (ok)
+    {
+        return source;
+    }
+
+    static const auto names = QHash<QString, int>{
+        {QStringLiteral("preview"), RawIOHandler::PreviewSource},
+        {QStringLiteral("raw"), RawIOHandler::RawSource},
+        {QStringLiteral("cfa"), RawIOHandler::MosaicSource}
+    };
+    return names.value(value.toString().toLower(), RawIOHandler::AutoSource);
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::previewOnly() const
+{
+    // the embedded preview only ever shows the first frame
+    return imageSource() == RawIOHandler::PreviewSource && frame == 0 &&
+           !previewSize.isEmpty();
+}
+
+//============================================================================
+QSize RawIOHandlerPrivate::outputSize() const
+{
+    const auto size = previewOnly() ? previewSize : defaultSize;
+
+    // bit 2 of LibRaw's flip swaps the axes
+    return (applyOrientation() && (orientation & 4)) ? size.transposed() : size;
+}
+
+//============================================================================
+int RawIOHandlerPrivate::outputColorSpace() const
+{
+    const auto value = rawOption(RawIOHandler::ColorSpace);
+    auto ok = false;
+    const auto space = value.toInt(&ok);
+    if (ok)
+    {
+        return (space >= RawIOHandler::SRgb && space <= RawIOHandler::Xyz) ? space : 0;
+    }
+
+    static const auto names = QHash<QString, int>{
+        {QStringLiteral("srgb"), RawIOHandler::SRgb},
+        {QStringLiteral("adobe-rgb"), RawIOHandler::AdobeRgb},
+        {QStringLiteral("wide-gamut-rgb"), RawIOHandler::WideGamutRgb},
+        {QStringLiteral("prophoto-rgb"), RawIOHandler::ProPhotoRgb},
+        {QStringLiteral("xyz"), RawIOHandler::Xyz}
+    };
+    return names.value(value.toString().toLower(), 0);
+}
+
+//============================================================================
+double RawIOHandlerPrivate::outputGamma(int space) const
+{
+    const auto value = rawOption(RawIOHandler::Gamma);
+    if (value.isValid() && value.toDouble() > 0)
+    {
+        return value.toDouble();
+    }
+
+    // the native curve of the color space
+    switch (space)
+    {
+    case RawIOHandler::AdobeRgb:
+    case RawIOHandler::WideGamutRgb:
+        return 563.0 / 256.0;
+
+    case RawIOHandler::ProPhotoRgb:
+        return 1.8;
+
+    case RawIOHandler::Xyz:
+        return 1.0;
+
+    default:
+        return 0.0;
+    }
+}
+
+//============================================================================
+void RawIOHandlerPrivate::applyOutputColor()
+{
+    // Without options this is sRGB with the sRGB curve instead of LibRaw's
+    // default BT.709 curve, so the pixels match the QColorSpace they are
+    // tagged with
+    auto& params = raw->imgdata.params;
+    const auto space = outputColorSpace();
+    const auto gamma = outputGamma(space);
+    params.output_color = space ? space : RawIOHandler::SRgb;
+    if (gamma == 0.0)
+    {
+        params.gamm[0] = 1.0 / 2.4;
+        params.gamm[1] = 12.92;
+    }
+    else if (gamma == 1.0)
+    {
+        params.gamm[0] = 1.0;
+        params.gamm[1] = 1.0;
+    }
+    else
+    {
+        params.gamm[0] = 1.0 / gamma;
+        params.gamm[1] = 0.0;
+    }
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+//============================================================================
+void RawIOHandlerPrivate::tagColorSpace(QImage* image, bool thumbnail) const
+{
+    const auto space = outputColorSpace();
+    const auto explicitColor = rawOption(RawIOHandler::ColorSpace).isValid() ||
+                               rawOption(RawIOHandler::Gamma).isValid();
+    if (thumbnail && !explicitColor)
+    {
+        return;
+    }
+
+    const auto gamma = explicitColor ? outputGamma(space) : 0.0;
+    const auto transferFunction = gamma == 0.0 ? QColorSpace::TransferFunction::SRgb :
+                                  gamma == 1.0 ? QColorSpace::TransferFunction::Linear :
+                                                 QColorSpace::TransferFunction::Gamma;
+    auto colorSpace = QColorSpace{};
+    switch (space ? space : RawIOHandler::SRgb)
+    {
+    case RawIOHandler::SRgb:
+        colorSpace = QColorSpace(QColorSpace::Primaries::SRgb, transferFunction, float(gamma));
+        break;
+
+    case RawIOHandler::AdobeRgb:
+        colorSpace = QColorSpace(QColorSpace::Primaries::AdobeRgb, transferFunction, float(gamma));
+        break;
+
+    case RawIOHandler::WideGamutRgb:
+        colorSpace = QColorSpace(QPointF(0.3457, 0.3585), QPointF(0.7347, 0.2653),
+                                 QPointF(0.1152, 0.8264), QPointF(0.1566, 0.0177),
+                                 transferFunction, float(gamma));
+        break;
+
+    case RawIOHandler::ProPhotoRgb:
+        colorSpace = QColorSpace(QColorSpace::Primaries::ProPhotoRgb, transferFunction, float(gamma));
+        break;
+
+    default:
+        // QColorSpace can't describe XYZ as its blue primary has y = 0
+        return;
+    }
+
+    if (!thumbnail)
+    {
+        image->setColorSpace(colorSpace);
+        return;
+    }
+    if (!image->colorSpace().isValid())
+    {
+        // previews without an ICC profile are sRGB
+        image->setColorSpace(QColorSpace::SRgb);
+    }
+    if (image->colorSpace() != colorSpace)
+    {
+        image->convertToColorSpace(colorSpace);
+    }
+}
+#endif
+
+//============================================================================
+void RawIOHandlerPrivate::releaseLibRaw()
+{
+    // the cancel hook must never see a destroyed LibRaw instance
+    if (control)
+    {
+        control->setCancelHook(nullptr);
+    }
+    LibRawPool::global().release(move(raw));
+    // LibRaw may have read the mosaic from a mapped cache file
+    unpackedMapping.reset(nullptr);
+    stream.reset(nullptr);
+    memory->release(libRawMemory);
+    libRawMemory = 0;
+}
+
+//============================================================================
+/**
+ * @brief Maps the progress callbacks of LibRaw to the RawDecodeControl of the
+ * RawIOHandlerPrivate @a data.
+ *
+ * The stages of LibRaw are single bits in the order they are run, so the bit
+ * position of a stage tells how far the decode has come.
+ * @returns non-zero to make LibRaw stop
+ */
+static int reportProgress(void* data, LibRaw_progress stage, int iteration,
+                          int expected)
+{
+    constexpr auto LastStage = 19; // LIBRAW_PROGRESS_STRETCH
+    auto index = 0;
+    while ((1 << (index + 1)) <= int(stage))
+    {
+        ++index;
+    }
+    const auto fraction = expected > 0 ? double(iteration) / expected : 1.0;
+    auto* d = static_cast<RawIOHandlerPrivate*>(data);
+    d->control->reportProgress(qMin(0.99, (index + fraction) / (LastStage + 1)));
+    return d->control->isCanceled() ? 1 : 0;
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::attachControl()
+{
+    control = rawOption(RawIOHandler::DecodeControl).value<QSharedPointer<RawDecodeControl>>();
+    if (!control)
+    {
+        return true;
+    }
+
+    auto* libRaw = raw.get();
+    libRaw->clearCancelFlag();
+    libRaw->set_progress_handler(reportProgress, this);
+    control->setCancelHook([libRaw] { libRaw->setCancelFlag(); });
+    if (control->isCanceled())
+    {
+        detachControl();
+        return false;
+    }
+    control->reportProgress(0.0);
+    return true;
+}
+
+//============================================================================
+void RawIOHandlerPrivate::detachControl()
+{
+    if (!control)
+    {
+        return;
+    }
+    control->setCancelHook(nullptr);
+    if (raw)
+    {
+        raw->set_progress_handler(nullptr, nullptr);
+    }
+    control.reset();
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::isCanceled() const
+{
+    return control && control->isCanceled();
+}
+
+//============================================================================
+bool RawIOHandlerPrivate::checkStep(int ErrorCode, const char* step) const
+{
+    if (ErrorCode == LIBRAW_SUCCESS && !isCanceled())
+    {
+        return true;
+    }
+    if (isCanceled() || ErrorCode == LIBRAW_CANCELLED_BY_CALLBACK)
+    {
+        qDebug() << "Decoding canceled during" << step;
+    }
+    else
+    {
+        qCritical("LibRaw %s failed: %s", step, libraw_strerror(ErrorCode));
+        DecodeMetrics::global().recordLibRawError(ErrorCode);
+    }
+    return false;
+}
+
+//============================================================================
+ImageStatistics* RawIOHandlerPrivate::statisticsTarget()
+{
+    return rawOption(RawIOHandler::Statistics).toBool() ? &statistics : nullptr;
+}
+
+//============================================================================
+void RawIOHandlerPrivate::acquireLibRawMemory(qint64 bytes)
+{
+    libRawMemory += bytes;
+    memory->acquire(bytes);
+}
+
+//============================================================================
+QVariant RawIOHandlerPrivate::rawOption(RawIOHandler::RawOption option) const
+{
+    const auto it = rawOptions.constFind(option);
+    if (it != rawOptions.cend())
+    {
+        return *it;
+    }
+    if (auto* device = q->device())
+    {
+        return device->property(RawIOHandler::rawOptionName(option));
+    }
+    return QVariant();
+}
+
+//============================================================================
+RawIOHandler::RawIOHandler() :
+    d(make_unique<RawIOHandlerPrivate>(this))
+{
+}
+
+//============================================================================
+RawIOHandler::~RawIOHandler() = default;
+
+//============================================================================
+bool RawIOHandler::canRead(QIODevice* device)
+{
+    if (!device)
+    {
+        return false;
+    }
+
+    // Leave regular TIFF images to the TIFF plugin. This only peeks at the
+    // data, so we never consume anything of a sequential device.
+    const auto header = device->peek(16);
+    if (header.startsWith(QByteArrayLiteral("II*\0")) ||
+        header.startsWith(QByteArrayLiteral("MM\0*")))
+    {
+        if (!RawFormats::isRawTiff(device))
+        {
+            return false;
+        }
+    }
+    if (device->isSequential())
+    {
+        return RawFormats::hasRawSignature(header);
+    }
+    RawIOHandler handler;
+    return handler.d->openDatastream(device);
+}
+
+//============================================================================
+bool RawIOHandler::canRead() const
+{
+    if (canRead(device()))
+    {
+        setFormat("raw");
+        return true;
+    }
+    return false;
+}
+
+//============================================================================
+/**
+ * @brief Decodes the JPEG thumbnail @a data into @a image and applies the
+ * @a transformation.
+ *
+ * The JPEG decoder scales the image down to @a size itself, which is a lot
+ * cheaper than decoding it in full size and scaling it afterwards. If no
+ * transformation is necessary the decoder writes straight into the buffer of
+ * @a image, provided that it is compatible. Otherwise the transformation is
+ * applied while the downscaled pixels are copied into @a image. If
+ * @a statistics is given, the decoded pixels are accounted for in it.
+ * @returns true on success
+ */
+static bool decodeJpeg(QByteArray data, QSize size,
+                       QImageIOHandler::Transformations transformation,
+                       QImage* image, ImageStatistics* statistics)
+{
+    if (transformation & QImageIOHandler::TransformationRotate90)
+    {
+        // the JPEG data isn't rotated yet
+        size.transpose();
+    }
+
+    QBuffer buffer(&data);
+    QImageReader reader(&buffer, "JPEG");
+    reader.setScaledSize(size);
+
+    if (transformation == QImageIOHandler::TransformationNone)
+    {
+        if (!reader.read(image))
+        {
+            return false;
+        }
+        // the decoder doesn't let us in on its pass, but the preview is small
+        if (statistics)
+        {
+            statistics->add(image->format() == QImage::Format_RGB32 ?
+                            *image : image->convertToFormat(QImage::Format_RGB32));
+        }
+        return true;
+    }
+
+    auto decoded = QImage{};
+    if (!reader.read(&decoded))
+    {
+        return false;
+    }
+    if (decoded.format() != QImage::Format_RGB32)
+    {
+        decoded = decoded.convertToFormat(QImage::Format_RGB32);
+    }
+
+    prepareTarget(image, (transformation & QImageIOHandler::TransformationRotate90) ?
+                         decoded.size().transposed() : decoded.size());
+    if (image->isNull())
+    {
+        return false;
+    }
+    const auto targetRows = OrientedRows(image, transformation);
+    for (int y = 0; y < decoded.height(); ++y)
+    {
+        const auto* src = reinterpret_cast<const QRgb*>(decoded.constScanLine(y));
+        const auto dst = targetRows.line(y);
+        for (int x = 0; x < decoded.width(); ++x)
+        {
+            dst[x] = src[x];
+            if (statistics)
+            {
+                statistics->add(src[x]);
+            }
+        }
+    }
+    return true;
+}
+
 //============================================================================
-bool RawIOHandlerPrivate::openDatastream(QIODevice* device)
+/**
+ * @brief Checks for possible errors that occured during LibRaw
+ * loading/processing.
+ * @returns true if there was no error
+ */
+static bool checkLibRawError(int ErrorCode)
 {
-    if (!device)
+    if (ErrorCode != LIBRAW_SUCCESS || errno != EXIT_SUCCESS)
     {
+        perror("ERROR DRUING DECODING");
+        qCritical("Error code: %d; LibRaw error: %d\nAborting RawIOHandler::read(QImage*)",
+                  errno, ErrorCode);
+        if (ErrorCode != LIBRAW_SUCCESS)
+        {
+            DecodeMetrics::global().recordLibRawError(ErrorCode);
+        }
         return false;
     }
+    return true;
+}
 
-    device->seek(0);
-    if (raw)
+//============================================================================
+bool RawIOHandlerPrivate::readThumbnail(const QSize& size, QImage* image)
+{
+    qDebug() << "Using thumbnail";
+    StageClock clock;
+
+    // LibRaw leaves the orientation of thumbnails to us
+    const auto transformation = applyOrientation() ? transformationFromFlip(orientation) :
+                                                     QImageIOHandler::TransformationNone;
+
+    // A JPEG preview in memory is decoded right where it is, without the
+    // copies of unpack_thumb() and dcraw_make_mem_thumb()
+    const auto jpeg = embeddedJpeg();
+    if (!jpeg.isEmpty())
     {
+        if (!decodeJpeg(jpeg, size, transformation, image, statisticsTarget()))
+        {
+            qCritical("Could not decode the JPEG thumbnail! Aborting RawIOHandler::read(QImage*)");
+            return false;
+        }
+        memory->acquire(qint64(image->bytesPerLine()) * image->height());
+        clock.lap(DecodeMetrics::PreviewStage);
         return true;
     }
 
-    stream = make_unique<Datastream>(device);
-    raw = make_unique<LibRaw>();
-    if (raw->open_datastream(stream.get()) != LIBRAW_SUCCESS)
+    if (!checkStep(raw->unpack_thumb(), "unpack_thumb"))
     {
-        raw.reset(nullptr);
-        stream.reset(nullptr);
         return false;
     }
+    acquireLibRawMemory(raw->imgdata.thumbnail.tlength);
 
-    defaultSize = QSize(raw->imgdata.sizes.width,
-                        raw->imgdata.sizes.height);
-    if (raw->imgdata.sizes.flip == 5 || raw->imgdata.sizes.flip == 6)
+    auto ErrorCode = int{};
+    ProcessedImage output(raw->dcraw_make_mem_thumb(&ErrorCode),
+                          &LibRaw::dcraw_clear_mem);
+    if (!checkLibRawError(ErrorCode))
+    {
+        return false;
+    }
+    if (!output)
+    {
+        qCritical("Output image is a null image! Aborting RawIOHandler::read(QImage*)");
+        return false;
+    }
+    memory->acquire(output->data_size);
+    if (rawOption(RawIOHandler::MemoryLean).toBool())
+    {
+        releaseLibRaw();
+    }
+
+    if (output->type == LIBRAW_IMAGE_JPEG)
+    {
+        const auto data = QByteArray::fromRawData(reinterpret_cast<const char*>(output->data),
+                                                  int(output->data_size));
+        if (!decodeJpeg(data, size, transformation, image, statisticsTarget()))
+        {
+            qCritical("Could not decode the JPEG thumbnail! Aborting RawIOHandler::read(QImage*)");
+            return false;
+        }
+    }
+    else if (!packBitmap(*output, size, transformation, image, statisticsTarget()))
     {
-        defaultSize.transpose();
+        qCritical("Could not allocate the output image! Aborting RawIOHandler::read(QImage*)");
+        return false;
     }
+    memory->acquire(qint64(image->bytesPerLine()) * image->height());
+    clock.lap(DecodeMetrics::PreviewStage);
     return true;
 }
 
-
 //============================================================================
-RawIOHandler::RawIOHandler() :
-    d(make_unique<RawIOHandlerPrivate>(this))
+bool RawIOHandlerPrivate::locatePreview(QIODevice* device)
 {
+    if (!locator)
+    {
+        locator = make_unique<PreviewLocator>(device);
+        if (!locator->locate(&locatedPreview))
+        {
+            locatedPreview = EmbeddedPreview{};
+        }
+    }
+    return locatedPreview.length > 0;
 }
 
 //============================================================================
-RawIOHandler::~RawIOHandler() = default;
-
-//============================================================================
-bool RawIOHandler::canRead(QIODevice* device)
+bool RawIOHandlerPrivate::readLocatedPreview(QIODevice* device, QImage* image)
 {
-    if (!device)
+    // The automatic source needs the size of the raw image to decide, unless
+    // a scaled size is given. Once LibRaw has identified the file, the
+    // preview it has chosen stands.
+    const auto source = imageSource();
+    const auto sourceAllowsPreview = source == RawIOHandler::PreviewSource ||
+                                     (source == RawIOHandler::AutoSource &&
+                                      scaledSize.isValid());
+    if (raw || frame != 0 || !sourceAllowsPreview || !locatePreview(device))
     {
         return false;
     }
-    RawIOHandler handler;
-    return handler.d->openDatastream(device);
+    const auto& preview = locatedPreview;
+    // the scaled size is oriented like the output, so compare it with the
+    // preview as it will be shown
+    const auto orientedSize = (applyOrientation() && (preview.orientation & 4)) ?
+                              preview.size.transposed() : preview.size;
+    if (source == RawIOHandler::AutoSource &&
+        scaledSize.width() >= orientedSize.width() &&
+        scaledSize.height() >= orientedSize.height())
+    {
+        return false;
+    }
+    const auto decodeControl =
+        rawOption(RawIOHandler::DecodeControl).value<QSharedPointer<RawDecodeControl>>();
+    if (decodeControl && decodeControl->isCanceled())
+    {
+        // the cancellation is reported by the path through LibRaw
+        return false;
+    }
+
+    qDebug() << "Using located preview";
+    StageClock clock;
+    const auto transformation = applyOrientation() ?
+                                transformationFromFlip(preview.orientation) :
+                                QImageIOHandler::TransformationNone;
+    const auto size = scaledSize.isValid() ? scaledSize : orientedSize;
+    if (!decodeJpeg(locator->data(preview), size, transformation, image,
+                    statisticsTarget()))
+    {
+        // LibRaw may still make sense of the file
+        qWarning("Could not decode the located preview, falling back to LibRaw");
+        return false;
+    }
+    memory->acquire(qint64(image->bytesPerLine()) * image->height());
+    clock.lap(DecodeMetrics::PreviewStage);
+    if (decodeControl)
+    {
+        decodeControl->reportProgress(1.0);
+    }
+    return true;
 }
 
 //============================================================================
-bool RawIOHandler::canRead() const
+void RawIOHandlerPrivate::finishRead(QImage* image, bool thumbnail)
 {
-    if (canRead(device()))
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    if (imageSource() != RawIOHandler::MosaicSource)
     {
-        setFormat("raw");
-        return true;
+        tagColorSpace(image, thumbnail);
+    }
+#else
+    Q_UNUSED(thumbnail)
+#endif
+
+    text.insert(QStringLiteral("PeakMemory"), QString::number(memory->peak()));
+    if (statisticsTarget())
+    {
+        statistics.toText(&text);
+    }
+    for (auto it = text.cbegin(); it != text.cend(); ++it)
+    {
+        image->setText(it.key(), it.value());
     }
-    return false;
 }
 
 //============================================================================
-bool RawIOHandler::read(QImage* image)
+bool RawIOHandlerPrivate::readRawData(const QSize& size, QImage* image)
 {
-    if (!d->openDatastream(device()))
+    qDebug() << "Decoding raw data";
+    const auto& imgdata = raw->imgdata;
+    const auto lean = rawOption(RawIOHandler::MemoryLean).toBool();
+    StageClock clock;
+
+    if (!checkStep(UnpackCache::global().unpack(q->device(), raw.get(), &unpackedMapping),
+                   "unpack"))
+    {
+        return false;
+    }
+    clock.lap(DecodeMetrics::UnpackStage);
+    acquireLibRawMemory(qint64(imgdata.sizes.raw_pitch) * imgdata.sizes.raw_height);
+    applyOutputColor();
+    if (!checkStep(raw->dcraw_process(), "dcraw_process"))
     {
         return false;
     }
+    clock.lap(DecodeMetrics::ProcessStage);
+    acquireLibRawMemory(qint64(imgdata.sizes.iwidth) * imgdata.sizes.iheight *
+                        qint64(sizeof(*imgdata.image)));
 
-    const auto finalSize = d->scaledSize.isValid() ?
-                           d->scaledSize : d->defaultSize;
+    auto width = 0;
+    auto height = 0;
+    auto colors = 0;
+    auto bps = 0;
+    raw->get_mem_image_format(&width, &height, &colors, &bps);
+    if (QSize(width, height) == size && bps == 8 && (colors == 1 || colors == 3))
+    {
+        // the unscaled image can be rendered without any intermediate copy
+        prepareTarget(image, size);
+        if (image->isNull())
+        {
+            qCritical("Could not allocate the output image! Aborting RawIOHandler::read(QImage*)");
+            return false;
+        }
+        memory->acquire(qint64(image->bytesPerLine()) * image->height());
+        const auto ErrorCode = renderInto(raw.get(), colors, image, statisticsTarget());
+        if (lean)
+        {
+            releaseLibRaw();
+        }
+        clock.lap(DecodeMetrics::OutputStage);
+        return checkLibRawError(ErrorCode);
+    }
 
-    const auto& imgdata = d->raw->imgdata;
-    const auto deleter = [](auto* i){ LibRaw::dcraw_clear_mem(i); };
-    unique_ptr<libraw_processed_image_t, decltype(deleter)> output(nullptr, deleter);
     auto ErrorCode = int{};
+    ProcessedImage output(raw->dcraw_make_mem_image(&ErrorCode),
+                          &LibRaw::dcraw_clear_mem);
+    if (!checkLibRawError(ErrorCode))
+    {
+        return false;
+    }
+    if (!output)
+    {
+        qCritical("Output image is a null image! Aborting RawIOHandler::read(QImage*)");
+        return false;
+    }
+    memory->acquire(output->data_size);
+    if (lean)
+    {
+        // the processed image is all we need from now on
+        releaseLibRaw();
+    }
 
-    if (finalSize.width() < imgdata.thumbnail.twidth ||
-        finalSize.height() < imgdata.thumbnail.theight)
+    // LibRaw has already applied the orientation to its output
+    if (!packBitmap(*output, size, QImageIOHandler::TransformationNone, image,
+                    statisticsTarget()))
     {
-        qDebug() << "Using thumbnail";
-        d->raw->unpack_thumb();
-        output.reset(d->raw->dcraw_make_mem_thumb(&ErrorCode));
+        qCritical("Could not allocate the output image! Aborting RawIOHandler::read(QImage*)");
+        return false;
     }
-    else
+    memory->acquire(qint64(image->bytesPerLine()) * image->height());
+    clock.lap(DecodeMetrics::OutputStage);
+    return true;
+}
+
+//============================================================================
+/**
+ * @brief Keeps LibRaw alive for as long as a QImage uses its raw buffer, and
+ * accounts for LibRaw's memory until then.
+ */
+struct MosaicOwner
+{
+    unique_ptr<Datastream> stream;
+    unique_ptr<LibRaw> raw;
+    QSharedPointer<MemoryUsage> memory;
+    qint64 libRawMemory;
+
+    ~MosaicOwner()
     {
-        qDebug() << "Decoding raw data";
-        d->raw->unpack();
-        d->raw->dcraw_process();
-        output.reset(d->raw->dcraw_make_mem_image(&ErrorCode));
+        // LibRaw must go before the datastream it was opened with
+        LibRawPool::global().release(move(raw));
+        memory->release(libRawMemory);
     }
+};
 
-    // Check for possible errors that occured during LibRaw loading/processing
-    if (ErrorCode != LIBRAW_SUCCESS || errno != EXIT_SUCCESS)
+//============================================================================
+bool RawIOHandlerPrivate::readMosaic(QImage* image)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    qDebug() << "Reading the raw mosaic";
+    const auto& sizes = raw->imgdata.sizes;
+    StageClock clock;
+
+    if (!checkStep(raw->unpack(), "unpack"))
     {
-        perror("ERROR DRUING DECODING");
-        qCritical("Error code: %d; LibRaw error: %d\nAborting RawIOHandler::read(QImage*)",
-                  errno, ErrorCode);
         return false;
     }
-    if (!output)
+    clock.lap(DecodeMetrics::UnpackStage);
+    const auto* rawImage = raw->imgdata.rawdata.raw_image;
+    if (!rawImage)
     {
-        qCritical("Output image is a null image! Aborting RawIOHandler::read(QImage*)");
+        // Foveon, sRAW and linear DNG data has more than one sample per pixel
+        qCritical("The raw data is not a CFA mosaic! Aborting RawIOHandler::read(QImage*)");
         return false;
     }
+    acquireLibRawMemory(qint64(sizes.raw_pitch) * sizes.raw_height);
+    addMosaicText();
 
-    auto unscaled = QImage{};
-    if (output->type == LIBRAW_IMAGE_JPEG)
+    // the image uses LibRaw's buffer directly and takes LibRaw along, so the
+    // handler opens the file again for its next read
+    if (control)
+    {
+        control->setCancelHook(nullptr);
+    }
+    raw->set_progress_handler(nullptr, nullptr);
+    const auto pitch = int(sizes.raw_pitch);
+    const auto* visible = reinterpret_cast<const uchar*>(rawImage) +
+                          sizes.top_margin * pitch + sizes.left_margin * int(sizeof(*rawImage));
+    auto* owner = new MosaicOwner{move(stream), move(raw), memory, libRawMemory};
+    libRawMemory = 0;
+    *image = QImage(const_cast<uchar*>(visible), sizes.width, sizes.height, pitch,
+                    QImage::Format_Grayscale16,
+                    [](void* info) { delete static_cast<MosaicOwner*>(info); }, owner);
+    if (image->isNull())
+    {
+        delete owner;
+        qCritical("Could not wrap the raw data! Aborting RawIOHandler::read(QImage*)");
+        return false;
+    }
+    return true;
+#else
+    Q_UNUSED(image)
+    qCritical("Reading the raw mosaic needs Qt 5.13! Aborting RawIOHandler::read(QImage*)");
+    return false;
+#endif
+}
+
+//============================================================================
+void RawIOHandlerPrivate::addMosaicText()
+{
+    const auto& color = raw->imgdata.color;
+    const auto join = [](const float* values, int count)
     {
-        unscaled.loadFromData(output->data, output->data_size, "JPEG");
-        if (imgdata.sizes.flip != 0)
+        auto result = QStringList{};
+        for (int i = 0; i < count; ++i)
         {
-            int angle = 0;
-            if (imgdata.sizes.flip == 3)
-            {
-                angle = 180;
-            }
-            else if (imgdata.sizes.flip == 5)
-            {
-                angle = -90;
-            }
-            else if (imgdata.sizes.flip == 6)
-            {
-                angle = 90;
-            }
-            if (angle != 0)
-            {
-                const auto rotation = [&angle]
-                                      {
-                                          auto rot = QTransform{};
-                                          rot.rotate(angle);
-                                          return rot;
-                                      }();
-                unscaled = unscaled.transformed(rotation);
-            }
+            result << QString::number(double(values[i]), 'g', 6);
         }
+        return result.join(QLatin1Char(','));
+    };
+    //------------------------------------------------------------------------
+
+    // the black level of each of the four channels of the pattern
+    auto black = QStringList{};
+    for (int i = 0; i < 4; ++i)
+    {
+        black << QString::number(color.black + color.cblack[i]);
     }
-    else
+    text.insert(QStringLiteral("BlackLevel"), black.join(QLatin1Char(',')));
+    text.insert(QStringLiteral("WhiteLevel"), QString::number(color.maximum));
+
+    // one row of the repeating pattern after the other, e.g. "RG/GB"
+    const auto& idata = raw->imgdata.idata;
+    const auto period = idata.filters == 9 ? 6 : 2;
+    auto rows = QStringList{};
+    for (int row = 0; row < period; ++row)
     {
-        const auto numPixels = output->width * output->height;
-        const auto colorSize = output->bits / 8;
-        const auto pixelSize = output->colors * colorSize;
-        auto pixels = make_unique<uchar[]>(numPixels * 4);
-        auto data = output->data;
-        for (int i = 0; i < numPixels; ++i, data += pixelSize)
+        auto line = QString{};
+        for (int column = 0; column < period; ++column)
         {
-            if (output->colors == 3)
-            {
-                pixels[i * 4    ] = data[2 * colorSize];
-                pixels[i * 4 + 1] = data[1 * colorSize];
-                pixels[i * 4 + 2] = data[0];
-            }
-            else
-            {
-                pixels[i * 4    ] = data[0];
-                pixels[i * 4 + 1] = data[0];
-                pixels[i * 4 + 2] = data[0];
-            }
+            line += QLatin1Char(idata.cdesc[raw->COLOR(row, column)]);
         }
-        unscaled = QImage(pixels.release(),
-                          output->width, output->height,
-                          QImage::Format_RGB32);
+        rows << line;
     }
+    text.insert(QStringLiteral("CfaPattern"), rows.join(QLatin1Char('/')));
+
+    text.insert(QStringLiteral("AsShotMultipliers"), join(color.cam_mul, 4));
+    text.insert(QStringLiteral("DaylightMultipliers"), join(color.pre_mul, 4));
 
-    if (unscaled.size() != finalSize)
+    // XYZ to camera, as DNG's ColorMatrix, and camera to sRGB, row by row
+    auto camXyz = QStringList{};
+    auto rgbCam = QStringList{};
+    for (int i = 0; i < 3; ++i)
     {
-        // TODO: use quality parameter to decide transformation method
-        *image = unscaled.scaled(finalSize, Qt::IgnoreAspectRatio,
-                                 Qt::SmoothTransformation);
+        camXyz << join(color.cam_xyz[i], 3);
+        rgbCam << join(color.rgb_cam[i], 3);
     }
-    else
+    text.insert(QStringLiteral("ColorMatrix"), camXyz.join(QLatin1Char(',')));
+    text.insert(QStringLiteral("CameraToSRgb"), rgbCam.join(QLatin1Char(',')));
+}
+
+//============================================================================
+bool RawIOHandler::read(QImage* image)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // the preview of TIFF based files can be found without LibRaw
+    d->memory = QSharedPointer<MemoryUsage>::create();
+    d->text.clear();
+    d->statistics = ImageStatistics{};
+    if (d->readLocatedPreview(device(), image))
+    {
+        DecodeMetrics::global().recordDecode(DecodeMetrics::ThumbnailPath,
+                                             DecodeMetrics::Succeeded,
+                                             timer.nsecsElapsed(), d->memory->peak());
+        d->finishRead(image, true);
+        return true;
+    }
+
+    if (!d->openDatastream(device()))
+    {
+        return false;
+    }
+
+    const auto finalSize = d->scaledSize.isValid() ?
+                           d->scaledSize : d->outputSize();
+
+    // LibRaw orients its processed images according to user_flip, which
+    // takes effect when the raw data is processed
+    d->raw->imgdata.params.user_flip = d->applyOrientation() ? d->orientation : 0;
+
+    d->memory = QSharedPointer<MemoryUsage>::create();
+    d->libRawMemory = 0;
+    d->text.clear();
+    d->statistics = ImageStatistics{};
+    if (!d->attachControl())
+    {
+        return false;
+    }
+
+    // the embedded thumbnail only ever shows the first frame
+    const auto& thumbnail = d->raw->imgdata.thumbnail;
+    const auto mosaic = d->imageSource() == MosaicSource;
+    const auto useThumbnail = d->previewOnly() ||
+                              (d->imageSource() == AutoSource && d->frame == 0 &&
+                               (finalSize.width() < thumbnail.twidth ||
+                                finalSize.height() < thumbnail.theight));
+    const auto success = mosaic ? d->readMosaic(image) :
+                         useThumbnail ? d->readThumbnail(finalSize, image) :
+                                        d->readRawData(finalSize, image);
+    const auto path = mosaic ? DecodeMetrics::MosaicPath :
+                      useThumbnail ? DecodeMetrics::ThumbnailPath :
+                      finalSize == d->outputSize() ? DecodeMetrics::FullPath :
+                                                     DecodeMetrics::ScaledPath;
+    DecodeMetrics::global().recordDecode(path,
+                                         d->isCanceled() ? DecodeMetrics::Canceled :
+                                         success ? DecodeMetrics::Succeeded :
+                                                   DecodeMetrics::Failed,
+                                         timer.nsecsElapsed(), d->memory->peak());
+    if (!success || d->isCanceled())
     {
-        *image = unscaled;
-        if (output->type == LIBRAW_IMAGE_BITMAP)
+        // a canceled decode leaves nothing behind
+        if (d->isCanceled())
         {
-            // make sure that the bits are copied
-            // NOTE: better call detach() explicitly ???
-            const auto* b = image->bits();
-            Q_UNUSED(b);
+            d->releaseLibRaw();
         }
+        d->detachControl();
+        return false;
+    }
+    if (d->control)
+    {
+        d->control->reportProgress(1.0);
+    }
+    d->detachControl();
+    d->finishRead(image, useThumbnail);
+    return true;
+}
+
+//============================================================================
+int RawIOHandler::imageCount() const
+{
+    if (!d->openDatastream(device()))
+    {
+        return 0;
+    }
+    return d->frameCount;
+}
+
+//============================================================================
+bool RawIOHandler::jumpToImage(int imageNumber)
+{
+    if (imageNumber < 0 || imageNumber >= imageCount())
+    {
+        return false;
+    }
+    if (imageNumber == d->frame)
+    {
+        return true;
     }
 
+    // The frame is only unpacked by the next read()
+    const auto previousFrame = d->frame;
+    d->frame = imageNumber;
+    if (!d->openFrame(device()))
+    {
+        // the next read opens the previous frame again
+        d->releaseLibRaw();
+        d->frame = previousFrame;
+        return false;
+    }
     return true;
 }
 
+//============================================================================
+bool RawIOHandler::jumpToNextImage()
+{
+    return jumpToImage(d->frame + 1);
+}
+
+//============================================================================
+int RawIOHandler::currentImageNumber() const
+{
+    return d->frame;
+}
+
 //============================================================================
 QVariant RawIOHandler::option(ImageOption option) const
 {
     switch (option)
     {
     case ImageFormat:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+        if (d->imageSource() == MosaicSource)
+        {
+            return QImage::Format_Grayscale16;
+        }
+#endif
         return QImage::Format_RGB32;
 
     case Size:
+        // the size of a located preview doesn't need LibRaw either
+        if (!d->raw && d->imageSource() == PreviewSource && d->frame == 0 &&
+            d->locatePreview(device()))
+        {
+            const auto& preview = d->locatedPreview;
+            return (d->applyOrientation() && (preview.orientation & 4)) ?
+                   preview.size.transposed() : preview.size;
+        }
         d->openDatastream(device());
-        return d->defaultSize;
+        return d->outputSize();
 
     case ScaledSize:
         return d->scaledSize;
 
+    case ImageTransformation:
+        // an applied orientation must not be applied again by QImageReader
+        d->openDatastream(device());
+        return int(d->applyOrientation() ? TransformationNone :
+                                           transformationFromFlip(d->orientation));
+
+    case TransformedByDefault:
+        return true;
+
+    case Description:
+    {
+        auto description = QStringList{};
+        for (auto it = d->text.cbegin(); it != d->text.cend(); ++it)
+        {
+            description << it.key() + QLatin1String(": ") + it.value();
+        }
+        return description.join(QLatin1String("\n\n"));
+    }
+
     default:
         break;
     }
@@ -293,6 +1451,9 @@ bool RawIOHandler::supportsOption(ImageOption option) const
     case ImageFormat:
     case Size:
     case ScaledSize:
+    case Description:
+    case ImageTransformation:
+    case TransformedByDefault:
         return true;
 
     default:
@@ -300,3 +1461,53 @@ bool RawIOHandler::supportsOption(ImageOption option) const
     }
     return false;
 }
+
+//============================================================================
+const char* RawIOHandler::rawOptionName(RawOption option)
+{
+    switch (option)
+    {
+    case MemoryLean:
+        return "qtraw_memory_lean";
+
+    case SpoolMemoryLimit:
+        return "qtraw_spool_memory_limit";
+
+    case ColorSpace:
+        return "qtraw_color_space";
+
+    case Gamma:
+        return "qtraw_gamma";
+
+    case ApplyOrientation:
+        return "qtraw_apply_orientation";
+
+    case Source:
+        return "qtraw_source";
+
+    case DecodeControl:
+        return "qtraw_decode_control";
+
+    case Statistics:
+        return "qtraw_statistics";
+    }
+    return nullptr;
+}
+
+//============================================================================
+QVariant RawIOHandler::rawOption(RawOption option) const
+{
+    return d->rawOption(option);
+}
+
+//============================================================================
+const ImageStatistics& RawIOHandler::statistics() const
+{
+    return d->statistics;
+}
+
+//============================================================================
+void RawIOHandler::setRawOption(RawOption option, const QVariant& value)
+{
+    d->rawOptions.insert(option, value);
+}
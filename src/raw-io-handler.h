@@ -24,6 +24,9 @@
 //============================================================================
 //                                   INCLUDES
 //============================================================================
+#include "image-statistics.h"
+#include "qtraw-export.h"
+
 #include <QImageIOHandler>
 
 #include <memory>
@@ -42,9 +45,110 @@ class RawIOHandlerPrivate;
  * @brief The RawIOHandler class implements the functionality of Libraw to make
  * it usable for the use with the QImageReader.
  */
-class RawIOHandler : public QImageIOHandler
+class QTRAW_EXPORT RawIOHandler : public QImageIOHandler
 {
 public:
+    /**
+     * @brief Options of the RawIOHandler that go beyond the ImageOptions of
+     * the QImageIOHandler.
+     *
+     * If the handler is used through a QImageReader, these options can be
+     * set as dynamic properties of the reader's device. The property names
+     * are given by rawOptionName().
+     */
+    enum RawOption
+    {
+        /**
+         * Release every intermediate buffer as soon as the next stage of
+         * read() has consumed it, trading the possibility of subsequent
+         * reads for a lower peak memory usage (bool, default false).
+         */
+        MemoryLean,
+
+        /**
+         * The number of bytes of a sequential device that are kept in memory
+         * before the data is spooled into a temporary file instead
+         * (qint64, default 64 MiB).
+         */
+        SpoolMemoryLimit,
+
+        /**
+         * The color space LibRaw converts the output to, either as an
+         * OutputColorSpace or as its name ("srgb", "adobe-rgb",
+         * "wide-gamut-rgb", "prophoto-rgb", "xyz"). The image is tagged with
+         * the matching QColorSpace (default: sRGB with the sRGB curve).
+         */
+        ColorSpace,
+
+        /**
+         * The power of the output curve, e.g. 2.2, or 1.0 for linear output
+         * (double, default: the native curve of the ColorSpace).
+         */
+        Gamma,
+
+        /**
+         * Apply the orientation of the camera while the pixels are written
+         * (bool, default: true). If disabled, the pixels are returned as
+         * stored by the sensor and option(ImageTransformation) reports the
+         * orientation instead, so QImageReader::setAutoTransform() or the
+         * caller can apply it.
+         */
+        ApplyOrientation,
+
+        /**
+         * Where the image comes from, either as an ImageSource or as its name
+         * ("auto", "preview", "raw", "cfa"). The default picks the embedded
+         * preview if it is larger than the requested size.
+         */
+        Source,
+
+        /**
+         * A QSharedPointer<RawDecodeControl> that cancels the read() or
+         * follows its progress.
+         */
+        DecodeControl,
+
+        /**
+         * Accumulate the histograms and clipping counts of the image while
+         * its pixels are packed (bool, default false). They are available
+         * from statistics() and as the text keys "HistogramRed",
+         * "HistogramGreen", "HistogramBlue", "HistogramLuminance",
+         * "ClippedHighlights" and "ClippedShadows".
+         */
+        Statistics
+    };
+
+    /**
+     * @brief The sources read() can take the image from.
+     */
+    enum ImageSource
+    {
+        AutoSource,
+        PreviewSource,
+        RawSource,
+
+        /**
+         * The unprocessed sensor data of the visible area as a
+         * Format_Grayscale16 image, which is neither scaled nor oriented.
+         * Its black and white levels, CFA pattern and color matrices are
+         * returned as text keys.
+         */
+        MosaicSource
+    };
+
+    /**
+     * @brief The color spaces LibRaw can convert its output to. The values
+     * match LibRaw's output_color parameter.
+     */
+    enum OutputColorSpace
+    {
+        SRgb = 1,
+        AdobeRgb = 2,
+        WideGamutRgb = 3,
+        ProPhotoRgb = 4,
+        Xyz = 5
+    };
+
     RawIOHandler();
     ~RawIOHandler() override;
 
@@ -61,9 +165,38 @@ public:
      */
     static bool canRead(QIODevice* device);
 
+    /**
+     * @brief Returns the name of the dynamic device property that sets the
+     * given RawOption @a option.
+     */
+    static const char* rawOptionName(RawOption option);
+
+    /**
+     * @brief Returns the value of the RawOption @a option.
+     *
+     * Values set with setRawOption() take precedence over the dynamic
+     * properties of the device.
+     */
+    QVariant rawOption(RawOption option) const;
+
+    /**
+     * @brief Returns the statistics of the last read() if the Statistics
+     * option is set.
+     */
+    const ImageStatistics& statistics() const;
+
+    /**
+     * @brief Sets the RawOption @a option to @a value.
+     */
+    void setRawOption(RawOption option, const QVariant& value);
+
     // reimplemented virtual functions ----------------------------------------
     bool canRead() const override;
     bool read(QImage* image) override;
+    int imageCount() const override;
+    bool jumpToImage(int imageNumber) override;
+    bool jumpToNextImage() override;
+    int currentImageNumber() const override;
     QVariant option(ImageOption option) const override;
     void setOption(ImageOption option, const QVariant& value) override;
     bool supportsOption(ImageOption option) const override;
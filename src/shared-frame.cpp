@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "shared-frame.h"
+
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#include <QFile>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+/**
+ * @brief The pixels start at a page boundary.
+ */
+constexpr qint64 PixelAlignment = 4096;
+
+/**
+ * @brief Returns @a value rounded up to a multiple of @a alignment.
+ */
+qint64 alignUp(qint64 value, qint64 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Unmaps a taken segment once the QImage that uses it is gone.
+ */
+struct Mapping
+{
+    void* data;
+    qint64 size;
+
+    static void cleanup(void* info)
+    {
+        auto* mapping = static_cast<Mapping*>(info);
+#ifdef Q_OS_UNIX
+        munmap(mapping->data, size_t(mapping->size));
+#endif
+        delete mapping;
+    }
+};
+
+/**
+ * @brief Sets @a error to @a message, if there is an @a error.
+ */
+QImage fail(QString* error, const QString& message)
+{
+    if (error)
+    {
+        *error = message;
+    }
+    return QImage();
+}
+}
+
+//============================================================================
+QImage SharedFrame::take(const QString& name, QString* error)
+{
+#ifdef Q_OS_UNIX
+    const auto path = QFile::encodeName(name);
+    const auto fd = shm_open(path.constData(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        return fail(error, QStringLiteral("Cannot open %1: %2").arg(name, qt_error_string(errno)));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < qint64(sizeof(Header)))
+    {
+        ::close(fd);
+        return fail(error, QStringLiteral("%1 is not a shared frame").arg(name));
+    }
+    const auto size = qint64(info.st_size);
+    auto* map = static_cast<uchar*>(mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED, fd, 0));
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return fail(error, QStringLiteral("Cannot map %1: %2").arg(name, qt_error_string(errno)));
+    }
+    const auto unmap = [map, size] { munmap(map, size_t(size)); };
+    //------------------------------------------------------------------------
+
+    auto* header = reinterpret_cast<Header*>(map);
+    if (header->magic != Magic || header->version != Version)
+    {
+        unmap();
+        return fail(error, QStringLiteral("%1 is not a shared frame").arg(name));
+    }
+
+    // only one consumer can move the frame from Ready to Taken
+    auto expected = quint32(Ready);
+    if (!__atomic_compare_exchange_n(&header->state, &expected, quint32(Taken), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        unmap();
+        return fail(error, expected == Writing ?
+                           QStringLiteral("%1 is still being written").arg(name) :
+                           QStringLiteral("%1 has already been taken").arg(name));
+    }
+
+    // the mapping outlives the name, and the system frees the memory once the
+    // mapping is gone
+    shm_unlink(path.constData());
+
+    if (header->format == QImage::Format_Invalid || header->format >= QImage::NImageFormats)
+    {
+        unmap();
+        return fail(error, QStringLiteral("%1 is damaged").arg(name));
+    }
+    const auto format = QImage::Format(header->format);
+    const auto bitsPerPixel = qint64(QImage::toPixelFormat(format).bitsPerPixel());
+    const auto pixelEnd = header->pixelOffset + header->pixelSize;
+    const auto metadataEnd = header->metadataOffset + header->metadataSize;
+    if (header->width <= 0 || header->height <= 0 || bitsPerPixel == 0 ||
+        qint64(header->bytesPerLine) < (header->width * bitsPerPixel + 7) / 8 ||
+        header->pixelSize != quint64(header->bytesPerLine) * quint64(header->height) ||
+        pixelEnd < header->pixelOffset || pixelEnd > quint64(size) ||
+        header->metadataOffset < sizeof(Header) || metadataEnd > header->pixelOffset)
+    {
+        unmap();
+        return fail(error, QStringLiteral("%1 is damaged").arg(name));
+    }
+
+    const auto metadata = QJsonDocument::fromJson(QByteArray::fromRawData(
+        reinterpret_cast<const char*>(map + header->metadataOffset),
+        int(header->metadataSize))).object();
+    auto* mapping = new Mapping{map, size};
+    auto image = QImage(map + header->pixelOffset, header->width, header->height,
+                        header->bytesPerLine, format, &Mapping::cleanup, mapping);
+    if (image.isNull())
+    {
+        Mapping::cleanup(mapping);
+        return fail(error, QStringLiteral("%1 is damaged").arg(name));
+    }
+    for (auto it = metadata.constBegin(); it != metadata.constEnd(); ++it)
+    {
+        image.setText(it.key(), it.value().toString());
+    }
+    return image;
+#else
+    return fail(error, QStringLiteral("Shared frames are not supported on this platform"));
+#endif
+}
+
+//============================================================================
+bool SharedFrame::remove(const QString& name)
+{
+#ifdef Q_OS_UNIX
+    return shm_unlink(QFile::encodeName(name).constData()) == 0;
+#else
+    Q_UNUSED(name)
+    return false;
+#endif
+}
+
+//============================================================================
+SharedFrameWriter::SharedFrameWriter(const QString& name) :
+    m_name(name)
+{
+}
+
+//============================================================================
+SharedFrameWriter::~SharedFrameWriter()
+{
+    close();
+}
+
+//============================================================================
+void SharedFrameWriter::close()
+{
+    // the image must not refer to the mapping any longer
+    m_image = QImage();
+    if (!m_map)
+    {
+        return;
+    }
+#ifdef Q_OS_UNIX
+    munmap(m_map, size_t(m_mapSize));
+    if (!m_published)
+    {
+        SharedFrame::remove(m_name);
+    }
+#endif
+    m_map = nullptr;
+    m_mapSize = 0;
+}
+
+//============================================================================
+bool SharedFrameWriter::create(const QSize& size, QImage::Format format, int metadataCapacity)
+{
+    close();
+    m_published = false;
+
+    const auto bitsPerPixel = qint64(QImage::toPixelFormat(format).bitsPerPixel());
+    const auto bytesPerLine = (qint64(size.width()) * bitsPerPixel + 31) / 32 * 4;
+    if (size.isEmpty() || bitsPerPixel == 0 || bytesPerLine > INT_MAX)
+    {
+        m_error = QStringLiteral("Invalid frame size or format");
+        return false;
+    }
+    const auto metadataOffset = alignUp(sizeof(SharedFrame::Header), 64);
+    const auto pixelOffset = alignUp(metadataOffset + qMax(0, metadataCapacity), PixelAlignment);
+    const auto pixelSize = bytesPerLine * size.height();
+
+#ifdef Q_OS_UNIX
+    // O_EXCL never hands out a segment that a consumer might still be reading
+    const auto fd = shm_open(QFile::encodeName(m_name).constData(),
+                             O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        m_error = QStringLiteral("Cannot create %1: %2").arg(m_name, qt_error_string(errno));
+        return false;
+    }
+    m_mapSize = pixelOffset + pixelSize;
+    auto* map = MAP_FAILED;
+    if (ftruncate(fd, off_t(m_mapSize)) == 0)
+    {
+        map = mmap(nullptr, size_t(m_mapSize), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    m_error = qt_error_string(errno);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        SharedFrame::remove(m_name);
+        m_error = QStringLiteral("Cannot map %1: %2").arg(m_name, m_error);
+        return false;
+    }
+    m_map = static_cast<uchar*>(map);
+
+    auto* header = reinterpret_cast<SharedFrame::Header*>(m_map);
+    header->magic = SharedFrame::Magic;
+    header->version = SharedFrame::Version;
+    header->state = SharedFrame::Writing;
+    header->format = quint32(format);
+    header->width = size.width();
+    header->height = size.height();
+    header->bytesPerLine = qint32(bytesPerLine);
+    header->metadataSize = 0;
+    header->metadataOffset = quint64(metadataOffset);
+    header->pixelOffset = quint64(pixelOffset);
+    header->pixelSize = quint64(pixelSize);
+    header->producerPid = qint64(getpid());
+
+    m_image = QImage(m_map + pixelOffset, size.width(), size.height(), int(bytesPerLine),
+                     format);
+    m_error.clear();
+    return true;
+#else
+    Q_UNUSED(format)
+    Q_UNUSED(pixelSize)
+    m_error = QStringLiteral("Shared frames are not supported on this platform");
+    return false;
+#endif
+}
+
+//============================================================================
+QImage* SharedFrameWriter::image()
+{
+    return &m_image;
+}
+
+//============================================================================
+bool SharedFrameWriter::publish()
+{
+    if (!m_map || m_published)
+    {
+        m_error = QStringLiteral("There is no frame to publish");
+        return false;
+    }
+    auto* header = reinterpret_cast<SharedFrame::Header*>(m_map);
+    auto* pixels = m_map + header->pixelOffset;
+
+    if (m_image.constBits() != pixels)
+    {
+        // the decoder could not use the shared buffer, e.g. for a JPEG preview
+        if (m_image.size() != QSize(header->width, header->height) ||
+            m_image.format() != QImage::Format(header->format))
+        {
+            m_error = QStringLiteral("The decoded image does not fit the shared frame");
+            return false;
+        }
+        const auto lineSize = size_t(qMin(m_image.bytesPerLine(), header->bytesPerLine));
+        for (int y = 0; y < header->height; ++y)
+        {
+            memcpy(pixels + qint64(y) * header->bytesPerLine, m_image.constScanLine(y),
+                   lineSize);
+        }
+    }
+
+    auto metadata = QJsonObject{};
+    for (const auto& key : m_image.textKeys())
+    {
+        metadata.insert(key, m_image.text(key));
+    }
+    const auto json = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+    if (quint64(json.size()) > header->pixelOffset - header->metadataOffset)
+    {
+        m_error = QStringLiteral("The text keys do not fit the shared frame");
+        return false;
+    }
+    memcpy(m_map + header->metadataOffset, json.constData(), size_t(json.size()));
+    header->metadataSize = quint32(json.size());
+
+    // everything above is visible to a consumer that sees the Ready state
+    atomic_thread_fence(memory_order_release);
+    header->state = SharedFrame::Ready;
+    m_published = true;
+    return true;
+}
+
+//============================================================================
+bool SharedFrameWriter::decode(QImageReader* reader)
+{
+    auto size = reader->scaledSize().isValid() ? reader->scaledSize() : reader->size();
+    if (reader->autoTransform() &&
+        (reader->transformation() & QImageIOHandler::TransformationRotate90))
+    {
+        size.transpose();
+    }
+    const auto format = reader->imageFormat() != QImage::Format_Invalid ?
+                        reader->imageFormat() : QImage::Format_RGB32;
+    if (!create(size, format))
+    {
+        return false;
+    }
+    if (!reader->read(&m_image))
+    {
+        m_error = reader->errorString();
+        close();
+        return false;
+    }
+    return publish();
+}
+
+//============================================================================
+QString SharedFrameWriter::errorString() const
+{
+    return m_error;
+}
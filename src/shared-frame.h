@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SHARED_FRAME_H
+#define SHARED_FRAME_H
+
+#include "qtraw-export.h"
+
+#include <QImage>
+#include <QString>
+
+class QImageReader;
+
+/**
+ * @brief The SharedFrame namespace hands decoded frames to other processes in
+ * named POSIX shared memory segments.
+ *
+ * A segment starts with a SharedFrame::Header, followed by the text keys of
+ * the image as JSON and the pixels. A frame has exactly one consumer: take()
+ * unlinks the segment before it returns, so the memory belongs to the
+ * consumer alone and is freed by the system when its image is gone, even if
+ * the consumer crashes. A segment that is never taken must be removed by
+ * its producer with remove().
+ *
+ * Shared frames are only supported on Unix.
+ */
+namespace SharedFrame
+{
+/**
+ * @brief Identifies a segment that holds a shared frame ("QRSF").
+ */
+constexpr quint32 Magic = 0x46535251;
+
+/**
+ * @brief The version of the segment layout.
+ */
+constexpr quint32 Version = 1;
+
+/**
+ * @brief The states of a shared frame.
+ */
+enum State : quint32
+{
+    Writing,
+    Ready,
+    Taken
+};
+
+/**
+ * @brief The header at the start of every segment.
+ */
+struct Header
+{
+    quint32 magic;
+    quint32 version;
+    quint32 state;
+    quint32 format;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    quint32 metadataSize;
+    quint64 metadataOffset;
+    quint64 pixelOffset;
+    quint64 pixelSize;
+    qint64 producerPid;
+};
+
+/**
+ * @brief Maps the frame in the segment @a name and takes it over.
+ *
+ * The returned QImage uses the shared memory directly, no pixel is copied.
+ * @returns the frame, or a null image if the segment does not exist, is not
+ * ready or is damaged, in which case @a error tells why
+ */
+QTRAW_EXPORT QImage take(const QString& name, QString* error = nullptr);
+
+/**
+ * @brief Removes the segment @a name, e.g. one that has never been taken.
+ * @returns true if the segment existed
+ */
+QTRAW_EXPORT bool remove(const QString& name);
+}
+
+/**
+ * @brief The SharedFrameWriter class decodes an image straight into a named
+ * shared memory segment.
+ *
+ * The frame buffer that the handler decodes into lives in the segment, so
+ * the pixels are written once and never copied. Until publish() succeeds the
+ * segment is removed again when the writer is destroyed, so a failed decode
+ * leaves nothing behind.
+ */
+class QTRAW_EXPORT SharedFrameWriter
+{
+public:
+    /**
+     * @brief The default number of bytes reserved for the text keys.
+     */
+    static constexpr int DefaultMetadataCapacity = 64 * 1024;
+
+    /**
+     * @brief Construct a new SharedFrameWriter for the segment @a name, which
+     * must start with a slash.
+     */
+    explicit SharedFrameWriter(const QString& name);
+
+    /**
+     * @brief Destruct the SharedFrameWriter. The segment stays around if the
+     * frame has been published.
+     */
+    ~SharedFrameWriter();
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(SharedFrameWriter);
+    SharedFrameWriter(const SharedFrameWriter&& rhs) = delete;
+    SharedFrameWriter& operator=(const SharedFrameWriter&& rhs) = delete;
+
+    /**
+     * @brief Creates the segment for a frame of the given @a size and
+     * @a format. An existing segment of the same name is never reused.
+     * @returns true on success
+     */
+    bool create(const QSize& size, QImage::Format format = QImage::Format_RGB32,
+                int metadataCapacity = DefaultMetadataCapacity);
+
+    /**
+     * @brief Returns the image whose pixels live in the segment. Read into it
+     * with QImageReader::read(QImage*) or RawIOHandler::read().
+     */
+    QImage* image();
+
+    /**
+     * @brief Stores the text keys of image() and marks the frame ready.
+     *
+     * If the decoder has replaced the buffer of image(), its pixels are
+     * copied into the segment.
+     * @returns true on success
+     */
+    bool publish();
+
+    /**
+     * @brief Creates the segment for the image of @a reader, reads the image
+     * into it and publishes it.
+     * @returns true on success
+     */
+    bool decode(QImageReader* reader);
+
+    /**
+     * @brief Returns why the last operation failed.
+     */
+    QString errorString() const;
+
+private:
+    /**
+     * @brief Unmaps the segment and removes it unless it has been published.
+     */
+    void close();
+
+    QString m_name;
+    uchar* m_map{};
+    qint64 m_mapSize{};
+    QImage m_image;
+    bool m_published{};
+    QString m_error;
+};
+
+#endif // SHARED_FRAME_H
@@ -3,7 +3,6 @@ include(../common-config.pri)
 TARGET = qtraw
 TEMPLATE = lib
 CONFIG += c++14 \
-    link_pkgconfig \
     plugin
 DESTDIR = imageformats
 
@@ -11,33 +10,40 @@ build_pass:CONFIG(debug, debug|release) {
     win32: TARGET = $$join(TARGET,,,d) # 'd' suffix for debug builds on Windows
 }
 
-unix: {
-    PKGCONFIG += \
-        libraw
-}
+include(qtraw-core.pri)
+include(raw-formats.pri)
 
-HEADERS += \
-    datastream.h \
-    raw-io-handler.h
 SOURCES += \
-    datastream.cpp \
-    main.cpp \
-    raw-io-handler.cpp
-OTHER_FILES += \
-    raw.json
-
-win32: {
-    INCLUDEPATH *= $$PWD/../LibRaw/libraw/
-
-    LIBS += -L$$OUT_PWD/../libs -llibraw
-}
+    main.cpp
+
+# the plugin metadata and the KDE service file are generated from the format
+# list that raw-formats.pri has read
+RAW_KEYS_JSON = $$join(RAW_KEYS, ", ")
+RAW_MIMETYPES_JSON = $$join(RAW_MIMETYPES, ", ")
+RAW_JSON = \
+    "{" \
+    "  \"Keys\": [ $$RAW_KEYS_JSON ]," \
+    "  \"MimeTypes\": [ $$RAW_MIMETYPES_JSON ]" \
+    "}"
+write_file($$OUT_PWD/raw.json, RAW_JSON)|error("Could not write raw.json")
+
+RAW_DESKTOP_MIMETYPE_LIST = $$join(RAW_DESKTOP_MIMETYPES, ";")
+RAW_DESKTOP = \
+    "[Desktop Entry]" \
+    "Type=Service" \
+    "X-KDE-ServiceTypes=QImageIOPlugins" \
+    "X-KDE-ImageFormat=raw" \
+    "X-KDE-MimeType=$$RAW_DESKTOP_MIMETYPE_LIST" \
+    "X-KDE-Read=true" \
+    "X-KDE-Write=false"
+write_file($$OUT_PWD/raw.desktop, RAW_DESKTOP)|error("Could not write raw.desktop")
 
 target.path += $$[QT_INSTALL_PLUGINS]/imageformats
 INSTALLS += target
 
 unix:!isEmpty(INSTALL_KDEDIR): {
     # For KDE, install a .desktop file with metadata about the loader
-    kde_desktop.files = raw.desktop
+    kde_desktop.files = $$OUT_PWD/raw.desktop
     kde_desktop.path = $${INSTALL_KDEDIR}/share/kde4/services/qimageioplugins/
     INSTALLS += kde_desktop
 }
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "unpack-cache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <cstring>
+
+#include "libraw.h"
+
+using namespace std;
+
+namespace
+{
+/**
+ * @brief The header of a cache file. The mosaic starts at a page boundary,
+ * so it can be mapped in place. The sizes of LibRaw's structures reject
+ * files that were written by a different build.
+ */
+struct CacheHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 colorSize;
+    quint32 sizesSize;
+    quint32 outputParamsSize;
+    quint64 colorOffset;
+    quint64 sizesOffset;
+    quint64 outputParamsOffset;
+    quint64 mosaicOffset;
+    quint64 mosaicLength;
+};
+
+constexpr char Magic[8] = {'Q', 'T', 'R', 'A', 'W', 'U', 'N', 'P'};
+constexpr quint32 Version = 1;
+constexpr quint64 PageSize = 4096;
+
+/**
+ * @brief LibRaw allocates 8 rows more than the mosaic has, which some of its
+ * algorithms read.
+ */
+constexpr quint64 PaddingRows = 8;
+
+const auto FileSuffix = QStringLiteral(".unpacked");
+
+//============================================================================
+/**
+ * @brief Rounds @a offset up to a multiple of @a alignment.
+ */
+quint64 aligned(quint64 offset, quint64 alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+}
+
+constexpr qint64 UnpackCache::DefaultMaxSize;
+
+//============================================================================
+UnpackCache& UnpackCache::global()
+{
+    // never destroyed, so handlers that are destroyed during static
+    // destruction can still use it
+    static auto* cache = []
+    {
+        auto* result = new UnpackCache;
+        const auto maxSize = qgetenv("QTRAW_UNPACK_CACHE_SIZE").toLongLong();
+        if (maxSize > 0)
+        {
+            result->setMaxSize(maxSize * 1024 * 1024);
+        }
+        result->setDirectory(QString::fromLocal8Bit(qgetenv("QTRAW_UNPACK_CACHE")));
+        return result;
+    }();
+    return *cache;
+}
+
+//============================================================================
+void UnpackCache::setDirectory(const QString& directory)
+{
+    if (!directory.isEmpty() && !QDir().mkpath(directory))
+    {
+        qWarning("Could not create the unpack cache %s", qPrintable(directory));
+        return;
+    }
+    lock_guard<mutex> lock(m_mutex);
+    m_directory = directory;
+}
+
+//============================================================================
+QString UnpackCache::directory() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_directory;
+}
+
+//============================================================================
+void UnpackCache::setMaxSize(qint64 maxSize)
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_maxSize = maxSize;
+    }
+    evict();
+}
+
+//============================================================================
+qint64 UnpackCache::maxSize() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_maxSize;
+}
+
+//============================================================================
+QString UnpackCache::cacheFile(QIODevice* device, LibRaw* raw) const
+{
+    const auto cacheDirectory = directory();
+    auto* file = qobject_cast<QFile*>(device);
+    if (cacheDirectory.isEmpty() || !file)
+    {
+        return QString();
+    }
+    const auto info = QFileInfo(*file);
+    const auto path = info.canonicalFilePath();
+    if (path.isEmpty())
+    {
+        return QString();
+    }
+
+    auto key = QCryptographicHash(QCryptographicHash::Sha1);
+    key.addData(path.toUtf8() + '\n');
+    key.addData(QByteArray::number(info.size()) + '\n');
+    key.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + '\n');
+    key.addData(QByteArray::number(raw->imgdata.params.shot_select) + '\n');
+    key.addData(QByteArray(LibRaw::version()));
+    return QDir(cacheDirectory).filePath(QString::fromLatin1(key.result().toHex()) +
+                                         FileSuffix);
+}
+
+//============================================================================
+int UnpackCache::unpack(QIODevice* device, LibRaw* raw, unique_ptr<QFile>* mapping)
+{
+    const auto fileName = cacheFile(device, raw);
+    if (!fileName.isEmpty() && restore(fileName, raw, mapping))
+    {
+        qDebug() << "Restored the unpacked raw data from" << fileName;
+        return LIBRAW_SUCCESS;
+    }
+
+    const auto result = raw->unpack();
+    if (result == LIBRAW_SUCCESS && !fileName.isEmpty() && store(fileName, raw) > 0)
+    {
+        evict();
+    }
+    return result;
+}
+
+//============================================================================
+bool UnpackCache::restore(const QString& fileName, LibRaw* raw,
+                          unique_ptr<QFile>* mapping)
+{
+    auto file = make_unique<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    const auto size = quint64(file->size());
+    if (size < sizeof(CacheHeader))
+    {
+        return false;
+    }
+
+    // copy on write, so nothing LibRaw might do to the mosaic reaches the file
+    auto* data = file->map(0, qint64(size), QFileDevice::MapPrivateOption);
+    if (!data)
+    {
+        return false;
+    }
+    auto header = CacheHeader{};
+    memcpy(&header, data, sizeof(header));
+    auto& imgdata = raw->imgdata;
+    auto& outputParams = raw->get_internal_data_pointer()->internal_output_params;
+    const auto fits = [size](quint64 offset, quint64 length)
+    {
+        return offset <= size && length <= size - offset;
+    };
+    if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version ||
+        header.colorSize != sizeof(imgdata.color) ||
+        header.sizesSize != sizeof(imgdata.sizes) ||
+        header.outputParamsSize != sizeof(outputParams) ||
+        !fits(header.colorOffset, header.colorSize) ||
+        !fits(header.sizesOffset, header.sizesSize) ||
+        !fits(header.outputParamsOffset, header.outputParamsSize) ||
+        !fits(header.mosaicOffset, header.mosaicLength) ||
+        header.mosaicOffset % PageSize != 0)
+    {
+        qWarning("Ignoring the invalid unpack cache file %s", qPrintable(fileName));
+        return false;
+    }
+
+    auto sizes = libraw_image_sizes_t{};
+    memcpy(&sizes, data + header.sizesOffset, sizeof(sizes));
+    if (sizes.raw_width != imgdata.sizes.raw_width ||
+        sizes.raw_height != imgdata.sizes.raw_height ||
+        header.mosaicLength != quint64(sizes.raw_pitch) * (sizes.raw_height + PaddingRows))
+    {
+        return false;
+    }
+
+    // The state unpack() leaves behind. The ICC profile belongs to this
+    // instance of LibRaw, not to the one that wrote the file. So does the
+    // flip: the writer may have developed with a different user_flip, which
+    // LibRaw writes into the sizes.
+    auto* profile = imgdata.color.profile;
+    const auto profileLength = imgdata.color.profile_length;
+    const auto flip = imgdata.sizes.flip;
+    memcpy(&imgdata.color, data + header.colorOffset, sizeof(imgdata.color));
+    imgdata.color.profile = profile;
+    imgdata.color.profile_length = profileLength;
+    imgdata.sizes = sizes;
+    imgdata.sizes.flip = flip;
+    memcpy(&outputParams, data + header.outputParamsOffset, sizeof(outputParams));
+
+    // LibRaw only frees raw_alloc, so the mapped mosaic is left alone
+    auto& rawdata = imgdata.rawdata;
+    rawdata.raw_image = reinterpret_cast<ushort*>(data + header.mosaicOffset);
+    rawdata.color = imgdata.color;
+    rawdata.sizes = imgdata.sizes;
+    rawdata.iparams = imgdata.idata;
+    rawdata.ioparams = outputParams;
+    imgdata.progress_flags |= LIBRAW_PROGRESS_LOAD_RAW;
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // the modification time orders the files for the eviction
+    file->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+#endif
+    *mapping = move(file);
+    return true;
+}
+
+//============================================================================
+qint64 UnpackCache::store(const QString& fileName, LibRaw* raw)
+{
+    const auto& imgdata = raw->imgdata;
+    const auto& rawdata = imgdata.rawdata;
+    const auto& sizes = imgdata.sizes;
+    const auto& outputParams = raw->get_internal_data_pointer()->internal_output_params;
+
+    // only the Bayer data of LibRaw itself, without the separate black
+    // levels of Phase One backs
+    if (!rawdata.raw_image || rawdata.raw_image != rawdata.raw_alloc ||
+        rawdata.ph1_cblack || rawdata.ph1_rblack || sizes.raw_pitch == 0)
+    {
+        return 0;
+    }
+
+    auto header = CacheHeader{};
+    memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.colorSize = sizeof(imgdata.color);
+    header.sizesSize = sizeof(imgdata.sizes);
+    header.outputParamsSize = sizeof(outputParams);
+    header.colorOffset = aligned(sizeof(header), 8);
+    header.sizesOffset = aligned(header.colorOffset + header.colorSize, 8);
+    header.outputParamsOffset = aligned(header.sizesOffset + header.sizesSize, 8);
+    header.mosaicOffset = aligned(header.outputParamsOffset + header.outputParamsSize,
+                                  PageSize);
+    const auto mosaicLength = quint64(sizes.raw_pitch) * sizes.raw_height;
+    const auto paddingLength = quint64(sizes.raw_pitch) * PaddingRows;
+    header.mosaicLength = mosaicLength + paddingLength;
+
+    auto prefix = QByteArray(int(header.mosaicOffset), '\0');
+    memcpy(prefix.data(), &header, sizeof(header));
+    memcpy(prefix.data() + header.colorOffset, &imgdata.color, header.colorSize);
+    memcpy(prefix.data() + header.sizesOffset, &imgdata.sizes, header.sizesSize);
+    memcpy(prefix.data() + header.outputParamsOffset, &outputParams,
+           header.outputParamsSize);
+
+    // QSaveFile lets the file appear atomically for other processes
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(prefix) != prefix.size() ||
+        file.write(reinterpret_cast<const char*>(rawdata.raw_image), qint64(mosaicLength)) !=
+        qint64(mosaicLength) ||
+        file.write(QByteArray(int(paddingLength), '\0')) != qint64(paddingLength) ||
+        !file.commit())
+    {
+        qWarning("Could not write the unpack cache file %s: %s", qPrintable(fileName),
+                 qPrintable(file.errorString()));
+        return 0;
+    }
+    return qint64(header.mosaicOffset + header.mosaicLength);
+}
+
+//============================================================================
+void UnpackCache::evict()
+{
+    const auto cacheDirectory = directory();
+    const auto limit = maxSize();
+    if (cacheDirectory.isEmpty())
+    {
+        return;
+    }
+
+    // the least recently used files come first
+    const auto files = QDir(cacheDirectory).entryInfoList({QLatin1Char('*') + FileSuffix},
+                                                          QDir::Files,
+                                                          QDir::Time | QDir::Reversed);
+    auto total = qint64{};
+    for (const auto& info : files)
+    {
+        total += info.size();
+    }
+    for (const auto& info : files)
+    {
+        if (total <= limit)
+        {
+            break;
+        }
+        if (QFile::remove(info.filePath()))
+        {
+            total -= info.size();
+        }
+    }
+}
+
+//============================================================================
+void UnpackCache::clear()
+{
+    const auto cacheDirectory = directory();
+    if (cacheDirectory.isEmpty())
+    {
+        return;
+    }
+    for (const auto& info : QDir(cacheDirectory).entryInfoList({QLatin1Char('*') + FileSuffix},
+                                                               QDir::Files))
+    {
+        QFile::remove(info.filePath());
+    }
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2020 Florian Meinicke <florian.meinicke@t-online.de>
+ *
+ * This file is part of QtRaw.
+ *
+ * QtRaw is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * QtRaw is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QtRaw.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPACK_CACHE_H
+#define UNPACK_CACHE_H
+
+#include "qtraw-export.h"
+
+#include <QString>
+
+#include <memory>
+#include <mutex>
+
+class LibRaw;
+class QFile;
+class QIODevice;
+
+/**
+ * @brief The UnpackCache class keeps the unpacked raw data of files on disk,
+ * so developing a file again skips LibRaw's unpack().
+ *
+ * Decompressing the raw data of lossless JPEG CR2s or compressed NEFs is
+ * often the largest part of a decode. The cache stores the Bayer mosaic
+ * together with the colour data, sizes and output parameters LibRaw
+ * determines while it unpacks, in a file whose mosaic is page aligned. A
+ * later unpack() of the same file maps that file and points LibRaw at the
+ * mapped mosaic, so dcraw_process() reads it without a copy.
+ *
+ * Files are keyed by their canonical path, size and modification time, the
+ * frame and the version of LibRaw. Only QFiles can be cached, and only
+ * Bayer data: LibRaw's 3 and 4 colour and floating point images are
+ * unpacked as usual. When the cache grows beyond its size limit, the files
+ * that have not been used for the longest time are removed.
+ *
+ * The cache is off until it has a directory, which the environment variable
+ * QTRAW_UNPACK_CACHE sets for the global cache. QTRAW_UNPACK_CACHE_SIZE sets
+ * its limit in MiB.
+ */
+class QTRAW_EXPORT UnpackCache
+{
+public:
+    static constexpr qint64 DefaultMaxSize = qint64(4) * 1024 * 1024 * 1024;
+
+    /**
+     * @brief Returns the cache the RawIOHandler and the RawDeveloper use.
+     */
+    static UnpackCache& global();
+
+    /**
+     * @brief Construct a new UnpackCache without a directory.
+     */
+    UnpackCache() = default;
+    ~UnpackCache() = default;
+
+    /**
+     * Rule of five.
+     */
+    Q_DISABLE_COPY(UnpackCache);
+    UnpackCache(const UnpackCache&& rhs) = delete;
+    UnpackCache& operator=(const UnpackCache&& rhs) = delete;
+
+    /**
+     * @brief Keeps the cache files in @a directory, which is created if
+     * necessary. An empty directory turns the cache off.
+     */
+    void setDirectory(const QString& directory);
+
+    /**
+     * @brief Returns the directory of the cache files.
+     */
+    QString directory() const;
+
+    /**
+     * @brief Sets the number of bytes the cache files may take to
+     * @a maxSize.
+     */
+    void setMaxSize(qint64 maxSize);
+
+    /**
+     * @brief Returns the number of bytes the cache files may take.
+     */
+    qint64 maxSize() const;
+
+    /**
+     * @brief Unpacks the raw data of the file on @a device into @a raw,
+     * which has opened it, either from the cache or with LibRaw's unpack().
+     * In the latter case the unpacked data is added to the cache.
+     *
+     * If the data comes from the cache, @a mapping is the mapped cache file.
+     * LibRaw reads from its memory, so it has to be kept until @a raw has
+     * been recycled or destroyed.
+     * @returns LibRaw's error code
+     */
+    int unpack(QIODevice* device, LibRaw* raw, std::unique_ptr<QFile>* mapping);
+
+    /**
+     * @brief Removes all cache files.
+     */
+    void clear();
+
+private:
+    /**
+     * @brief Returns the name of the cache file of the file on @a device as
+     * opened by @a raw, or an empty string if it can't be cached.
+     */
+    QString cacheFile(QIODevice* device, LibRaw* raw) const;
+
+    /**
+     * @brief Restores the unpacked data of @a raw from the cache file
+     * @a fileName and keeps it mapped in @a mapping.
+     * @returns true on success
+     */
+    static bool restore(const QString& fileName, LibRaw* raw,
+                        std::unique_ptr<QFile>* mapping);
+
+    /**
+     * @brief Writes the unpacked data of @a raw to the cache file
+     * @a fileName.
+     * @returns the size of the file, or 0 on failure
+     */
+    static qint64 store(const QString& fileName, LibRaw* raw);
+
+    /**
+     * @brief Removes the least recently used files until the cache fits into
+     * its limit.
+     */
+    void evict();
+
+    mutable std::mutex m_mutex;
+    QString m_directory;
+    qint64 m_maxSize{DefaultMaxSize};
+};
+
+#endif // UNPACK_CACHE_H
@@ -19,10 +19,39 @@
  */
 
 #include "qtraw-test.h"
+#include "buffer-pool.h"
+#include "catalog.h"
+#include "decode-metrics.h"
+#include "decode-scheduler.h"
+#include "indexer.h"
+#include "libraw-pool.h"
+#include "preview-locator.h"
+#include "raw-decode-control.h"
+#include "raw-developer.h"
+#include "raw-header.h"
+#include "raw-io-handler.h"
+#include "shared-frame.h"
+#include "synthetic-raw.h"
+#include "thumbnail-server.h"
+#include "unpack-cache.h"
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+#include <QColorSpace>
+#endif
+#include <QBuffer>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
 #include <QImage>
 #include <QImageReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QLockFile>
+#include <QProcess>
+#include <QTemporaryDir>
 
 void QtRawTest::initTestCase()
 {
@@ -32,6 +61,18 @@ void QtRawTest::cleanupTestCase()
 {
 }
 
+void QtRawTest::supportedFormats()
+{
+    const auto formats = QImageReader::supportedImageFormats();
+    QVERIFY(formats.contains("cr3"));
+    QVERIFY(formats.contains("orf"));
+    QVERIFY(formats.contains("rw2"));
+
+    const auto mimeTypes = QImageReader::supportedMimeTypes();
+    QVERIFY(mimeTypes.contains("image/x-canon-cr3"));
+    QVERIFY(mimeTypes.contains("image/x-sony-arw"));
+}
+
 void QtRawTest::loadRaw()
 {
     QImage raw("testimage.arw");
@@ -48,4 +89,790 @@ void QtRawTest::loadRawWithReader()
     QCOMPARE(raw.size(), QSize(800, 600));
 }
 
+void QtRawTest::readIntoExistingImage()
+{
+    QImage raw;
+    QImageReader reader("testimage.arw");
+    reader.setScaledSize(QSize(800,600));
+    QVERIFY(reader.read(&raw));
+    const auto* bits = raw.constBits();
+
+    // a second read of the same size must not reallocate the frame buffer
+    QImageReader nextReader("testimage.arw");
+    nextReader.setScaledSize(QSize(800,600));
+    QVERIFY(nextReader.read(&raw));
+    QCOMPARE(raw.constBits(), bits);
+}
+
+void QtRawTest::imageCount()
+{
+    QImageReader reader("testimage.arw");
+    QCOMPARE(reader.imageCount(), 1);
+    QCOMPARE(reader.currentImageNumber(), 0);
+    QVERIFY(!reader.jumpToNextImage());
+    QVERIFY(reader.jumpToImage(0));
+    QCOMPARE(reader.read().size(), QSize(4288, 2856));
+}
+
+void QtRawTest::loadRawFromSequentialDevice()
+{
+    QProcess cat;
+    cat.start("cat", QStringList() << "testimage.arw");
+    QVERIFY(cat.waitForStarted());
+
+    QImageReader reader(&cat, "arw");
+    QCOMPARE(reader.size(), QSize(4288, 2856));
+
+    reader.setScaledSize(QSize(800,600));
+    QImage raw = reader.read();
+    QCOMPARE(raw.size(), QSize(800, 600));
+}
+
+void QtRawTest::loadRawFromFinishedProcess()
+{
+    // all the data is buffered and nothing more can arrive, so the spool
+    // must not wait for more until it times out
+    QProcess cat;
+    cat.start("cat", QStringList() << "testimage.arw");
+    QVERIFY(cat.waitForFinished());
+    QCOMPARE(cat.state(), QProcess::NotRunning);
+
+    QImageReader reader(&cat, "arw");
+    reader.setScaledSize(QSize(800, 600));
+    QCOMPARE(reader.read().size(), QSize(800, 600));
+}
+
+void QtRawTest::outputColorSpace()
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
+    QSKIP("QColorSpace requires Qt 5.14");
+#else
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    file.setProperty("qtraw_color_space", "prophoto-rgb");
+    QImageReader reader(&file, "arw");
+    const auto image = reader.read();
+    QVERIFY(!image.isNull());
+    QCOMPARE(image.colorSpace().primaries(), QColorSpace::Primaries::ProPhotoRgb);
+    QCOMPARE(image.colorSpace().transferFunction(), QColorSpace::TransferFunction::Gamma);
+    QCOMPARE(image.colorSpace().gamma(), 1.8f);
+
+    // the default output is written with the curve it is tagged with; the
+    // raw source keeps the embedded thumbnail out of the comparison
+    QFile defaultFile("testimage.arw");
+    QVERIFY(defaultFile.open(QIODevice::ReadOnly));
+    defaultFile.setProperty("qtraw_source", "raw");
+    QImageReader defaultReader(&defaultFile, "arw");
+    defaultReader.setScaledSize(QSize(800, 533));
+    const auto defaultImage = defaultReader.read();
+    QCOMPARE(defaultImage.colorSpace().transferFunction(), QColorSpace::TransferFunction::SRgb);
+
+    QFile srgbFile("testimage.arw");
+    QVERIFY(srgbFile.open(QIODevice::ReadOnly));
+    srgbFile.setProperty("qtraw_source", "raw");
+    srgbFile.setProperty("qtraw_color_space", "srgb");
+    QImageReader srgbReader(&srgbFile, "arw");
+    srgbReader.setScaledSize(QSize(800, 533));
+    QVERIFY(srgbReader.read() == defaultImage);
+#endif
+}
+
+void QtRawTest::orientation()
+{
+    // the camera was turned 90 degrees clockwise, so the white bar along the
+    // top edge of the sensor belongs on the right
+    auto options = SyntheticRawOptions{};
+    options.size = QSize(600, 400);
+    options.previewSize = QSize();
+    options.orientation = 6;
+    auto dng = SyntheticRaw::render(QStringLiteral("patches"), options);
+    QVERIFY(!dng.isEmpty());
+    const auto barOnRight = [](const QImage& image)
+    {
+        return image.size() == QSize(400, 600) &&
+               qGray(image.pixel(397, 300)) > 200 && qGray(image.pixel(2, 300)) < 100;
+    };
+
+    QBuffer oriented(&dng);
+    QVERIFY(oriented.open(QIODevice::ReadOnly));
+    QImageReader reader(&oriented, "dng");
+    QVERIFY(reader.autoTransform());
+    QCOMPARE(reader.size(), QSize(400, 600));
+    QCOMPARE(reader.transformation(), QImageIOHandler::TransformationNone);
+    QVERIFY(barOnRight(reader.read()));
+
+    // the handler leaves the pixels as the sensor stored them
+    QBuffer unoriented(&dng);
+    QVERIFY(unoriented.open(QIODevice::ReadOnly));
+    unoriented.setProperty("qtraw_apply_orientation", false);
+    QImageReader sensorReader(&unoriented, "dng");
+    sensorReader.setAutoTransform(false);
+    QCOMPARE(sensorReader.transformation(), QImageIOHandler::TransformationRotate90);
+    const auto sensor = sensorReader.read();
+    QCOMPARE(sensor.size(), QSize(600, 400));
+    QVERIFY(qGray(sensor.pixel(300, 2)) > 200);
+    QVERIFY(qGray(sensor.pixel(300, 397)) < 100);
+
+    // and QImageReader applies the orientation the handler left alone
+    QBuffer transformed(&dng);
+    QVERIFY(transformed.open(QIODevice::ReadOnly));
+    transformed.setProperty("qtraw_apply_orientation", false);
+    QImageReader transformingReader(&transformed, "dng");
+    QVERIFY(barOnRight(transformingReader.read()));
+}
+
+void QtRawTest::cancelDecode()
+{
+    auto control = QSharedPointer<RawDecodeControl>::create();
+    auto* rawControl = control.data();
+    control->setProgressHandler([rawControl](double progress)
+                                {
+                                    if (progress > 0)
+                                    {
+                                        rawControl->cancel();
+                                    }
+                                });
+
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    file.setProperty("qtraw_decode_control", QVariant::fromValue(control));
+    QImageReader reader(&file, "arw");
+    QVERIFY(reader.read().isNull());
+    QVERIFY(control->isCanceled());
+    QVERIFY(control->progress() < 1.0);
+}
+
+void QtRawTest::loadRawFromBuffer()
+{
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    auto data = file.readAll();
+    QBuffer buffer(&data);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    // the preview is decoded straight from the buffer
+    QImageReader reader(&buffer, "arw");
+    reader.setScaledSize(QSize(400, 266));
+    const auto preview = reader.read();
+    QCOMPARE(preview.size(), QSize(400, 266));
+
+    QImageReader fileReader("testimage.arw");
+    fileReader.setScaledSize(QSize(400, 266));
+    QCOMPARE(preview, fileReader.read());
+}
+
+void QtRawTest::developTwice()
+{
+    RawDeveloper developer;
+    QVERIFY(developer.open(QStringLiteral("testimage.arw")));
+    QCOMPARE(developer.size(), QSize(4288, 2856));
+
+    auto parameters = DevelopParameters{};
+    parameters.autoBrightness = false;
+    QImage dark;
+    QVERIFY(developer.develop(parameters, QSize(800, 533), &dark));
+    QCOMPARE(dark.size(), QSize(800, 533));
+
+    // only the tone changes, so the demosaiced image is reused
+    parameters.brightness = 2.0;
+    QImage bright;
+    QVERIFY(developer.develop(parameters, QSize(800, 533), &bright));
+    QVERIFY(qGray(bright.pixel(400, 266)) >= qGray(dark.pixel(400, 266)));
+    QVERIFY(bright != dark);
+}
+
+void QtRawTest::statistics()
+{
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    file.setProperty("qtraw_statistics", true);
+    QImageReader reader(&file, "arw");
+    reader.setScaledSize(QSize(400, 266));
+    const auto image = reader.read();
+    QVERIFY(!image.isNull());
+
+    // every pixel is counted exactly once
+    auto pixels = qint64{};
+    for (const auto& count : reader.text("HistogramLuminance").split(','))
+    {
+        pixels += count.toLongLong();
+    }
+    QCOMPARE(pixels, qint64(image.width()) * image.height());
+    QVERIFY(!reader.text("ClippedHighlights").isEmpty());
+}
+
+void QtRawTest::readHeaders()
+{
+    // one reader serves several files in a row
+    RawHeaderReader reader;
+    for (int i = 0; i < 2; ++i)
+    {
+        QFile file("testimage.arw");
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        auto header = RawHeader{};
+        QVERIFY(reader.read(&file, &header));
+        QCOMPARE(header.size, QSize(4288, 2856));
+        QCOMPARE(header.make, QStringLiteral("Sony"));
+        QVERIFY(header.previewOffset > 0);
+        QVERIFY(header.previewOffset + header.previewLength <= file.size());
+    }
+
+    QBuffer garbage;
+    garbage.setData(QByteArray(4096, 'x'));
+    garbage.open(QIODevice::ReadOnly);
+    auto header = RawHeader{};
+    QVERIFY(!reader.read(&garbage, &header));
+    QVERIFY(!reader.errorString().isEmpty());
+}
+
+void QtRawTest::readMosaic()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 13, 0)
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    file.setProperty("qtraw_source", "cfa");
+    QImageReader reader(&file, "arw");
+    reader.setAutoTransform(false);
+    const auto mosaic = reader.read();
+    QVERIFY(!mosaic.isNull());
+    QCOMPARE(mosaic.format(), QImage::Format_Grayscale16);
+    QCOMPARE(mosaic.size(), QSize(4288, 2856));
+    QCOMPARE(reader.text("CfaPattern").size(), 5);
+    QCOMPARE(reader.text("BlackLevel").split(',').size(), 4);
+    QCOMPARE(reader.text("ColorMatrix").split(',').size(), 9);
+
+    // the samples are raw sensor values, not 8 bit values scaled up
+    const auto whiteLevel = reader.text("WhiteLevel").toUInt();
+    QVERIFY(whiteLevel > 255);
+    const auto* line = reinterpret_cast<const quint16*>(mosaic.constScanLine(1428));
+    QVERIFY(line[2144] <= whiteLevel);
+#else
+    QSKIP("Format_Grayscale16 needs Qt 5.13");
+#endif
+}
+
+void QtRawTest::bufferPool()
+{
+    BufferPool pool;
+    auto* first = pool.acquire(48 * 1024 * 1024);
+    QVERIFY(first);
+    pool.release(first);
+
+    // a slightly different size falls into the same class
+    auto* second = pool.acquire(47 * 1024 * 1024);
+    QCOMPARE(second, first);
+    QCOMPARE(pool.statistics().hits, qint64(1));
+    QCOMPARE(pool.statistics().misses, qint64(1));
+
+    // the image gives its buffer back when it is gone
+    {
+        const auto image = pool.image(QSize(4288, 2856), QImage::Format_RGB32);
+        QCOMPARE(image.size(), QSize(4288, 2856));
+        QVERIFY(pool.statistics().bytesInUse >= 2 * 47 * 1024 * 1024);
+    }
+    pool.release(second);
+    QCOMPARE(pool.statistics().bytesInUse, qint64(0));
+
+    pool.trim();
+    QCOMPARE(pool.statistics().bytesRetained, qint64(0));
+    QVERIFY(pool.statistics().bytesTrimmed > 0);
+
+    // the pool knows its own buffers, which is how LibRaw's hooks tell them
+    // from the blocks of the C library
+    auto* pooled = pool.acquire(8 * 1024 * 1024);
+    QVERIFY(pool.bufferSize(pooled) >= 8 * 1024 * 1024);
+    auto block = std::vector<char>(16);
+    QCOMPARE(pool.bufferSize(block.data()), qint64(0));
+    pool.release(pooled);
+
+    // a pool that is no longer used gives its idle buffers back by itself
+    pool.setMaxIdleTime(10);
+    pool.release(pool.acquire(8 * 1024 * 1024));
+    QTRY_COMPARE(pool.statistics().bytesRetained, qint64(0));
+}
+
+void QtRawTest::sharedFrame()
+{
+#ifdef Q_OS_UNIX
+    const auto name = QStringLiteral("/qtraw-test-%1").arg(QCoreApplication::applicationPid());
+    {
+        QImageReader reader("testimage.arw");
+        reader.setScaledSize(QSize(536, 357));
+        SharedFrameWriter writer(name);
+        QVERIFY2(writer.create(QSize(536, 357)), qPrintable(writer.errorString()));
+        const auto* bits = writer.image()->constBits();
+        QVERIFY(reader.read(writer.image()));
+
+        // the handler has decoded straight into the segment
+        QCOMPARE(writer.image()->constBits(), bits);
+        QVERIFY2(writer.publish(), qPrintable(writer.errorString()));
+
+        // a segment is never created twice
+        SharedFrameWriter twin(name);
+        QVERIFY(!twin.create(QSize(16, 16)));
+    }
+
+    auto error = QString();
+    const auto frame = SharedFrame::take(name, &error);
+    QVERIFY2(!frame.isNull(), qPrintable(error));
+    QCOMPARE(frame.size(), QSize(536, 357));
+    QCOMPARE(frame.format(), QImage::Format_RGB32);
+    QVERIFY(!frame.text("PeakMemory").isEmpty());
+
+    // the frame belongs to the first consumer alone
+    QVERIFY(SharedFrame::take(name).isNull());
+    QVERIFY(!SharedFrame::remove(name));
+
+    // an unpublished frame is removed with its writer
+    {
+        SharedFrameWriter writer(name);
+        QVERIFY(writer.create(QSize(16, 16)));
+    }
+    QVERIFY(!SharedFrame::remove(name));
+#else
+    QSKIP("Shared frames need POSIX shared memory");
+#endif
+}
+
+void QtRawTest::decodeAsync()
+{
+    DecodeScheduler scheduler(1);
+    auto options = DecodeOptions{};
+    options.size = QSize(800, 600);
+    options.rawOptions.insert(RawIOHandler::Source, "raw");
+
+    // the watchers are told in the order the decodes finish
+    auto finished = QStringList();
+    QFutureWatcher<QImage> firstWatcher;
+    QFutureWatcher<QImage> secondWatcher;
+    QFutureWatcher<QImage> thirdWatcher;
+    connect(&firstWatcher, &QFutureWatcher<QImage>::finished,
+            [&finished] { finished << "first"; });
+    connect(&secondWatcher, &QFutureWatcher<QImage>::finished,
+            [&finished] { finished << "second"; });
+    connect(&thirdWatcher, &QFutureWatcher<QImage>::finished,
+            [&finished] { finished << "third"; });
+
+    auto first = scheduler.decode("testimage.arw", options,
+                                  DecodeScheduler::PrefetchPriority);
+    auto second = scheduler.decode("testimage.arw", options,
+                                   DecodeScheduler::PrefetchPriority);
+    auto third = scheduler.decode("testimage.arw", options,
+                                  DecodeScheduler::PrefetchPriority);
+    firstWatcher.setFuture(first);
+    secondWatcher.setFuture(second);
+    thirdWatcher.setFuture(third);
+
+    // the third image becomes visible while the second one is still waiting,
+    // and overtakes it
+    QVERIFY(scheduler.setPriority(third, DecodeScheduler::VisiblePriority));
+    QVERIFY(scheduler.pendingCount() >= 2);
+    first.waitForFinished();
+    second.waitForFinished();
+    third.waitForFinished();
+    QCoreApplication::processEvents();
+    QCOMPARE(finished.size(), 3);
+    QVERIFY(finished.indexOf("third") < finished.indexOf("second"));
+
+    // DecodeOptions::size keeps the aspect ratio
+    QCOMPARE(third.result().size(), QSize(800, 532));
+    QVERIFY(!first.result().isNull());
+    QVERIFY(!scheduler.setPriority(first, DecodeScheduler::VisiblePriority));
+    QCOMPARE(scheduler.pendingCount(), 0);
+
+    // a canceled decode has no result
+    auto running = scheduler.decode("testimage.arw");
+    QTRY_VERIFY(running.progressValue() > 0);
+    running.cancel();
+    running.waitForFinished();
+    QVERIFY(running.isCanceled());
+    QCOMPARE(running.resultCount(), 0);
+    QCOMPARE(scheduler.pendingCount(), 0);
+
+    // other images are decoded as well
+    QBuffer png;
+    png.open(QIODevice::WriteOnly);
+    QVERIFY(QImage(32, 16, QImage::Format_RGB32).save(&png, "png"));
+    png.close();
+    png.open(QIODevice::ReadOnly);
+    options.size = QSize(16, 16);
+    QCOMPARE(QtRaw::decodeAsync(&png, options).result().size(), QSize(16, 8));
+}
+
+void QtRawTest::decodeMetrics()
+{
+    // the plugin records into the registry of the library the test links
+    auto& metrics = DecodeMetrics::global();
+    metrics.reset();
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    file.setProperty("qtraw_source", "raw");
+    QImageReader reader(&file, "arw");
+    reader.setScaledSize(QSize(800, 533));
+    QVERIFY(!reader.read().isNull());
+    QCOMPARE(metrics.decodeCount(DecodeMetrics::ScaledPath, DecodeMetrics::Succeeded),
+             qint64(1));
+    QCOMPARE(metrics.decodeLatency(DecodeMetrics::ScaledPath).count(), qint64(1));
+    QCOMPARE(metrics.stageLatency(DecodeMetrics::OpenStage).count(), qint64(1));
+    QCOMPARE(metrics.stageLatency(DecodeMetrics::UnpackStage).count(), qint64(1));
+    QVERIFY(metrics.peakMemory() > 0);
+
+    QBuffer garbage;
+    garbage.setData("not a raw file");
+    garbage.open(QIODevice::ReadOnly);
+    QImageReader garbageReader(&garbage, "arw");
+    QVERIFY(garbageReader.read().isNull());
+    QCOMPARE(metrics.libRawErrors().size(), 1);
+
+    const auto text = metrics.toPrometheus();
+    QVERIFY(text.contains("qtraw_decodes_total{path=\"scaled\",result=\"succeeded\"} 1\n"));
+    QVERIFY(text.contains("qtraw_decode_duration_seconds_bucket{path=\"scaled\",le=\"+Inf\"} 1\n"));
+    QVERIFY(text.contains("qtraw_decode_duration_seconds_count{path=\"full\"} 0\n"));
+
+    // LibRaw reads a buffer in memory directly, so it is counted when it is opened
+    const auto bytesRead = metrics.bytesRead();
+    QVERIFY(bytesRead > 0);
+    QVERIFY(file.seek(0));
+    QBuffer buffer;
+    buffer.setData(file.readAll());
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+    buffer.setProperty("qtraw_source", "raw");
+    QImageReader bufferReader(&buffer, "arw");
+    bufferReader.setScaledSize(QSize(800, 533));
+    QVERIFY(!bufferReader.read().isNull());
+    QVERIFY(metrics.bytesRead() >= bytesRead + buffer.size());
+
+    // the dump writes the file right away and once more when it stops
+    QTemporaryDir directory;
+    const auto fileName = directory.filePath("qtraw.prom");
+    QVERIFY(DecodeMetrics::startDump(fileName, 60 * 1000));
+
+    // the dump owns the file until it stops
+    QLockFile ownership(fileName + ".lock");
+    QVERIFY(!ownership.tryLock(0));
+    DecodeMetrics::stopDump();
+    QVERIFY(ownership.tryLock(0));
+    ownership.unlock();
+    QFile dump(fileName);
+    QVERIFY(dump.open(QIODevice::ReadOnly));
+    QCOMPARE(dump.readAll(), metrics.toPrometheus());
+
+    LatencyHistogram histogram;
+    for (int i = 0; i < 90; ++i)
+    {
+        histogram.observe(3 * 1000 * 1000);
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+        histogram.observe(700 * 1000 * 1000);
+    }
+    QCOMPARE(histogram.quantile(0.5), 0.005);
+    QCOMPARE(histogram.quantile(0.99), 1.0);
+    QCOMPARE(histogram.sum(), 7.27);
+}
+
+void QtRawTest::libRawPool()
+{
+    LibRawPool pool(1);
+    auto raw = pool.acquire();
+    QVERIFY(raw);
+    QCOMPARE(pool.createdCount(), qint64(1));
+    QVERIFY(pool.constructionTime() > 0);
+
+    // a released instance comes back with the default parameters
+    const auto defaultBright = raw->imgdata.params.bright;
+    raw->imgdata.params.half_size = 1;
+    raw->imgdata.params.bright = 2.0f;
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const auto data = file.readAll();
+    QCOMPARE(raw->open_buffer(const_cast<char*>(data.constData()), size_t(data.size())),
+             int(LIBRAW_SUCCESS));
+    const auto* rawPointer = raw.get();
+    pool.release(std::move(raw));
+
+    raw = pool.acquire();
+    QCOMPARE(raw.get(), rawPointer);
+    QCOMPARE(pool.createdCount(), qint64(1));
+    QCOMPARE(raw->imgdata.params.half_size, 0);
+    QCOMPARE(raw->imgdata.params.bright, defaultBright);
+
+    // only one idle instance is kept
+    auto second = pool.acquire();
+    QCOMPARE(pool.createdCount(), qint64(2));
+    pool.release(std::move(raw));
+    pool.release(std::move(second));
+    raw = pool.acquire();
+    second = pool.acquire();
+    QCOMPARE(pool.createdCount(), qint64(3));
+
+    // new instances read the cameras of rawspeed from the override, which
+    // rawspeed rejects if it isn't a camera database
+    if (!(LibRaw::capabilities() & LIBRAW_CAPS_RAWSPEED))
+    {
+        QSKIP("LibRaw is built without rawspeed");
+    }
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const auto camerasFile = directory.filePath(QStringLiteral("cameras.xml"));
+    QFile cameras(camerasFile);
+    QVERIFY(cameras.open(QIODevice::WriteOnly));
+    cameras.write("<Cameras><Camera make=");
+    cameras.close();
+    pool.setCameraFile(camerasFile);
+    QTest::ignoreMessage(QtWarningMsg,
+                         qPrintable(QStringLiteral("Could not load the rawspeed cameras from ") +
+                                    camerasFile));
+    QVERIFY(pool.acquire());
+    QCOMPARE(pool.createdCount(), qint64(4));
+}
+
+void QtRawTest::previewLocator()
+{
+    QFile file("testimage.arw");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    PreviewLocator locator(&file);
+    auto preview = EmbeddedPreview{};
+    QVERIFY(locator.locate(&preview));
+    QCOMPARE(preview.orientation, 0);
+
+    // the largest preview is at least as large as the one of LibRaw
+    RawHeaderReader reader;
+    auto header = RawHeader{};
+    QVERIFY(reader.read(&file, &header));
+    QVERIFY(preview.size.width() >= header.previewSize.width());
+
+    const auto jpeg = locator.data(preview);
+    QCOMPARE(qint64(jpeg.size()), preview.length);
+    QVERIFY(jpeg.startsWith("\xff\xd8"));
+    QCOMPARE(QImage::fromData(jpeg, "JPEG").size(), preview.size);
+
+    // the handler reads the preview without opening LibRaw
+    const auto opened = DecodeMetrics::global().stageLatency(DecodeMetrics::OpenStage).count();
+    RawIOHandler handler;
+    handler.setDevice(&file);
+    handler.setRawOption(RawIOHandler::Source, RawIOHandler::PreviewSource);
+    QCOMPARE(handler.option(QImageIOHandler::Size).toSize(), preview.size);
+    QImage image;
+    QVERIFY(handler.read(&image));
+    QCOMPARE(image.size(), preview.size);
+    QCOMPARE(DecodeMetrics::global().stageLatency(DecodeMetrics::OpenStage).count(), opened);
+
+    // the automatic source compares the scaled size with the preview as it
+    // is shown, so a portrait request as large as the rotated preview goes
+    // to LibRaw, and a smaller one is served by the preview
+    auto options = SyntheticRawOptions{};
+    options.size = QSize(1500, 1000);
+    options.previewSize = QSize(750, 500);
+    options.orientation = 6;
+    auto dng = SyntheticRaw::render(QStringLiteral("patches"), options);
+    QVERIFY(!dng.isEmpty());
+    const auto readScaled = [&dng](const QSize& size)
+    {
+        QBuffer buffer(&dng);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader rotatedReader(&buffer, "dng");
+        rotatedReader.setScaledSize(size);
+        return rotatedReader.read();
+    };
+    const auto beforeRaw = DecodeMetrics::global().stageLatency(DecodeMetrics::OpenStage).count();
+    QCOMPARE(readScaled(QSize(500, 750)).size(), QSize(500, 750));
+    QCOMPARE(DecodeMetrics::global().stageLatency(DecodeMetrics::OpenStage).count(), beforeRaw + 1);
+    QCOMPARE(readScaled(QSize(400, 600)).size(), QSize(400, 600));
+    QCOMPARE(DecodeMetrics::global().stageLatency(DecodeMetrics::OpenStage).count(), beforeRaw + 1);
+
+    // everything else is left to LibRaw
+    QBuffer png;
+    png.open(QIODevice::WriteOnly);
+    QVERIFY(image.save(&png, "PNG"));
+    png.close();
+    png.open(QIODevice::ReadOnly);
+    PreviewLocator pngLocator(&png);
+    QVERIFY(!pngLocator.locate(&preview));
+}
+
+void QtRawTest::unpackCache()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    auto& cache = UnpackCache::global();
+    cache.setDirectory(directory.path());
+    const auto cacheFiles = [&directory]
+    {
+        return QDir(directory.path()).entryList({QStringLiteral("*.unpacked")}, QDir::Files);
+    };
+
+    auto parameters = DevelopParameters{};
+    parameters.halfSize = true;
+    const auto develop = [&parameters](QImage* image)
+    {
+        RawDeveloper developer;
+        return developer.open(QStringLiteral("testimage.arw")) &&
+               developer.develop(parameters, QSize(), image);
+    };
+
+    QImage unpacked;
+    QVERIFY(develop(&unpacked));
+    QCOMPARE(cacheFiles().size(), 1);
+
+    // the second time the mosaic comes from the cache file
+    QImage cached;
+    QVERIFY(develop(&cached));
+    QCOMPARE(cached.size(), unpacked.size());
+    QVERIFY(cached == unpacked);
+
+    // the orientation belongs to the read, not to the cache file
+    auto options = SyntheticRawOptions{};
+    options.size = QSize(600, 400);
+    options.previewSize = QSize();
+    options.orientation = 6;
+    const auto rotatedName = directory.filePath(QStringLiteral("rotated.dng"));
+    QFile rotated(rotatedName);
+    QVERIFY(rotated.open(QIODevice::WriteOnly));
+    QVERIFY(rotated.write(SyntheticRaw::render(QStringLiteral("patches"), options)) > 0);
+    rotated.close();
+    const auto readRotated = [&rotatedName](bool applyOrientation)
+    {
+        QFile file(rotatedName);
+        file.open(QIODevice::ReadOnly);
+        file.setProperty("qtraw_apply_orientation", applyOrientation);
+        QImageReader reader(&file, "dng");
+        reader.setAutoTransform(false);
+        return reader.read();
+    };
+    QCOMPARE(readRotated(true).size(), QSize(400, 600));
+    QCOMPARE(cacheFiles().size(), 2);
+    const auto sensor = readRotated(false);
+    QCOMPARE(sensor.size(), QSize(600, 400));
+    QVERIFY(qGray(sensor.pixel(300, 2)) > 200);
+    const auto oriented = readRotated(true);
+    QCOMPARE(oriented.size(), QSize(400, 600));
+    QVERIFY(qGray(oriented.pixel(397, 300)) > 200);
+    QCOMPARE(cacheFiles().size(), 2);
+
+    // a file that doesn't fit into the limit is evicted right away
+    cache.clear();
+    QCOMPARE(cacheFiles().size(), 0);
+    cache.setMaxSize(1);
+    QVERIFY(develop(&cached));
+    QCOMPARE(cacheFiles().size(), 0);
+
+    cache.setMaxSize(UnpackCache::DefaultMaxSize);
+    cache.setDirectory(QString());
+}
+
+void QtRawTest::thumbnailServer()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const auto cacheDirectory = directory.filePath(QStringLiteral("thumbnails"));
+    const auto name = QStringLiteral("qtraw-test-%1").arg(QCoreApplication::applicationPid());
+    ThumbnailServer server(cacheDirectory, 2);
+    QVERIFY(server.listen(name));
+
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    QVERIFY(socket.waitForConnected());
+    const auto send = [&socket](const QJsonObject& request)
+    {
+        socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n');
+        // the server answers on the event loop of this thread
+        QTRY_VERIFY_WITH_TIMEOUT(socket.canReadLine(), 30000);
+    };
+    const auto request = [&socket, &send](int width)
+    {
+        send({{"path", QFileInfo(QStringLiteral("testimage.arw")).absoluteFilePath()},
+              {"width", width},
+              {"height", width}});
+        return QJsonDocument::fromJson(socket.readLine()).object();
+    };
+    const auto cacheFiles = [&cacheDirectory]
+    {
+        return QDir(cacheDirectory).entryInfoList(QDir::Files);
+    };
+
+    // the first request decodes, the second one is answered from the cache
+    auto answer = request(160);
+    QCOMPARE(answer.value("status").toString(), QStringLiteral("ok"));
+    QCOMPARE(answer.value("cached").toBool(), false);
+    const auto file = answer.value("file").toString();
+    QCOMPARE(QImage(file).size().width(), 160);
+    answer = request(160);
+    QCOMPARE(answer.value("status").toString(), QStringLiteral("ok"));
+    QCOMPARE(answer.value("cached").toBool(), true);
+    QCOMPARE(answer.value("file").toString(), file);
+    send({{"command", "stats"}});
+    QCOMPARE(QJsonDocument::fromJson(socket.readLine()).object().value("cacheHits").toInt(), 1);
+    QCOMPARE(cacheFiles().size(), 1);
+
+    // the thumbnail that was requested least recently is evicted first
+    answer = request(120);
+    QCOMPARE(answer.value("cached").toBool(), false);
+    QCOMPARE(cacheFiles().size(), 2);
+    request(160);
+    server.setMaxCacheSize(QFileInfo(file).size());
+    QCOMPARE(cacheFiles().size(), 1);
+    QVERIFY(QFile::exists(file));
+
+    // a thumbnail that doesn't fit into the limit is evicted right away
+    server.setMaxCacheSize(0);
+    QCOMPARE(cacheFiles().size(), 0);
+    answer = request(120);
+    QCOMPARE(answer.value("status").toString(), QStringLiteral("ok"));
+    QCOMPARE(cacheFiles().size(), 0);
+}
+
+void QtRawTest::indexer()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const auto root = directory.filePath(QStringLiteral("photos"));
+    QVERIFY(QDir().mkpath(root + QStringLiteral("/day")));
+    const auto first = root + QStringLiteral("/a.arw");
+    const auto second = root + QStringLiteral("/day/b.arw");
+    QVERIFY(QFile::copy(QStringLiteral("testimage.arw"), first));
+    QVERIFY(QFile::copy(QStringLiteral("testimage.arw"), second));
+
+    Catalog catalog;
+    QVERIFY(catalog.open(directory.filePath(QStringLiteral("catalog.db"))));
+    auto options = IndexOptions{};
+    options.jobs = 2;
+    const auto index = [&catalog, &options, &root]
+    {
+        Indexer indexer(&catalog, options);
+        indexer.run({root});
+        return indexer.counts();
+    };
+
+    auto counts = index();
+    QCOMPARE(counts.indexed, 2);
+    QCOMPARE(counts.failed, 0);
+    QCOMPARE(counts.unchanged, 0);
+    QCOMPARE(catalog.stamps().size(), 2);
+
+    // the second run skips the files whose size and time have not changed
+    counts = index();
+    QCOMPARE(counts.indexed, 0);
+    QCOMPARE(counts.unchanged, 2);
+    QCOMPARE(counts.removed, 0);
+
+    // a changed file is indexed again, a deleted one leaves the catalog
+    QFile changed(first);
+    QVERIFY(changed.open(QIODevice::Append));
+    QVERIFY(changed.write(QByteArray(16, '\0')) == 16);
+    changed.close();
+    QVERIFY(QFile::remove(second));
+    counts = index();
+    QCOMPARE(counts.indexed, 1);
+    QCOMPARE(counts.unchanged, 0);
+    QCOMPARE(counts.removed, 1);
+    QCOMPARE(catalog.stamps().keys(), QStringList{QFileInfo(first).absoluteFilePath()});
+
+    // forced runs index the unchanged files as well
+    options.force = true;
+    counts = index();
+    QCOMPARE(counts.indexed, 1);
+    QCOMPARE(counts.unchanged, 0);
+}
+
 QTEST_MAIN(QtRawTest)
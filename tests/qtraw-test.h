@@ -31,8 +31,30 @@ private Q_SLOTS:
     void initTestCase();
     void cleanupTestCase();
 
+    void supportedFormats();
     void loadRaw();
     void loadRawWithReader();
+    void readIntoExistingImage();
+    void imageCount();
+    void loadRawFromSequentialDevice();
+    void loadRawFromFinishedProcess();
+    void outputColorSpace();
+    void orientation();
+    void cancelDecode();
+    void loadRawFromBuffer();
+    void developTwice();
+    void statistics();
+    void readHeaders();
+    void readMosaic();
+    void bufferPool();
+    void sharedFrame();
+    void decodeAsync();
+    void decodeMetrics();
+    void libRawPool();
+    void previewLocator();
+    void unpackCache();
+    void thumbnailServer();
+    void indexer();
 };
 
 #endif /* QTRAW_TEST_H */
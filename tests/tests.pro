@@ -3,12 +3,35 @@ include(../common-config.pri)
 TARGET = qtraw-test
 
 QT += \
+    network \
+    sql \
     testlib
+CONFIG += c++14
+
+# the core library is linked, the image format plugin is loaded
+include(../src/qtraw-core.pri)
+
+# the rotated fixtures are rendered as synthetic DNGs
+INCLUDEPATH += ../qtraw-quality
+# the thumbnail daemon and the indexer are tested without their processes
+INCLUDEPATH += \
+    ../qtraw-convert \
+    ../qtraw-index \
+    ../qtraw-thumbd
 
 SOURCES += \
+    ../qtraw-index/catalog.cpp \
+    ../qtraw-index/indexer.cpp \
+    ../qtraw-quality/synthetic-raw.cpp \
+    ../qtraw-thumbd/thumbnail-server.cpp \
     qtraw-test.cpp
 
 HEADERS += \
+    ../qtraw-convert/work-queue.h \
+    ../qtraw-index/catalog.h \
+    ../qtraw-index/indexer.h \
+    ../qtraw-quality/synthetic-raw.h \
+    ../qtraw-thumbd/thumbnail-server.h \
     qtraw-test.h
 
 check.commands = "QT_PLUGIN_PATH=$${TOP_BUILD_DIR}/src ./qtraw-test"